@@ -0,0 +1,82 @@
+/**
+* actuator.c - Actuator daemon client support functions
+*
+*/
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "actuator.h"
+
+bool connect_actuator(ACTUATOR_CONNECTION *connection) {
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, ACTUATOR_SOCKET, sizeof(address.sun_path) - 1);
+    
+    connection->fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (connection->fd < 0) {
+        return false;
+    }
+    if (connect(connection->fd, (struct sockaddr *) &address, sizeof(address)) < 0) {
+        close(connection->fd);
+        return false;
+    }
+    connection->replies = fdopen(dup(connection->fd), "r");
+    if (connection->replies == NULL) {
+        close(connection->fd);
+        return false;
+    }
+    return true;
+}
+
+void disconnect_actuator(ACTUATOR_CONNECTION *connection) {
+    fclose(connection->replies);
+    close(connection->fd);
+}
+
+bool send_actuator_command(ACTUATOR_CONNECTION *connection, char *command) {
+    // One write per command - several may be sent before reading replies
+    char line[ACTUATOR_LINE_MAX];
+    int length = snprintf(line, sizeof(line), "%s\n", command);
+    if (length <= 0 || length >= (int) sizeof(line)) {
+        return false;
+    }
+    return write(connection->fd, line, length) == length;
+}
+
+bool read_actuator_reply(ACTUATOR_CONNECTION *connection, long *result) {
+    // Returns false on "err" replies or a closed connection
+    char *line = connection->reply;
+    line[0] = '\0';
+    if (fgets(line, sizeof(connection->reply), connection->replies) == NULL) {
+        fprintf(stderr, "Actuator daemon closed connection!\n");
+        return false;
+    }
+    if (strncmp(line, "ok ", 3) != 0) {
+        fprintf(stderr, "Actuator daemon: %s", line);
+        return false;
+    }
+    *result = atol(line + 3);
+    return true;
+}
+
+bool actuator_command(ACTUATOR_CONNECTION *connection, char *command, long *result) {
+    return send_actuator_command(connection, command) && read_actuator_reply(connection, result);
+}
+
+bool actuator_halted(ACTUATOR_CONNECTION *connection) {
+    // Whether the last motion reply was halted by a sensor - not just paused on the way to its end
+    long interrupted_duration;
+    long executed_us;
+    char halt_cause[16];
+    int fields = sscanf(connection->reply, "ok %ld %ld %15s", &interrupted_duration, &executed_us, halt_cause);
+    if (fields == 3) {
+        return strcmp(halt_cause, "done") != 0;
+    }
+    return fields >= 1 && interrupted_duration != 0;
+}
@@ -0,0 +1,54 @@
+/**
+* actuator.h - Actuator daemon protocol
+*
+* actuatord owns the motor, lights, laser and buzzer GPIO pins. Clients
+* connect to ACTUATOR_SOCKET and send one command per line. Commands may
+* be pipelined; they run in order and each gets one reply line,
+* "ok <result>" or "err <reason>". A path is the rest of the line, spaces
+* and all, less any trailing halts. Lines of ACTUATOR_LINE_MAX or more
+* are refused with "err too long" and not run.
+*
+*   motion <motion> [halts]     result is the interrupted duration in millisecs, followed
+*                               by the usecs actually driven and what halted it, e.g.
+*                               "ok 412 587630 impact_f" or "ok 0 1000081 done" - a motion
+*                               that paused for an obstacle and then ran to its end is
+*                               interrupted but "done"
+*   trim <left> <right>         percent of motion speed for each motor, result is 0
+*   load <path> [halts]         compile a motion script, result is its op count
+*   run                         run the loaded script, result as for motion
+*   script <path> [halts]       load and run
+*   lights on|off               result is 0
+*   laser on|off                result is 0
+*   buzzer <1-1023>|off         result is 0
+*
+* Clients are served one at a time, since only one can drive the motors.
+* A motion leaves the motors running, so pipelined motions run back to
+* back - they stop when the client disconnects, or sends no further
+* motion for ACTUATOR_IDLE_MS. A motion a sensor halts has stopped them
+* already.
+*/
+
+#ifndef ACTUATOR_H
+#define ACTUATOR_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#define ACTUATOR_SOCKET     "/dev/shm/uv1_actuator"
+#define ACTUATOR_LINE_MAX   256
+#define ACTUATOR_IDLE_MS    100     // Motors stop this long after a motion if no command follows
+
+typedef struct {
+    int fd;
+    FILE *replies;          // Buffered reader over fd
+    char reply[ACTUATOR_LINE_MAX];      // Last reply line read
+} ACTUATOR_CONNECTION;
+
+bool connect_actuator(ACTUATOR_CONNECTION *);
+void disconnect_actuator(ACTUATOR_CONNECTION *);
+bool send_actuator_command(ACTUATOR_CONNECTION *, char *);
+bool read_actuator_reply(ACTUATOR_CONNECTION *, long *);
+bool actuator_command(ACTUATOR_CONNECTION *, char *, long *);
+bool actuator_halted(ACTUATOR_CONNECTION *);
+
+#endif
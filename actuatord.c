@@ -0,0 +1,380 @@
+/**
+* actuatord.c - Actuator daemon service - owns the motor, lights, laser
+* and buzzer GPIO pins and runs commands sent over ACTUATOR_SOCKET
+*
+* compile with sensors.o pwm.o motion.o motion_script.o + a GPIO backend + -pthread
+*/
+
+#include <ctype.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "gpio.h"
+#include "gpio_pins.h"
+#include "sensors.h"
+#include "pwm.h"
+#include "motion.h"
+#include "motion_script.h"
+#include "actuator.h"
+
+void terminate_signal_handler(int sig);
+
+int open_actuator_socket(void);
+void serve_client(int);
+void stop_motors(void);
+void motion_done(MOTION_RESULT *);
+void run_command(char *, char *, int);
+int parse_command(char *, char *, char *, int *);
+void motion_reply(char *, int, int, MOTION_RESULT *);
+bool run_switch(int, char *);
+bool run_buzzer(char *);
+
+static SENSOR_MEMORY *sensor_memory;
+static MOTION_SCRIPT loaded_script;     // Compiled by "load", run by "run"
+static bool motors_running = false;     // Left on by the last motion until the client idles or goes
+static uint64_t idle_ns;                // When they stop if no other motion comes first
+
+static volatile bool TERMINATE_SIGNAL_RECEIVED = false;
+
+int main(void) {
+
+    // Register signal handlers for graceful termination
+    // No SA_RESTART, so a blocked accept or read returns and we can exit
+
+    struct sigaction terminate_action;
+    memset(&terminate_action, 0, sizeof(terminate_action));
+    terminate_action.sa_handler = terminate_signal_handler;
+    int signals[] = { SIGINT, SIGTERM, SIGHUP, SIGQUIT, SIGABRT };
+    int i;
+    for (i = 0; i < (int) (sizeof(signals) / sizeof(signals[0])); i++) {
+        if (sigaction(signals[i], &terminate_action, NULL) < 0) {
+            fprintf(stderr, "Cannot handle signal %d!\n", signals[i]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    signal(SIGPIPE, SIG_IGN);      // Client went away - write fails instead
+
+    // Access sensor memory - read-write without create, to publish motion state
+    if (access_sensor_memory( &sensor_memory, 0 ) < 0)
+    {
+        fprintf(stderr, "Cannot access sensor memory!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    /**
+    * GPIO initialization - once for all commands
+    **/
+
+    if (setup_gpio() < 0) {
+        fprintf(stderr, "Cannot set up GPIO!\n");
+        release_sensor_memory(sensor_memory);
+        exit(EXIT_FAILURE);
+    }
+    setup_motion(sensor_memory);
+    start_pwm(&sensor_memory->pwm_stats);
+    set_pin_mode (LIGHTS_GPIO, OUTPUT);
+    set_pin_mode (LASER_GPIO, OUTPUT);
+    set_pin_mode (BUZZER_GPIO, OUTPUT);
+    write_pin (BUZZER_GPIO, LOW);
+    set_pin_mode (BUZZER_GPIO, PWM_OUTPUT);
+    execute_motion(MOTORS_OFF, 0, NULL);
+
+    int listen_fd = open_actuator_socket();
+    if (listen_fd < 0) {
+        release_sensor_memory(sensor_memory);
+        exit(EXIT_FAILURE);
+    }
+
+    // Serve one client at a time
+
+    while (!TERMINATE_SIGNAL_RECEIVED) {
+        int client_fd = accept(listen_fd, NULL, NULL);
+        if (client_fd < 0) {
+            continue;       // Interrupted by signal
+        }
+        serve_client(client_fd);
+    }
+
+    // Before termination, stop motors
+    execute_motion(MOTORS_OFF, 0, NULL);
+    stop_pwm();
+    write_pin_pwm(BUZZER_GPIO, 0);
+
+    close(listen_fd);
+    unlink(ACTUATOR_SOCKET);
+    release_sensor_memory(sensor_memory);
+
+    exit(EXIT_SUCCESS);
+}
+
+int open_actuator_socket() {
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, ACTUATOR_SOCKET, sizeof(address.sun_path) - 1);
+
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd < 0) {
+        fprintf(stderr, "Cannot create actuator socket!\n");
+        return -1;
+    }
+
+    unlink(ACTUATOR_SOCKET);    // Left over from a previous run
+    if (bind(listen_fd, (struct sockaddr *) &address, sizeof(address)) < 0
+            || listen(listen_fd, 8) < 0) {
+        fprintf(stderr, "Cannot listen on %s!\n", ACTUATOR_SOCKET);
+        close(listen_fd);
+        return -1;
+    }
+    chmod(ACTUATOR_SOCKET, 0666);
+    return listen_fd;
+}
+
+void serve_client(int client_fd) {
+    // Pipelined commands are buffered here and run in order. A motion leaves the motors
+    // running, so the next one carries straight on as the motors app's steps always have -
+    // they stop once the client goes away, or runs no motion for ACTUATOR_IDLE_MS. Other
+    // commands in between don't put that off
+    char buffer[ACTUATOR_LINE_MAX];
+    char reply[ACTUATOR_LINE_MAX];
+    int buffered = 0;
+    bool discarding = false;    // Rest of a line too long to run
+
+    while (!TERMINATE_SIGNAL_RECEIVED) {
+        char *newline = memchr(buffer, '\n', buffered);
+        if (newline == NULL && (discarding || buffered == sizeof(buffer) - 1)) {
+            // Never run the truncated start of a line - refuse it once, drop it through its newline
+            if (!discarding) {
+                int length = snprintf(reply, sizeof(reply), "err too long\n");
+                if (write(client_fd, reply, length) != length) {
+                    break;
+                }
+            }
+            discarding = true;
+            buffered = 0;
+        } else if (newline != NULL) {
+            int used = newline + 1 - buffer;
+            *newline = '\0';
+            if (!discarding) {
+                run_command(buffer, reply, sizeof(reply));
+                int length = strlen(reply);
+                if (write(client_fd, reply, length) != length) {
+                    break;
+                }
+            }
+            discarding = false;
+            buffered -= used;
+            memmove(buffer, buffer + used, buffered);
+            continue;
+        }
+
+        int timeout_ms = -1;
+        if (motors_running) {
+            uint64_t now_ns = monotonic_ns();
+            if (now_ns >= idle_ns) {
+                stop_motors();
+                continue;
+            }
+            timeout_ms = (idle_ns - now_ns + 999999) / 1000000;
+        }
+        struct pollfd client = { .fd = client_fd, .events = POLLIN };
+        int ready = poll(&client, 1, timeout_ms);
+        if (ready == 0) {
+            continue;       // Idle - stopped at the top of the loop
+        }
+        if (ready < 0) {
+            continue;       // Interrupted by signal
+        }
+        int received = read(client_fd, buffer + buffered, sizeof(buffer) - 1 - buffered);
+        if (received <= 0) {
+            break;
+        }
+        buffered += received;
+    }
+
+    stop_motors();
+    close(client_fd);
+}
+
+void stop_motors() {
+    if (motors_running) {
+        execute_motion(MOTORS_OFF, 0, NULL);
+        motors_running = false;
+    }
+}
+
+void motion_done(MOTION_RESULT *result) {
+    // A halted motion has already stopped the motors in run_motion - only one that ran
+    // its course leaves them on, until the idle deadline
+    if (result->halt_cause != 0) {
+        motors_running = false;
+        return;
+    }
+    motors_running = true;
+    idle_ns = monotonic_ns() + ACTUATOR_IDLE_MS * 1000000ULL;
+}
+
+void run_command(char *line, char *reply, int reply_size) {
+    char verb[16];
+    char arg[ACTUATOR_LINE_MAX];
+    int halts = HALT_DEFAULT;
+
+    int fields = parse_command(line, verb, arg, &halts);
+    MOTION_RESULT result;
+    if (fields == 1 && strcmp("run", verb) == 0) {
+        int interrupted_duration = run_motion_script(&loaded_script, sensor_memory, &result);
+        motion_done(&result);
+        motion_reply(reply, reply_size, interrupted_duration, &result);
+        return;
+    }
+    if (fields < 2) {
+        snprintf(reply, reply_size, "err syntax\n");
+        return;
+    }
+
+    if (strcmp("motion", verb) == 0) {
+        if (motion_syntax_err(arg)) {
+            snprintf(reply, reply_size, "err motion %s\n", arg);
+            return;
+        }
+        int interrupted_duration = execute_motion(arg, halts, &result);
+        motion_done(&result);
+        motion_reply(reply, reply_size, interrupted_duration, &result);
+        return;
+    }
+
+    if (strcmp("trim", verb) == 0) {
+        int left_trim;
+        int right_trim;
+        if (sscanf(line, "%*s %d %d", &left_trim, &right_trim) != 2
+                || left_trim <= 0 || left_trim > PWM_FULL || right_trim <= 0 || right_trim > PWM_FULL) {
+            snprintf(reply, reply_size, "err trim\n");
+            return;
+        }
+        set_motor_trim(left_trim, right_trim);
+        snprintf(reply, reply_size, "ok 0\n");
+        return;
+    }
+
+    if (strcmp("load", verb) == 0 || strcmp("script", verb) == 0) {
+        int op_count = load_motion_script(arg, &loaded_script, halts);
+        if (op_count < 0) {
+            loaded_script.count = 0;
+            snprintf(reply, reply_size, "err script %s line %d\n", arg, -op_count);
+            return;
+        }
+        if (strcmp("load", verb) == 0) {
+            snprintf(reply, reply_size, "ok %d\n", op_count);
+            return;
+        }
+        int interrupted_duration = run_motion_script(&loaded_script, sensor_memory, &result);
+        motion_done(&result);
+        motion_reply(reply, reply_size, interrupted_duration, &result);
+        return;
+    }
+
+    bool ok = false;
+    if (strcmp("lights", verb) == 0) {
+        ok = run_switch(LIGHTS_GPIO, arg);
+    } else if (strcmp("laser", verb) == 0) {
+        ok = run_switch(LASER_GPIO, arg);
+    } else if (strcmp("buzzer", verb) == 0) {
+        ok = run_buzzer(arg);
+    }
+
+    if (ok) {
+        snprintf(reply, reply_size, "ok 0\n");
+    } else {
+        snprintf(reply, reply_size, "err %s %s\n", verb, arg);
+    }
+}
+
+int parse_command(char *line, char *verb, char *arg, int *halts) {
+    // The verb, then the rest of the line as its argument - a path may hold spaces - less
+    // any trailing halts. Returns the fields found, as sscanf would
+    int verb_end;
+    if (sscanf(line, "%15s%n", verb, &verb_end) != 1) {
+        return 0;
+    }
+    char *rest = line + verb_end;
+    rest += strspn(rest, " \t");
+    int length = strlen(rest);
+    while (length > 0 && isspace((unsigned char) rest[length - 1])) {
+        length--;
+    }
+    if (length == 0) {
+        return 1;
+    }
+    memcpy(arg, rest, length);
+    arg[length] = '\0';
+
+    char *last = arg + length;
+    while (last > arg && !isspace((unsigned char) last[-1])) {
+        last--;
+    }
+    char *end;
+    long value = strtol(last, &end, 10);
+    if (last == arg || *end != '\0') {
+        return 2;
+    }
+    *halts = value;
+    while (last > arg && isspace((unsigned char) last[-1])) {
+        last--;
+    }
+    *last = '\0';
+    return 3;
+}
+
+void motion_reply(char *reply, int reply_size, int interrupted_duration, MOTION_RESULT *result) {
+    // Interrupted millisecs first, as clients have always read it, then what actually ran
+    snprintf(reply, reply_size, "ok %d %ld %s\n", interrupted_duration, result->executed_us,
+                halt_cause_name(result->halt_cause));
+}
+
+bool run_switch(int pin, char *setting) {
+    if (strcmp("on", setting) == 0) {
+        write_pin(pin, HIGH);
+        return true;
+    }
+    if (strcmp("off", setting) == 0) {
+        write_pin(pin, LOW);
+        return true;
+    }
+    return false;
+}
+
+bool run_buzzer(char *setting) {
+    if (strcmp("off", setting) == 0) {
+        write_pin_pwm(BUZZER_GPIO, 0);
+        return true;
+    }
+
+    // Ramp up to freq and back down, 1 msec per step
+    int freq = atoi(setting);
+    if (freq <= 0 || freq >= 1024) {
+        return false;
+    }
+    int i;
+    for (i = 0; i < freq; i++) {
+        write_pin_pwm(BUZZER_GPIO, i);
+        delay_ms(1);
+    }
+    for (i = freq; i >= 0; i--) {
+        write_pin_pwm(BUZZER_GPIO, i);
+        delay_ms(1);
+    }
+    return true;
+}
+
+void terminate_signal_handler(int sig) {
+    (void) sig;
+    TERMINATE_SIGNAL_RECEIVED = true;
+}
@@ -1,58 +1,45 @@
 /**
-* buzzer.c - Control uv1 forward laser
+* buzzer.c - Control uv1 buzzer
 * 
 * Oren Camber 2014-06-21
 *
-* compile with -lwiringPi
+* Client of actuatord - compile with actuator.o
 */
 
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <wiringPi.h>
-#include "gpio_pins.h"
+#include <stdbool.h>
+#include "actuator.h"
 
 int main(int argc, char **argv)
 {
     int ok = 0;
-        
-    wiringPiSetupGpio();
-    pinMode (BUZZER_GPIO, OUTPUT);
-    digitalWrite (BUZZER_GPIO, LOW);
-    pinMode (BUZZER_GPIO, PWM_OUTPUT);
     
     if (argc == 2)
     {
-        if (strcmp("off", argv[1]) == 0) 
-        {
-            ok = 1;
-        }
-        else
-        {
-            int freq = atoi(argv[1]);
-            if (freq > 0 && freq < 1024) 
-            {
-                ok = 1;
-                int i;
-                for (i=0; i<freq; i++) 
-                {
-                    pwmWrite(BUZZER_GPIO, i);
-                    delay(1);
-                }
-                for (i=freq; i>=0; i--) 
-                {
-                    pwmWrite(BUZZER_GPIO, i);
-                    delay(1);
-                }
-            }
-        }
+        int freq = atoi(argv[1]);
+        ok = strcmp("off", argv[1]) == 0 || (freq > 0 && freq < 1024);
     }
     if (!ok)
     {
         printf("Usage: buzzer [1-1023] -or- buzzer off\n");
+        return 0;
     }
-    return 0;
+    
+    ACTUATOR_CONNECTION actuator;
+    if (!connect_actuator(&actuator))
+    {
+        fprintf(stderr, "Cannot connect to actuator daemon!\n");
+        return 1;
+    }
+    
+    // Daemon ramps the buzzer up to freq and back down
+    char command[ACTUATOR_LINE_MAX];
+    long result;
+    snprintf(command, sizeof(command), "buzzer %s", argv[1]);
+    ok = actuator_command(&actuator, command, &result);
+    disconnect_actuator(&actuator);
+    return ok ? 0 : 1;
 
 } // main
-
-
@@ -0,0 +1,662 @@
+/**
+* controld.c - Controller daemon - explores on its own like uv1-simple.py,
+* reacting to sensord changes in microseconds instead of a polling loop
+*
+* Usage: controld [-l log_dir] [-s seed] [-t run_secs] [-v]
+*
+* One epoll loop picks each next move. It wakes on:
+*   sensor changes      the halt_events futex, bridged to an eventfd by a thread
+*   motion done         eventfd from the motion thread
+*   survey, turn        timerfds, due at random intervals
+*   run end, signals    timerfd for -t, signalfd
+* Motions run on their own thread through execute_motion, so run_motion
+* halts them, stopping the motors, and the loop only decides what comes
+* next.
+*
+* Behaviour follows uv1-simple.py:
+*   sound               stop exploring
+*   obstacle, impact    back away, then rotate 90-180 degrees
+*   range < 10 cm       rotate 90-180 degrees
+*   survey due          one full turn in place as a range sweep, then
+*                       rotate to the best heading it found and go
+*                       forward towards it, up to 30 cm
+*   turn due            rotate towards the nearest frontier in the map,
+*                       or -45 to 45 degrees if there is none
+*   otherwise           forward 10-30 cm
+* Flags sensord latches are reset once avoided, level tracked ones
+* (sensord -l) are left to clear themselves.
+*
+* Every range reading sensord logs goes into an occupancy grid (mapper.c)
+* at the pose dead reckoned from the motions executed, interpolated
+* through the motion that was running when it was taken. Frontiers - free
+* cells next to unexplored ones - steer the turns.
+*
+* -l logs every sensor event and motion to a telemetry log (telemetry.c)
+* in log_dir - uv1log reads it back.
+*
+* -s seeds the random choices, so runs against the GPIO simulator repeat;
+* without it the seed comes from the clock. -v prints each decision.
+* On exit it prints the reaction time from the sensor edge (its kernel
+* timestamp in the event log) to the motion that answers it starting,
+* and for halted motions from the edge that halted one to run_motion
+* stopping the motors.
+*
+* Owns the motor pins - do not run alongside actuatord.
+*
+* compile with sensors.o pwm.o motion.o mapper.o heading.o telemetry.o + a GPIO backend + -pthread -lm
+*/
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include "gpio.h"
+#include "sensors.h"
+#include "pwm.h"
+#include "motion.h"
+#include "mapper.h"
+#include "heading.h"
+#include "telemetry.h"
+
+// Same tuning as uv1-simple.py
+#define MOTOR_TRIM_LEFT         100     // Percent of motion speed per motor, so it drives straight
+#define MOTOR_TRIM_RIGHT        95
+#define MOTOR_MS_PER_DEG        5.83
+#define MOTOR_MS_PER_CM         52.5
+#define MIN_FORWARD_CM          10
+#define MAX_FORWARD_CM          30
+#define MIN_RANGE_CM            10      // Closer than this, turn away
+#define BACK_AWAY               "RR200"
+#define SURVEY_DEGREES          360     // Sweep turn - best_heading's headings are from where it started
+#define SURVEY_EVERY_MS         10000   // Surveys come at random, this to twice this apart
+#define TURN_EVERY_MS           2500    // Likewise heading changes
+
+#define BRIDGE_TIMEOUT_NS       100000000L  // Sensor bridge checks for shutdown this often
+#define REACTION_SAMPLES        4096
+
+// What the loop is in the middle of
+#define MODE_EXPLORE            0
+#define MODE_BACK_AWAY          1       // Rotate away next
+#define MODE_SURVEY             2       // Sweeping - pick a heading from its profile next
+#define MODE_HEAD_OUT           3       // Turning to the survey's heading - go forward next
+
+void *motion_thread(void *);
+void *sensor_bridge(void *);
+int add_timer(int);
+void arm_timer(int, long);
+void start_motion(char *, int, uint64_t, char *);
+void start_sweep(int, int);
+void decide(void);
+bool rotate(int, int, uint64_t, char *);
+bool survey_heading(int *);
+int random_between(int, int);
+uint64_t latest_edge_ns(uint32_t);
+void map_reading(SENSOR_EVENT *);
+void print_reactions(void);
+int compare_ns(const void *, const void *);
+
+static SENSOR_MEMORY *sensor_memory;
+static int epoll_fd;
+static int sensor_fd;               // eventfd - sensor bridge
+static int motion_fd;               // eventfd - motion thread
+static int survey_timer;
+static int turn_timer;
+static int run_timer;
+static volatile bool stopping = false;
+static bool verbose = false;
+
+// Motion thread handoff
+static pthread_mutex_t motion_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t motion_queued = PTHREAD_COND_INITIALIZER;
+static char queued_motion[16];
+static int queued_halts;
+static uint64_t queued_edge_ns;     // Edge the motion answers, 0 if none
+static bool queued_sweep;           // Run it with run_sweep - queued_motion is the same turn, for dead reckoning
+static bool queued = false;
+
+// Loop state - main thread only
+static int mode = MODE_EXPLORE;
+static bool moving = false;
+static bool survey_due = false;
+static bool turn_due = false;
+static uint64_t survey_ns;          // Survey sweep queued - an older profile is not its own
+static int survey_cm;               // Forward towards the survey's heading, once turned to it
+static uint32_t latched_state;      // STATE_* flags sensord latches - reset once avoided
+static uint64_t decided_ns = 0;     // Last decision - later edges are what the next one answers
+static uint64_t start_ns;
+static uint64_t random_state;
+static SENSOR_EVENT_CURSOR event_cursor;
+static uint64_t edge_ns[SENSOR_ID_COUNT];  // Latest set or reading per SENSOR_ID_*, from the event log
+static MAP_POSE pose;               // Dead reckoned, after the last motion finished
+static MAP_POSE motion_pose;        // ...and before it started
+static char mapped_motion[16];      // The last motion, as the motion thread ran it
+static uint64_t mapped_start_ns;
+static long mapped_us;
+static uint64_t halt_stopped_ns;    // The last motion halted and stopped the motors then, 0 if it didn't
+static uint32_t halt_cause;
+static uint64_t stops[REACTION_SAMPLES];   // Halting edge to motors stopped
+static int stop_count = 0;
+
+// Motion thread to loop - the motion just done, under motion_mutex
+static char done_motion[16];
+static uint64_t done_start_ns;
+static long done_us;
+static uint64_t done_stopped_ns;
+static uint32_t done_halt_cause;
+
+// Written by the motion thread, read after it is joined
+static uint64_t reactions[REACTION_SAMPLES];
+static int reaction_count = 0;
+static uint64_t motions = 0;
+static uint64_t halted = 0;
+static uint64_t late_us = 0;          // Completed motions' time past their deadlines
+
+int main(int argc, char **argv) {
+    bool ok_args = true;
+    bool seeded = false;
+    long run_secs = 0;
+    const char *log_dir = NULL;
+    int option;
+    while ((option = getopt(argc, argv, "l:s:t:v")) != -1) {
+        switch (option) {
+            case 'l':
+                log_dir = optarg;
+                break;
+            case 's':
+                random_state = strtoull(optarg, NULL, 10);
+                seeded = true;
+                break;
+            case 't':
+                run_secs = atol(optarg);
+                ok_args = ok_args && run_secs > 0;
+                break;
+            case 'v':
+                verbose = true;
+                break;
+            default:
+                ok_args = false;
+        }
+    }
+    if (!ok_args || optind < argc) {
+        fprintf(stderr, "Usage: controld [-l log_dir] [-s seed] [-t run_secs] [-v]\n");
+        exit(EXIT_FAILURE);
+    }
+    start_ns = monotonic_ns();
+    if (!seeded) {
+        random_state = start_ns;
+    }
+    random_state = random_state * 2 + 1;    // Never 0
+
+    // Termination signals arrive on a signalfd - blocked before any thread starts, so all inherit it
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGHUP);
+    sigaddset(&signals, SIGQUIT);
+    sigprocmask(SIG_BLOCK, &signals, NULL);
+    int signal_fd = signalfd(-1, &signals, SFD_CLOEXEC);
+
+    // Read-write without create - sensord creates it
+    if (access_sensor_memory( &sensor_memory, 0 ) < 0)
+    {
+        fprintf(stderr, "Cannot access sensor memory!\n");
+        exit(EXIT_FAILURE);
+    }
+    int sensor_id;
+    for (sensor_id = SENSOR_ID_OBSTACLE_F; sensor_id < SENSOR_ID_COUNT; sensor_id++) {
+        if (sensor_memory->filter_stats.hold_us[sensor_id] < 0) {
+            latched_state |= STATE_FLAG(sensor_id);
+        }
+    }
+    open_sensor_event_cursor(sensor_memory, &event_cursor);
+    if (log_dir != NULL && open_telemetry(log_dir) < 0) {
+        fprintf(stderr, "Cannot open telemetry log in %s!\n", log_dir);
+        release_sensor_memory(sensor_memory);
+        exit(EXIT_FAILURE);
+    }
+
+    if (setup_gpio() < 0) {
+        fprintf(stderr, "Cannot set up GPIO!\n");
+        close_telemetry();
+        release_sensor_memory(sensor_memory);
+        exit(EXIT_FAILURE);
+    }
+    setup_motion(sensor_memory);
+    start_pwm(&sensor_memory->pwm_stats);
+    set_motor_trim(MOTOR_TRIM_LEFT, MOTOR_TRIM_RIGHT);
+    execute_motion(MOTORS_OFF, 0, NULL);
+    setup_map(MOTOR_MS_PER_CM, MOTOR_MS_PER_DEG);
+
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    sensor_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    motion_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    survey_timer = add_timer(SURVEY_EVERY_MS);
+    turn_timer = add_timer(TURN_EVERY_MS);
+    run_timer = add_timer(0);
+    if (run_secs > 0) {
+        arm_timer(run_timer, run_secs * 1000);
+    }
+    int watched[] = { sensor_fd, motion_fd, signal_fd };
+    int i;
+    for (i = 0; i < (int) (sizeof(watched) / sizeof(watched[0])); i++) {
+        struct epoll_event watch;
+        watch.events = EPOLLIN;
+        watch.data.fd = watched[i];
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, watched[i], &watch);
+    }
+
+    pthread_t motion;
+    pthread_t bridge;
+    if (signal_fd < 0 || sensor_fd < 0 || motion_fd < 0 || run_timer < 0
+            || pthread_create(&motion, NULL, motion_thread, NULL) != 0
+            || pthread_create(&bridge, NULL, sensor_bridge, NULL) != 0) {
+        fprintf(stderr, "Cannot start controller!\n");
+        execute_motion(MOTORS_OFF, 0, NULL);
+        stop_pwm();
+        close_telemetry();
+        release_sensor_memory(sensor_memory);
+        exit(EXIT_FAILURE);
+    }
+
+    decide();
+    while (!stopping) {
+        struct epoll_event ready[8];
+        int ready_count = epoll_wait(epoll_fd, ready, 8, -1);
+        if (ready_count < 0 && errno != EINTR) {
+            fprintf(stderr, "Controller loop failed!\n");
+            break;
+        }
+        bool sensors_changed = false;
+        bool motion_done = false;
+        for (i = 0; i < ready_count; i++) {
+            int fd = ready[i].data.fd;
+            uint64_t count;
+            if (read(fd, &count, sizeof(count)) <= 0 && fd != signal_fd) {
+                continue;       // Timer disarmed since it fired
+            }
+            if (fd == signal_fd) {
+                struct signalfd_siginfo info;
+                read(signal_fd, &info, sizeof(info));
+                stopping = true;
+            } else if (fd == run_timer) {
+                stopping = true;
+            } else if (fd == sensor_fd) {
+                sensors_changed = true;
+            } else if (fd == motion_fd) {
+                motion_done = true;
+            } else if (fd == survey_timer) {
+                survey_due = true;
+                arm_timer(survey_timer, random_between(SURVEY_EVERY_MS, SURVEY_EVERY_MS * 2));
+            } else if (fd == turn_timer) {
+                turn_due = true;
+                arm_timer(turn_timer, random_between(TURN_EVERY_MS, TURN_EVERY_MS * 2));
+            }
+        }
+        if (stopping) {
+            break;
+        }
+        if (motion_done) {
+            // Readings from here on are placed along this motion, then after it
+            moving = false;
+            pthread_mutex_lock(&motion_mutex);
+            strcpy(mapped_motion, done_motion);
+            mapped_start_ns = done_start_ns;
+            mapped_us = done_us;
+            halt_stopped_ns = done_stopped_ns;
+            halt_cause = done_halt_cause;
+            pthread_mutex_unlock(&motion_mutex);
+            motion_pose = pose;
+            move_pose(&pose, mapped_motion[0], mapped_motion[1], mapped_us);
+        }
+        // A running motion is halted by run_motion itself - sensor changes only matter between motions
+        if (!moving && (motion_done || sensors_changed)) {
+            decide();
+        }
+    }
+
+    // Finish the current motion, then stop
+    pthread_mutex_lock(&motion_mutex);
+    stopping = true;
+    pthread_cond_signal(&motion_queued);
+    pthread_mutex_unlock(&motion_mutex);
+    pthread_join(motion, NULL);
+    pthread_join(bridge, NULL);
+    execute_motion(MOTORS_OFF, 0, NULL);
+    stop_pwm();
+    close_telemetry();
+
+    print_reactions();
+    MAP_STATS map_stats;
+    read_map_stats(&map_stats);
+    printf("map %llu readings, %llu cell updates, %u tiles (%u KB), %u cells off the map, at %.0f, %.0f mm\n",
+            (unsigned long long) map_stats.rays, (unsigned long long) map_stats.cells, map_stats.tiles,
+            map_stats.tiles * MAP_TILE_CELLS * MAP_TILE_CELLS / 1024, map_stats.dropped, pose.x_mm, pose.y_mm);
+    release_sensor_memory(sensor_memory);
+    exit(EXIT_SUCCESS);
+}
+
+void decide() {
+    // Pick the next move from the sensor state, as uv1-simple.py's main loop does
+    SENSOR_EVENT event;
+    while (next_sensor_event(sensor_memory, &event_cursor, &event)) {
+        log_sensor_record(event.timestamp_ns, event.sensor_id, event.value);
+        if (event.value != 0) {
+            edge_ns[event.sensor_id] = event.timestamp_ns;
+        }
+        if (event.sensor_id == SENSOR_ID_RANGE) {
+            map_reading(&event);
+        }
+    }
+    if (halt_stopped_ns != 0) {
+        // The edge that halted the last motion is in the log by now - a ttc halt's is the range reading
+        uint64_t halt_edge_ns = latest_edge_ns((halt_cause & HALT_CAUSE_TTC) ? STATE_RANGE
+                                                : halt_cause & ~HALT_CAUSE_TTC);
+        if (halt_edge_ns != 0 && halt_edge_ns <= halt_stopped_ns && stop_count < REACTION_SAMPLES) {
+            stops[stop_count++] = halt_stopped_ns - halt_edge_ns;
+        }
+        halt_stopped_ns = 0;
+    }
+    uint32_t state = read_sensor_state(sensor_memory);
+    note_sensor_demand(sensor_memory);
+    int range = (state & STATE_RANGE_VALID) ? STATE_RANGE_CM(state) : 999;
+
+    if (state & STATE_SOUND) {
+        if (verbose) {
+            printf("%10.3f %-10s stop\n", (monotonic_ns() - start_ns) / 1e9, "sound");
+        }
+        stopping = true;
+        return;
+    }
+    if (mode == MODE_BACK_AWAY) {
+        reset_sensor_state(sensor_memory, latched_state & (STATE_OBSTACLE | STATE_IMPACT));
+        mode = MODE_EXPLORE;
+        if (rotate(random_between(90, 180), HALT_ON_IMPACT, 0, "avoid")) {
+            return;
+        }
+    }
+
+    // Avoiding ends a survey
+    if (state & (STATE_OBSTACLE | STATE_IMPACT)) {
+        mode = MODE_BACK_AWAY;
+        start_motion(BACK_AWAY, HALT_DEFAULT, latest_edge_ns(state & (STATE_OBSTACLE | STATE_IMPACT)),
+                        "obstacle");
+        return;
+    }
+    if (range < MIN_RANGE_CM) {
+        mode = MODE_EXPLORE;
+        rotate(random_between(90, 180), HALT_ON_IMPACT, latest_edge_ns(STATE_RANGE), "range");
+        return;
+    }
+
+    // Survey - sweep, turn to the clearest heading, go that way
+    if (mode == MODE_SURVEY) {
+        mode = MODE_EXPLORE;
+        int degrees;
+        if (survey_heading(&degrees)) {
+            mode = MODE_HEAD_OUT;
+            if (rotate(degrees, HALT_DEFAULT, 0, "heading")) {
+                return;
+            }
+        }
+    }
+    if (mode == MODE_HEAD_OUT) {
+        mode = MODE_EXPLORE;
+        char motion[16];
+        snprintf(motion, sizeof(motion), "FF%d", (int) (survey_cm * MOTOR_MS_PER_CM + 0.5));
+        start_motion(motion, HALT_DEFAULT | HALT_ON_TTC, 0, "heading");
+        return;
+    }
+    if (survey_due) {
+        survey_due = false;
+        mode = MODE_SURVEY;
+        start_sweep(SURVEY_DEGREES, HALT_DEFAULT);
+        return;
+    }
+    if (turn_due) {
+        turn_due = false;
+        MAP_FRONTIER frontier;
+        if (map_frontiers(&pose, &frontier, 1) == 1) {
+            if (rotate(frontier.bearing_deg, HALT_DEFAULT, 0, "frontier")) {
+                return;
+            }
+        } else if (rotate(random_between(-45, 45), HALT_DEFAULT, 0, "turn")) {
+            return;
+        }
+    }
+    char motion[16];
+    int cm = random_between(MIN_FORWARD_CM, MAX_FORWARD_CM);
+    snprintf(motion, sizeof(motion), "FF%d", (int) (cm * MOTOR_MS_PER_CM + 0.5));
+    start_motion(motion, HALT_DEFAULT | HALT_ON_TTC, 0, "forward");
+}
+
+bool rotate(int degrees, int halts, uint64_t edge_ns, char *reason) {
+    // Clockwise for positive degrees - false if there is nothing to turn
+    if (degrees == 0) {
+        return false;
+    }
+    char motion[16];
+    snprintf(motion, sizeof(motion), "%s%d", degrees > 0 ? "FR" : "RF",
+                (int) (abs(degrees) * MOTOR_MS_PER_DEG + 0.5));
+    start_motion(motion, halts, edge_ns, reason);
+    return true;
+}
+
+bool survey_heading(int *degrees) {
+    // Turn from here to the best heading in the survey's sweep profile, and how far to go - false
+    // if it has none, or nowhere is clear far enough
+    SWEEP_PROFILE profile;
+    HEADING heading;
+    if (!read_sweep_profile(sensor_memory, &profile) || profile.start_ns < survey_ns
+            || !best_heading(profile.range_mm, SWEEP_BINS, 0, &heading)) {
+        return false;
+    }
+    if (verbose) {
+        printf("%10.3f %-10s %d deg, %d mm clear\n", (monotonic_ns() - start_ns) / 1e9, "survey",
+                heading.degrees, heading.distance_mm);
+    }
+    survey_cm = heading.distance_mm / 10;
+    if (survey_cm > MAX_FORWARD_CM) {
+        survey_cm = MAX_FORWARD_CM;
+    }
+    // Headings are from where the sweep started - allow for how far it turned
+    int turned = (int) (mapped_us / 1000.0 / MOTOR_MS_PER_DEG + 0.5);
+    *degrees = ((heading.degrees - turned) % 360 + 540) % 360 - 180;
+    return survey_cm >= MIN_FORWARD_CM;
+}
+
+void start_sweep(int degrees, int halts) {
+    // A turn in place run with run_sweep, so sensord bins its ranges by heading
+    char motion[16];
+    snprintf(motion, sizeof(motion), "%s%d", degrees > 0 ? "FR" : "RF",
+                (int) (abs(degrees) * MOTOR_MS_PER_DEG + 0.5));
+    survey_ns = monotonic_ns();
+    pthread_mutex_lock(&motion_mutex);
+    queued_sweep = true;        // Taken with the motion, and cleared, by the motion thread
+    pthread_mutex_unlock(&motion_mutex);
+    start_motion(motion, halts, 0, "survey");
+}
+
+void start_motion(char *motion, int halts, uint64_t edge_ns, char *reason) {
+    // Hand the motion to the motion thread - edge_ns is the sensor edge it answers, 0 if none
+    if (verbose) {
+        printf("%10.3f %-10s %s\n", (monotonic_ns() - start_ns) / 1e9, reason, motion);
+    }
+    pthread_mutex_lock(&motion_mutex);
+    strncpy(queued_motion, motion, sizeof(queued_motion) - 1);
+    queued_halts = halts;
+    queued_edge_ns = edge_ns;
+    queued = true;
+    pthread_cond_signal(&motion_queued);
+    pthread_mutex_unlock(&motion_mutex);
+    moving = true;
+    decided_ns = monotonic_ns();
+}
+
+uint64_t latest_edge_ns(uint32_t state) {
+    // Time of the newest edge behind these STATE_* bits since the last decision, 0 if none
+    uint64_t latest = 0;
+    int sensor_id;
+    for (sensor_id = SENSOR_ID_RANGE; sensor_id < SENSOR_ID_COUNT; sensor_id++) {
+        uint32_t bits = sensor_id == SENSOR_ID_RANGE ? STATE_RANGE : STATE_FLAG(sensor_id);
+        if ((state & bits) && edge_ns[sensor_id] > latest) {
+            latest = edge_ns[sensor_id];
+        }
+    }
+    return latest > decided_ns ? latest : 0;
+}
+
+void map_reading(SENSOR_EVENT *event) {
+    // A range reading into the map, from where the robot was when it was taken
+    MAP_POSE reading_pose = pose;
+    if (mapped_start_ns != 0 && event->timestamp_ns < mapped_start_ns + mapped_us * 1000ULL) {
+        reading_pose = motion_pose;
+        if (event->timestamp_ns > mapped_start_ns) {
+            move_pose(&reading_pose, mapped_motion[0], mapped_motion[1],
+                        (event->timestamp_ns - mapped_start_ns) / 1000);
+        }
+    }
+    map_range(&reading_pose, event->value);
+}
+
+void *motion_thread(void *arg) {
+    // Runs queued motions one at a time, posting motion_fd after each
+    (void) arg;
+    char motion[16];
+    pthread_mutex_lock(&motion_mutex);
+    for (;;) {
+        while (!queued && !stopping) {
+            pthread_cond_wait(&motion_queued, &motion_mutex);
+        }
+        if (!queued) {
+            break;
+        }
+        strcpy(motion, queued_motion);
+        int halts = queued_halts;
+        uint64_t answered_ns = queued_edge_ns;
+        bool sweep = queued_sweep;
+        queued_sweep = false;
+        queued = false;
+        pthread_mutex_unlock(&motion_mutex);
+
+        if (answered_ns != 0 && reaction_count < REACTION_SAMPLES) {
+            reactions[reaction_count++] = monotonic_ns() - answered_ns;
+        }
+        MOTION_RESULT result;
+        uint64_t motion_start_ns = monotonic_ns();
+        if (sweep) {
+            run_sweep(motion[0] == 'F' ? SURVEY_DEGREES : -SURVEY_DEGREES, MOTOR_MS_PER_DEG, halts, &result);
+        } else {
+            execute_motion(motion, halts, &result);
+        }
+        motions++;
+        if (result.halt_cause != 0) {
+            halted++;
+        } else {
+            late_us += result.late_us;
+        }
+        log_motion_record(motion_start_ns, motion, halts, &result);
+        SWEEP_PROFILE profile;
+        if (sweep && read_sweep_profile(sensor_memory, &profile)) {
+            log_sweep_record(profile.start_ns, &profile);
+        }
+        if (verbose && result.halt_cause != 0) {
+            printf("%10.3f %-10s after %ld us\n", (monotonic_ns() - start_ns) / 1e9,
+                    halt_cause_name(result.halt_cause), result.executed_us);
+        }
+
+        pthread_mutex_lock(&motion_mutex);
+        strcpy(done_motion, motion);
+        done_start_ns = motion_start_ns;
+        done_us = result.executed_us;
+        done_stopped_ns = result.stopped_ns;
+        done_halt_cause = result.halt_cause;
+        uint64_t one = 1;
+        write(motion_fd, &one, sizeof(one));
+    }
+    pthread_mutex_unlock(&motion_mutex);
+    return NULL;
+}
+
+void *sensor_bridge(void *arg) {
+    // epoll can't wait on a futex - turn each halt_events change into an eventfd count
+    (void) arg;
+    uint32_t observed = sensor_event_count(sensor_memory);
+    while (!stopping) {
+        if (wait_sensor_event(sensor_memory, observed, BRIDGE_TIMEOUT_NS)) {
+            observed = sensor_event_count(sensor_memory);
+            uint64_t one = 1;
+            write(sensor_fd, &one, sizeof(one));
+        }
+    }
+    return NULL;
+}
+
+int add_timer(int every_ms) {
+    // One shot timerfd in the loop's epoll set, first due at random within every_ms to twice that, if not 0
+    int timer = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    if (timer < 0) {
+        return -1;
+    }
+    struct epoll_event watch;
+    watch.events = EPOLLIN;
+    watch.data.fd = timer;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, timer, &watch);
+    if (every_ms > 0) {
+        arm_timer(timer, random_between(every_ms, every_ms * 2));
+    }
+    return timer;
+}
+
+void arm_timer(int timer, long ms) {
+    // Due ms from now, 0 disarms
+    struct itimerspec due = { { 0, 0 }, { 0, 0 } };
+    due.it_value.tv_sec = ms / 1000;
+    due.it_value.tv_nsec = (ms % 1000) * 1000000L;
+    timerfd_settime(timer, 0, &due, NULL);
+}
+
+int random_between(int low, int high) {
+    // xorshift64* - the same sequence on any libc for a given -s seed
+    random_state ^= random_state >> 12;
+    random_state ^= random_state << 25;
+    random_state ^= random_state >> 27;
+    uint64_t value = random_state * 0x2545f4914f6cdd1dULL;
+    return low + (int) ((value >> 32) % (uint64_t) (high - low + 1));
+}
+
+void print_reactions() {
+    printf("%llu motions, %llu halted, %d sensor reactions\n",
+            (unsigned long long) motions, (unsigned long long) halted, reaction_count);
+    if (motions > halted) {
+        printf("completed motions ran %.1f us past their deadline on average\n",
+                (double) late_us / (motions - halted));
+    }
+    if (stop_count > 0) {
+        qsort(stops, stop_count, sizeof(uint64_t), compare_ns);
+        printf("halt (edge to motors stopped) p50 %.1f us   p99 %.1f us   max %.1f us\n",
+                stops[stop_count / 2] / 1e3, stops[stop_count * 99 / 100] / 1e3, stops[stop_count - 1] / 1e3);
+    }
+    if (reaction_count == 0) {
+        return;
+    }
+    qsort(reactions, reaction_count, sizeof(uint64_t), compare_ns);
+    printf("reaction (edge to next motion) p50 %.1f us   p99 %.1f us   max %.1f us\n",
+            reactions[reaction_count / 2] / 1e3, reactions[reaction_count * 99 / 100] / 1e3,
+            reactions[reaction_count - 1] / 1e3);
+}
+
+int compare_ns(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *) a;
+    uint64_t y = *(const uint64_t *) b;
+    return x < y ? -1 : (x > y);
+}
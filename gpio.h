@@ -0,0 +1,59 @@
+/**
+* gpio.h - GPIO backend interface
+*
+* Everything that touches pins goes through these calls, so the same
+* daemon and motion code links against either backend:
+*
+*   gpio_wiringpi.c     The robot - BCM GPIO numbers via wiringPi, with
+*   gpio_chardev.c      edge events from the GPIO character device
+*   gpio_sim.c          In-process simulator for any Linux box - see gpio_sim.h
+*
+* Pin numbers are BCM GPIO numbers (gpio_pins.h). Values and modes are
+* the wiringPi ones.
+*
+* write_pins switches any number of output pins in one go - one store to
+* the GPIO set register and one to the clear register on the robot - so
+* both motors change together.
+*
+* Edges on input pins are read from a single pollable fd, each with the
+* CLOCK_MONOTONIC time the kernel saw it, so handling latency never
+* shows up in measured pulse widths.
+*/
+
+#ifndef GPIO_H
+#define GPIO_H
+
+#include <stdint.h>
+
+#define GPIO_PINS           64
+#define PIN_BIT(pin)        (1ULL << (pin))     // write_pins bit for a pin
+
+#ifndef HIGH                // Same values as wiringPi.h
+#define LOW                 0
+#define HIGH                1
+#define INPUT               0
+#define OUTPUT              1
+#define PWM_OUTPUT          2
+#define INT_EDGE_FALLING    1
+#define INT_EDGE_RISING     2
+#define INT_EDGE_BOTH       3
+#endif
+
+typedef struct {
+    uint64_t timestamp_ns;  // CLOCK_MONOTONIC when the edge happened
+    int pin;
+    int value;              // Level after the edge
+} GPIO_EVENT;
+
+int setup_gpio(void);
+void set_pin_mode(int, int);
+void write_pin(int, int);
+void write_pins(uint64_t, uint64_t);
+int read_pin(int);
+void write_pin_pwm(int, int);
+void delay_ms(unsigned int);
+int open_pin_events(int *, int *, int);
+int read_pin_events(int, GPIO_EVENT *, int);
+void close_pin_events(int);
+
+#endif
@@ -0,0 +1,97 @@
+/**
+* gpio_chardev.c - Edge events from the Linux GPIO character device
+*
+* All requested lines share one line request fd. The kernel timestamps
+* each edge in its interrupt handler (CLOCK_MONOTONIC by default) and
+* queues it, so edges are neither lost to a busy handler nor timed late.
+* Line offsets on the Pi's main GPIO chip are the BCM GPIO numbers.
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/gpio.h>
+#include <sys/ioctl.h>
+#include "gpio.h"
+
+#define GPIO_CHIP           "/dev/gpiochip0"
+#define GPIO_CONSUMER       "uv1"
+
+int open_pin_events(int *pins, int *edges, int count) {
+    // Returns a non-blocking fd to poll and pass to read_pin_events, -1 on failure
+    struct gpio_v2_line_request request;
+    memset(&request, 0, sizeof(request));
+    if (count > GPIO_V2_LINES_MAX) {
+        return -1;
+    }
+
+    int i;
+    for (i = 0; i < count; i++) {
+        request.offsets[i] = pins[i];
+    }
+    request.num_lines = count;
+    strncpy(request.consumer, GPIO_CONSUMER, sizeof(request.consumer) - 1);
+    request.config.flags = GPIO_V2_LINE_FLAG_INPUT;
+
+    // One flags attribute per edge setting, masking the lines it applies to
+    int edge;
+    for (edge = INT_EDGE_FALLING; edge <= INT_EDGE_BOTH; edge++) {
+        uint64_t mask = 0;
+        for (i = 0; i < count; i++) {
+            if (edges[i] == edge) {
+                mask |= 1ULL << i;
+            }
+        }
+        if (mask == 0) {
+            continue;
+        }
+        struct gpio_v2_line_config_attribute *attr = &request.config.attrs[request.config.num_attrs++];
+        attr->attr.id = GPIO_V2_LINE_ATTR_ID_FLAGS;
+        attr->attr.flags = GPIO_V2_LINE_FLAG_INPUT
+                            | ((edge & INT_EDGE_RISING) ? GPIO_V2_LINE_FLAG_EDGE_RISING : 0)
+                            | ((edge & INT_EDGE_FALLING) ? GPIO_V2_LINE_FLAG_EDGE_FALLING : 0);
+        attr->mask = mask;
+    }
+
+    int chip_fd = open(GPIO_CHIP, O_RDONLY | O_CLOEXEC);
+    if (chip_fd < 0) {
+        fprintf(stderr, "Cannot open %s!\n", GPIO_CHIP);
+        return -1;
+    }
+    if (ioctl(chip_fd, GPIO_V2_GET_LINE_IOCTL, &request) < 0) {
+        fprintf(stderr, "Cannot request GPIO lines - %s!\n", strerror(errno));
+        close(chip_fd);
+        return -1;
+    }
+    close(chip_fd);         // Line request fd stays valid
+
+    fcntl(request.fd, F_SETFL, fcntl(request.fd, F_GETFL) | O_NONBLOCK);
+    return request.fd;
+}
+
+int read_pin_events(int fd, GPIO_EVENT *events, int max) {
+    // Returns the number of events read, 0 if none are pending, -1 on error
+    struct gpio_v2_line_event line_events[16];
+    if (max > 16) {
+        max = 16;
+    }
+    ssize_t size = read(fd, line_events, max * sizeof(struct gpio_v2_line_event));
+    if (size < 0) {
+        return (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+    }
+
+    int count = size / sizeof(struct gpio_v2_line_event);
+    int i;
+    for (i = 0; i < count; i++) {
+        events[i].timestamp_ns = line_events[i].timestamp_ns;
+        events[i].pin = line_events[i].offset;
+        events[i].value = (line_events[i].id == GPIO_V2_LINE_EVENT_RISING_EDGE) ? HIGH : LOW;
+    }
+    return count;
+}
+
+void close_pin_events(int fd) {
+    close(fd);      // Releases the lines
+}
@@ -16,7 +16,7 @@
 //      Ground                          09  Black
 //      UART0_RXD               15      10  Green
 #define LEFT_MOTOR_FWD_GPIO     17  //  11  Blue
-//      PCM_CLK                 18      12  Gray
+#define BUZZER_GPIO             18  //  12  Gray    PCM_CLK / PWM0
 #define LEFT_MOTOR_REV_GPIO     27  //  13  Green
 //      Ground                          14  Black
 #define RIGHT_MOTOR_FWD_GPIO    22  //  15  Yellow
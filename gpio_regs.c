@@ -0,0 +1,37 @@
+/**
+* gpio_regs.c - Batched pin writes through the GPIO register block
+*/
+
+#include <fcntl.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "gpio_regs.h"
+
+volatile uint32_t *map_gpio_regs() {
+    // The GPIO block, or NULL if there isn't one to map
+    int fd = open(GPIO_MEM, O_RDWR | O_SYNC | O_CLOEXEC);
+    if (fd < 0) {
+        return NULL;
+    }
+    void *mapped = mmap(NULL, GPIO_BLOCK_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);      // Mapping stays valid
+    return mapped == MAP_FAILED ? NULL : (volatile uint32_t *) mapped;
+}
+
+void write_gpio_regs(volatile uint32_t *regs, uint64_t set_bits, uint64_t clear_bits) {
+    // PIN_BIT(pin) bits - clears land first, so an H-bridge going from one
+    // direction to the other passes through coast, never brake
+    if ((uint32_t) clear_bits != 0) {
+        regs[GPCLR0] = (uint32_t) clear_bits;
+    }
+    if ((clear_bits >> 32) != 0) {
+        regs[GPCLR1] = (uint32_t) (clear_bits >> 32);
+    }
+    if ((uint32_t) set_bits != 0) {
+        regs[GPSET0] = (uint32_t) set_bits;
+    }
+    if ((set_bits >> 32) != 0) {
+        regs[GPSET1] = (uint32_t) (set_bits >> 32);
+    }
+}
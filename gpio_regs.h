@@ -0,0 +1,31 @@
+/**
+* gpio_regs.h - BCM283x GPIO register block
+*
+* The GPIO block has write-only set and clear registers with one bit per
+* pin, so any number of pins change level with one store to each. The
+* robot backend points these calls at the block mapped from /dev/gpiomem,
+* the simulator at a fake register file in memory, so the same stores are
+* made in both.
+*/
+
+#ifndef GPIO_REGS_H
+#define GPIO_REGS_H
+
+#include <stdint.h>
+
+#define GPIO_MEM            "/dev/gpiomem"  // GPIO block alone, no root needed
+#define GPIO_BLOCK_SIZE     4096
+
+// Register word offsets - bank 0 is GPIO 0-31, bank 1 GPIO 32-53
+#define GPSET0              7
+#define GPSET1              8
+#define GPCLR0              10
+#define GPCLR1              11
+#define GPLEV0              13
+#define GPLEV1              14
+#define GPIO_REG_WORDS      64              // Enough of the block for a fake register file
+
+volatile uint32_t *map_gpio_regs(void);
+void write_gpio_regs(volatile uint32_t *, uint64_t, uint64_t);
+
+#endif
@@ -0,0 +1,376 @@
+/**
+* gpio_sim.c - In-process GPIO simulator backend
+*
+* compile with gpio_regs.o + -pthread
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "gpio_pins.h"
+#include "sensors.h"
+#include "gpio.h"
+#include "gpio_sim.h"
+#include "gpio_regs.h"
+
+#define SPEED_OF_SOUND      0.0000343  // cm/nanosecond
+#define SIM_SCRIPT_MAX      65536      // Edges in a GPIO_SIM_SCRIPT file
+#define SIM_MIN_SLEEP_US    100        // Shorter script delays aren't slept
+
+static void *echo_thread(void *);
+static void *script_thread(void *);
+static void send_edge(int, int, uint64_t);
+static void record_write(int, int, bool, uint64_t);
+static void latch_regs(void);
+static void sleep_ns(long);
+static void sleep_until_ns(uint64_t);
+
+static int levels[GPIO_PINS];
+static int modes[GPIO_PINS];
+static int event_edges[GPIO_PINS];      // INT_EDGE_* for pins in the event source, 0 if not
+static int event_fds[2] = { -1, -1 };   // Pipe - read end is the event source fd
+
+static pthread_mutex_t event_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t events_drained = PTHREAD_COND_INITIALIZER;
+static uint64_t events_sent = 0;
+static uint64_t events_read = 0;
+static uint64_t events_handled = 0;     // Events read before the source was found empty
+
+static pthread_mutex_t write_mutex = PTHREAD_MUTEX_INITIALIZER;
+static SIM_WRITE write_log[SIM_WRITE_LOG_SIZE];
+static uint64_t write_count = 0;
+
+static pthread_mutex_t regs_mutex = PTHREAD_MUTEX_INITIALIZER;
+static uint32_t fake_regs[GPIO_REG_WORDS];  // Register file write_pins stores to
+static uint64_t reg_stores = 0;
+
+static pthread_mutex_t echo_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t echo_triggered = PTHREAD_COND_INITIALIZER;
+static int echo_range = SIM_DEFAULT_RANGE;
+static uint64_t triggers = 0;
+static uint64_t trigger_ns;             // End of the last trigger pulse
+
+static SIM_EDGE *script_edges;
+static int script_count;
+
+int setup_gpio() {
+    char *range = getenv("GPIO_SIM_RANGE");
+    if (range != NULL) {
+        echo_range = atoi(range);
+    }
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, echo_thread, NULL) != 0) {
+        fprintf(stderr, "Cannot start simulated rangefinder!\n");
+        return -1;
+    }
+    pthread_detach(thread);
+
+    char *script = getenv("GPIO_SIM_SCRIPT");
+    if (script != NULL) {
+        script_edges = malloc(SIM_SCRIPT_MAX * sizeof(SIM_EDGE));
+        script_count = sim_load_edges(script, script_edges, SIM_SCRIPT_MAX);
+        if (script_count < 0) {
+            fprintf(stderr, "Cannot load %s line %d!\n", script, -script_count);
+            return -1;
+        }
+        if (pthread_create(&thread, NULL, script_thread, NULL) != 0) {
+            fprintf(stderr, "Cannot start edge script!\n");
+            return -1;
+        }
+        pthread_detach(thread);
+    }
+    return 0;
+}
+
+void set_pin_mode(int pin, int mode) {
+    modes[pin] = mode;
+}
+
+void write_pin(int pin, int value) {
+    int previous = __atomic_exchange_n(&levels[pin], value, __ATOMIC_ACQ_REL);
+    record_write(pin, value, false, monotonic_ns());
+
+    // End of a trigger pulse starts an echo
+    if (pin == RANGE_TRIGGER_GPIO && previous == HIGH && value == LOW) {
+        pthread_mutex_lock(&echo_mutex);
+        triggers++;
+        trigger_ns = monotonic_ns();
+        pthread_cond_signal(&echo_triggered);
+        pthread_mutex_unlock(&echo_mutex);
+    }
+}
+
+void write_pins(uint64_t set_bits, uint64_t clear_bits) {
+    // The same stores the robot makes, to a fake register file - the lock
+    // stands in for each store being a single bus write
+    pthread_mutex_lock(&regs_mutex);
+    write_gpio_regs(fake_regs, set_bits, clear_bits);
+    latch_regs();
+    pthread_mutex_unlock(&regs_mutex);
+}
+
+int read_pin(int pin) {
+    return __atomic_load_n(&levels[pin], __ATOMIC_ACQUIRE);
+}
+
+void write_pin_pwm(int pin, int value) {
+    record_write(pin, value, true, monotonic_ns());
+}
+
+void delay_ms(unsigned int ms) {
+    sleep_ns(ms * 1000000L);
+}
+
+int open_pin_events(int *pins, int *edges, int count) {
+    // One event source at a time - a pipe of GPIO_EVENTs, written by sim_set_pin
+    if (event_fds[0] >= 0 || pipe(event_fds) < 0) {
+        fprintf(stderr, "Cannot open simulated GPIO events!\n");
+        return -1;
+    }
+    fcntl(event_fds[0], F_SETFL, O_NONBLOCK);   // Reader polls, writers block when full
+    int i;
+    for (i = 0; i < count; i++) {
+        __atomic_store_n(&event_edges[pins[i]], edges[i], __ATOMIC_RELEASE);
+    }
+    return event_fds[0];
+}
+
+int read_pin_events(int fd, GPIO_EVENT *events, int max) {
+    // Returns the number of events read, 0 if none are pending, -1 on error
+    ssize_t size = read(fd, events, max * sizeof(GPIO_EVENT));
+    pthread_mutex_lock(&event_mutex);
+    if (size > 0) {
+        events_read += size / sizeof(GPIO_EVENT);
+    } else {
+        // Empty - everything read before now has been handled
+        events_handled = events_read;
+        pthread_cond_broadcast(&events_drained);
+    }
+    pthread_mutex_unlock(&event_mutex);
+
+    if (size < 0) {
+        return (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+    }
+    return size / sizeof(GPIO_EVENT);
+}
+
+void close_pin_events(int fd) {
+    (void) fd;
+    int pin;
+    for (pin = 0; pin < GPIO_PINS; pin++) {
+        __atomic_store_n(&event_edges[pin], 0, __ATOMIC_RELEASE);
+    }
+    close(event_fds[1]);
+    close(event_fds[0]);
+    event_fds[0] = event_fds[1] = -1;
+}
+
+/**
+* Simulator controls
+**/
+
+void sim_set_pin(int pin, int value) {
+    // Drive an input pin - a matching edge is timestamped and queued on the event source
+    send_edge(pin, value, monotonic_ns());
+}
+
+static void send_edge(int pin, int value, uint64_t timestamp_ns) {
+    GPIO_EVENT event;
+    event.timestamp_ns = timestamp_ns;
+    event.pin = pin;
+    event.value = value;
+
+    int previous = __atomic_exchange_n(&levels[pin], value, __ATOMIC_ACQ_REL);
+    int edge = __atomic_load_n(&event_edges[pin], __ATOMIC_ACQUIRE);
+    if (previous == value || !(edge & (value == HIGH ? INT_EDGE_RISING : INT_EDGE_FALLING))) {
+        return;
+    }
+    pthread_mutex_lock(&event_mutex);
+    events_sent++;
+    pthread_mutex_unlock(&event_mutex);
+    while (write(event_fds[1], &event, sizeof(event)) < 0 && errno == EINTR) {
+        // Retry after signal - pipe writes this small are atomic
+    }
+}
+
+void sim_play_edges(SIM_EDGE *edges, int count) {
+    // Runs on the calling thread, sleeping between edges. Edges carry their
+    // scripted times, so pulse widths are exact even if a sleep overshoots,
+    // and edges closer than a sleep could manage are sent together.
+    uint64_t edge_ns = monotonic_ns();
+    int i;
+    for (i = 0; i < count; i++) {
+        edge_ns += edges[i].delay_us * 1000ULL;
+        if (edges[i].delay_us >= SIM_MIN_SLEEP_US) {
+            sleep_until_ns(edge_ns);
+        }
+        send_edge(edges[i].pin, edges[i].value, edge_ns);
+    }
+}
+
+int sim_load_edges(char *path, SIM_EDGE *edges, int max) {
+    // Returns the number of edges, or -{line number} on a syntax error (-1 if unreadable)
+    FILE *script = fopen(path, "r");
+    if (script == NULL) {
+        return -1;
+    }
+    char line[256];
+    int line_number = 0;
+    int count = 0;
+    while (fgets(line, sizeof(line), script) != NULL) {
+        line_number++;
+        char *comment = strchr(line, '#');
+        if (comment != NULL) {
+            *comment = '\0';
+        }
+        char extra;
+        SIM_EDGE edge;
+        int fields = sscanf(line, "%ld %d %d %c", &edge.delay_us, &edge.pin, &edge.value, &extra);
+        if (fields <= 0) {
+            continue;       // Blank line
+        }
+        if (fields != 3 || count >= max || edge.delay_us < 0
+                || edge.pin < 0 || edge.pin >= GPIO_PINS || (edge.value != LOW && edge.value != HIGH)) {
+            fclose(script);
+            return -line_number;
+        }
+        edges[count++] = edge;
+    }
+    fclose(script);
+    return count;
+}
+
+void sim_wait_handlers() {
+    // Until every edge sent so far has been read and the reader came back for more
+    pthread_mutex_lock(&event_mutex);
+    uint64_t sent = events_sent;
+    while (events_handled < sent) {
+        pthread_cond_wait(&events_drained, &event_mutex);
+    }
+    pthread_mutex_unlock(&event_mutex);
+}
+
+void sim_set_range(int range) {
+    // Range in cm for the next echoes, -1 for none
+    __atomic_store_n(&echo_range, range, __ATOMIC_RELAXED);
+}
+
+uint64_t sim_write_count() {
+    pthread_mutex_lock(&write_mutex);
+    uint64_t count = write_count;
+    pthread_mutex_unlock(&write_mutex);
+    return count;
+}
+
+uint64_t sim_register_stores() {
+    // Stores write_pins has made to set and clear registers
+    pthread_mutex_lock(&regs_mutex);
+    uint64_t stores = reg_stores;
+    pthread_mutex_unlock(&regs_mutex);
+    return stores;
+}
+
+bool sim_read_write(uint64_t number, SIM_WRITE *write) {
+    // Write number 0 is the first - false if not written yet or no longer kept
+    pthread_mutex_lock(&write_mutex);
+    bool kept = number < write_count && number + SIM_WRITE_LOG_SIZE >= write_count;
+    if (kept) {
+        *write = write_log[number & (SIM_WRITE_LOG_SIZE - 1)];
+    }
+    pthread_mutex_unlock(&write_mutex);
+    return kept;
+}
+
+static void record_write(int pin, int value, bool pwm, uint64_t time_ns) {
+    SIM_WRITE write;
+    write.time_ns = time_ns;
+    write.pin = pin;
+    write.value = value;
+    write.pwm = pwm;
+    pthread_mutex_lock(&write_mutex);
+    write_log[write_count++ & (SIM_WRITE_LOG_SIZE - 1)] = write;
+    pthread_mutex_unlock(&write_mutex);
+}
+
+static void latch_regs() {
+    // Apply whatever was stored to the clear then set registers, as the
+    // hardware would, with one time for every pin in the batch
+    static const int stores[4][2] = { { GPCLR0, 0 }, { GPCLR1, 32 }, { GPSET0, 0 }, { GPSET1, 32 } };
+    uint64_t time_ns = monotonic_ns();
+    int i;
+    for (i = 0; i < 4; i++) {
+        int reg = stores[i][0];
+        if (fake_regs[reg] == 0) {
+            continue;
+        }
+        int value = (reg == GPSET0 || reg == GPSET1) ? HIGH : LOW;
+        int bit;
+        for (bit = 0; bit < 32; bit++) {
+            if (fake_regs[reg] & (1U << bit)) {
+                int pin = stores[i][1] + bit;
+                __atomic_store_n(&levels[pin], value, __ATOMIC_RELEASE);
+                record_write(pin, value, false, time_ns);
+            }
+        }
+        fake_regs[reg] = 0;         // Write only - reads back as 0
+        reg_stores++;
+    }
+}
+
+static void *echo_thread(void *arg) {
+    // Echo pin goes HIGH for the sound's round trip time after each trigger.
+    // Edges carry the times they should have happened, like kernel timestamps,
+    // so sleep overshoot here doesn't change the simulated range.
+    (void) arg;
+    uint64_t answered = 0;
+    pthread_mutex_lock(&echo_mutex);
+    for (;;) {
+        while (answered == triggers) {
+            pthread_cond_wait(&echo_triggered, &echo_mutex);
+        }
+        answered = triggers;
+        uint64_t echo_start_ns = trigger_ns + SIM_ECHO_LATENCY_NS;
+        pthread_mutex_unlock(&echo_mutex);
+
+        int range = __atomic_load_n(&echo_range, __ATOMIC_RELAXED);
+        if (range >= 0) {
+            uint64_t echo_end_ns = echo_start_ns + (uint64_t) (2 * range / SPEED_OF_SOUND);
+            sleep_until_ns(echo_start_ns);
+            send_edge(RANGE_ECHO_GPIO, HIGH, echo_start_ns);
+            sleep_until_ns(echo_end_ns);
+            send_edge(RANGE_ECHO_GPIO, LOW, echo_end_ns);
+        }
+        pthread_mutex_lock(&echo_mutex);
+    }
+    return NULL;
+}
+
+static void *script_thread(void *arg) {
+    (void) arg;
+    sim_play_edges(script_edges, script_count);
+    return NULL;
+}
+
+static void sleep_until_ns(uint64_t deadline_ns) {
+    struct timespec deadline;
+    deadline.tv_sec = deadline_ns / 1000000000ULL;
+    deadline.tv_nsec = deadline_ns % 1000000000ULL;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR) {
+        // Retry after signal
+    }
+}
+
+static void sleep_ns(long ns) {
+    struct timespec duration;
+    duration.tv_sec = ns / 1000000000L;
+    duration.tv_nsec = ns % 1000000000L;
+    while (nanosleep(&duration, &duration) < 0 && errno == EINTR) {
+        // Finish the sleep after a signal
+    }
+}
@@ -0,0 +1,53 @@
+/**
+* gpio_sim.h - In-process GPIO simulator
+*
+* Link gpio_sim.o instead of the wiringPi backend to run the daemons and
+* motion code without a Pi. Pins hold levels in memory, edges on pins in
+* the event source are timestamped and queued on a pipe that stands in
+* for the GPIO character device, the rangefinder answers each trigger
+* pulse with an echo, and every pin write is recorded with its time.
+* write_pins stores to a fake GPIO register file, and every pin changed
+* by one store is recorded with the same time.
+*
+* Environment, read by setup_gpio:
+*   GPIO_SIM_RANGE      Simulated range in cm, -1 for no echo (default 100)
+*   GPIO_SIM_SCRIPT     Edge script file, played on a thread from startup
+*
+* An edge script has one edge per line, '#' starts a comment:
+*   {delay usec after previous edge} {GPIO} {0|1}
+* Script edges are timestamped with their scripted times.
+*/
+
+#ifndef GPIO_SIM_H
+#define GPIO_SIM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define SIM_WRITE_LOG_SIZE      4096        // Pin writes kept - power of 2
+#define SIM_ECHO_LATENCY_NS     450000L     // Trigger end to echo start
+#define SIM_DEFAULT_RANGE       100
+
+typedef struct {
+    uint64_t time_ns;       // CLOCK_MONOTONIC
+    int pin;
+    int value;              // Level, or duty for a PWM write
+    bool pwm;
+} SIM_WRITE;
+
+typedef struct {
+    long delay_us;          // After the previous edge
+    int pin;
+    int value;
+} SIM_EDGE;
+
+void sim_set_pin(int, int);
+void sim_play_edges(SIM_EDGE *, int);
+int sim_load_edges(char *, SIM_EDGE *, int);
+void sim_wait_handlers(void);
+void sim_set_range(int);
+uint64_t sim_write_count(void);
+uint64_t sim_register_stores(void);
+bool sim_read_write(uint64_t, SIM_WRITE *);
+
+#endif
@@ -0,0 +1,64 @@
+/**
+* gpio_wiringpi.c - GPIO backend for the robot, via wiringPi
+*
+* Edge events come from gpio_chardev.c, batched writes go straight to
+* the GPIO registers through gpio_regs.c.
+*
+* compile with gpio_chardev.o gpio_regs.o + -lwiringPi
+*/
+
+#include <stdio.h>
+#include <wiringPi.h>
+#include "gpio.h"
+#include "gpio_regs.h"
+
+static volatile uint32_t *gpio_regs = NULL;
+
+int setup_gpio() {
+    if (wiringPiSetupGpio() < 0) {
+        return -1;
+    }
+    gpio_regs = map_gpio_regs();
+    if (gpio_regs == NULL) {
+        fprintf(stderr, "Cannot map %s - batched pin writes will be one pin at a time\n", GPIO_MEM);
+    }
+    return 0;
+}
+
+void set_pin_mode(int pin, int mode) {
+    pinMode(pin, mode);
+}
+
+void write_pin(int pin, int value) {
+    digitalWrite(pin, value);
+}
+
+void write_pins(uint64_t set_bits, uint64_t clear_bits) {
+    if (gpio_regs != NULL) {
+        write_gpio_regs(gpio_regs, set_bits, clear_bits);
+        return;
+    }
+    int pin;
+    for (pin = 0; pin < GPIO_PINS; pin++) {
+        if (clear_bits & PIN_BIT(pin)) {
+            digitalWrite(pin, LOW);
+        }
+    }
+    for (pin = 0; pin < GPIO_PINS; pin++) {
+        if (set_bits & PIN_BIT(pin)) {
+            digitalWrite(pin, HIGH);
+        }
+    }
+}
+
+int read_pin(int pin) {
+    return digitalRead(pin);
+}
+
+void write_pin_pwm(int pin, int value) {
+    pwmWrite(pin, value);
+}
+
+void delay_ms(unsigned int ms) {
+    delay(ms);
+}
@@ -0,0 +1,137 @@
+/**
+* heading.c - Polar obstacle histogram heading selection
+*
+* The smoothing is a circular convolution with a triangular kernel, done
+* as two box filters over a copy of the densities padded with the kernel's
+* width from the other end of the circle. Each box filter is a running sum
+* and then differences of it, four bearings at a time on GCC vector types,
+* which compile to NEON on the Pi and SSE elsewhere - so the cost doesn't
+* grow with the kernel width.
+*
+* compile with -O2 - no dependencies
+*/
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "sensors.h"
+#include "heading.h"
+
+typedef float v4sf __attribute__((vector_size(16)));
+
+// Working buffers, with room for whole vectors past the end
+static float padded[HEADING_MAX_BINS * 2 + 8];      // Densities, wrapped round by the kernel's width
+static float prefix[HEADING_MAX_BINS * 2 + 16];      // Running sums of each pass' input
+static float boxed[HEADING_MAX_BINS * 2 + 8];       // After the first pass
+static float smoothed[HEADING_MAX_BINS + 8];
+
+static float range_density(uint16_t range_mm) {
+    // 1 for touching, falling to 0 at HEADING_MAX_RANGE_MM
+    if (range_mm == SWEEP_NO_SAMPLE) {
+        return HEADING_UNKNOWN_DENSITY;
+    }
+    if (range_mm >= HEADING_MAX_RANGE_MM) {
+        return 0;
+    }
+    float nearness = 1.0f - range_mm * (1.0f / HEADING_MAX_RANGE_MM);
+    return nearness * nearness;
+}
+
+static void box_sums(const float *in, int count, int length, float *out) {
+    // out[i] = in[i] + ... + in[i + length - 1] for i < count - length + 1, from running sums,
+    // differenced four at a time
+    int i;
+    prefix[0] = 0;
+    for (i = 0; i < count; i++) {
+        prefix[i + 1] = prefix[i] + in[i];
+    }
+    for (; i < count + 8; i++) {
+        prefix[i + 1] = prefix[i];
+    }
+    for (i = 0; i < count - length + 1; i += 4) {
+        v4sf head, tail;
+        memcpy(&head, &prefix[i + length], sizeof(head));    // Unaligned loads
+        memcpy(&tail, &prefix[i], sizeof(tail));
+        v4sf sum = head - tail;
+        memcpy(&out[i], &sum, sizeof(sum));
+    }
+}
+
+static void smooth_densities(const uint16_t *range_mm, int bins, int width) {
+    // Triangular kernel of half width width - a box of width + 1 bearings trailing each
+    // heading, then one leading it, so bearing k + j gets weight width + 1 - |j|
+    int i;
+    for (i = 0; i < bins; i++) {
+        padded[width + i] = range_density(range_mm[i]);
+    }
+    for (i = 0; i < width; i++) {
+        padded[i] = padded[bins + i];
+        padded[width + bins + i] = padded[width + i];
+    }
+    box_sums(padded, bins + 2 * width, width + 1, boxed);
+    box_sums(boxed, bins + width, width + 1, smoothed);
+
+    v4sf scale = { 1, 1, 1, 1 };
+    scale /= (float) (width + 1) * (width + 1);
+    for (i = 0; i < bins; i += 4) {
+        v4sf sum;
+        memcpy(&sum, &smoothed[i], sizeof(sum));
+        sum *= scale;
+        memcpy(&smoothed[i], &sum, sizeof(sum));
+    }
+}
+
+bool best_heading(const uint16_t *range_mm, int bins, int preferred_degrees, HEADING *best) {
+    // False if every heading is blocked, or there are no bins
+    if (bins <= 0 || bins > HEADING_MAX_BINS) {
+        return false;
+    }
+    int width = (HEADING_WINDOW_DEG * bins + 359) / 360;
+    if (width > bins / 2) {
+        width = bins / 2;
+    }
+    smooth_densities(range_mm, bins, width);
+
+    // Clearest heading, with turning away from the preferred one costing extra
+    preferred_degrees %= 360;
+    float preferred = preferred_degrees < 0 ? preferred_degrees + 360 : preferred_degrees;
+    float degrees_per_bin = 360.0f / bins;
+    int best_bin = -1;
+    float best_cost = 0;
+    int k;
+    for (k = 0; k < bins; k++) {
+        if (smoothed[k] >= HEADING_BLOCKED_DENSITY) {
+            continue;
+        }
+        float turn = k * degrees_per_bin - preferred;
+        turn = turn < 0 ? -turn : turn;
+        turn = turn > 180 ? 360 - turn : turn;
+        float cost = smoothed[k] + turn * (HEADING_TURN_COST / 180);
+        if (best_bin < 0 || cost < best_cost) {
+            best_bin = k;
+            best_cost = cost;
+        }
+    }
+    if (best_bin < 0) {
+        return false;
+    }
+
+    // Nearest range across the robot's width that way - bearings without a ping don't count,
+    // and with none at all it isn't known to be clear
+    int nearest_mm = HEADING_MAX_RANGE_MM;
+    bool pinged = false;
+    int j;
+    for (j = -width; j <= width; j++) {
+        uint16_t range = range_mm[(best_bin + j + bins) % bins];
+        if (range != SWEEP_NO_SAMPLE) {
+            pinged = true;
+            nearest_mm = range < nearest_mm ? range : nearest_mm;
+        }
+    }
+    nearest_mm = pinged ? nearest_mm : 0;
+    int degrees = (best_bin * 360 + bins / 2) / bins;
+    best->degrees = degrees > 180 ? degrees - 360 : degrees;
+    best->distance_mm = nearest_mm > HEADING_CLEARANCE_MM ? nearest_mm - HEADING_CLEARANCE_MM : 0;
+    best->density = smoothed[best_bin];
+    return true;
+}
@@ -0,0 +1,37 @@
+/**
+* heading.h - Pick where to go next from a range sweep
+*
+* A polar obstacle histogram, as in vector field histogram navigation:
+* each bearing's range becomes an obstacle density, the densities are
+* smoothed around the circle over about the robot's width, and the
+* clearest heading closest to the preferred one wins. Its travel
+* distance is the nearest range across that same width, less clearance.
+*
+* Bearings are evenly spaced clockwise from heading 0, as in
+* SWEEP_PROFILE, and any number up to HEADING_MAX_BINS will do.
+* Not thread safe - the working buffers are static.
+*/
+
+#ifndef HEADING_H
+#define HEADING_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define HEADING_MAX_BINS        8192
+#define HEADING_WINDOW_DEG      20      // Smoothing and clearance width either side of a heading
+#define HEADING_MAX_RANGE_MM    2000    // Farther than this counts as clear
+#define HEADING_UNKNOWN_DENSITY 0.3f    // Bearing no ping landed on
+#define HEADING_BLOCKED_DENSITY 0.5f    // Smoothed density from which a heading is ruled out
+#define HEADING_TURN_COST       0.2f    // Density worth turning half a circle to avoid
+#define HEADING_CLEARANCE_MM    150     // Kept between the robot and what it drives towards
+
+typedef struct {
+    int degrees;            // Clockwise from heading 0, -179 to 180
+    int distance_mm;        // Clear travel that way
+    float density;          // Smoothed obstacle density there, 0 clear
+} HEADING;
+
+bool best_heading(const uint16_t *, int, int, HEADING *);
+
+#endif
@@ -3,14 +3,14 @@
 * 
 * Oren Camber 2014-05-21
 *
-* compile with -lwiringPi
+* Client of actuatord - compile with actuator.o
 */
 
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <wiringPi.h>
-#include "gpio_pins.h"
+#include <stdbool.h>
+#include "actuator.h"
 
 int main(int argc, char **argv)
 {
@@ -21,18 +21,19 @@ int main(int argc, char **argv)
         return 0;
     }
         
-    wiringPiSetupGpio();
-    pinMode (LIGHTS_GPIO, OUTPUT);
-    
-    if (strcmp("on", argv[1]) == 0) 
-    {
-        digitalWrite(LIGHTS_GPIO, HIGH);
-    }
-    else
+    ACTUATOR_CONNECTION actuator;
+    if (!connect_actuator(&actuator))
     {
-        digitalWrite(LIGHTS_GPIO, LOW);
+        fprintf(stderr, "Cannot connect to actuator daemon!\n");
+        return 1;
     }
-    return 0;
+    
+    char command[ACTUATOR_LINE_MAX];
+    long result;
+    snprintf(command, sizeof(command), "lights %s", argv[1]);
+    bool ok = actuator_command(&actuator, command, &result);
+    disconnect_actuator(&actuator);
+    return ok ? 0 : 1;
 
 } // main
 
@@ -0,0 +1,239 @@
+/**
+* mapper.c - Tiled log-odds occupancy grid
+*
+* Each range reading is a ray from the pose, walked cell by cell with an
+* integer Bresenham line: every cell it crosses is more likely free, the
+* cell it ends in more likely occupied. Updates for the tile the walk is
+* in are staged in a tile sized buffer and go into the tile a row at a
+* time when the walk leaves it - one 16 byte vector add and clamp per row
+* touched, on GCC vector types, which compile to NEON on the Pi and SSE
+* elsewhere. Clamping keeps every cell far enough from the int8 limits
+* that no single update can wrap.
+*
+* compile with -O2 + -lm
+*/
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mapper.h"
+
+#define MAP_CELLS_ACROSS        (MAP_TILES_ACROSS * MAP_TILE_CELLS)
+#define MAP_FRONTIER_MIN_MM     300     // Frontiers nearer than this are where the robot already is
+
+typedef int8_t v16qi __attribute__((vector_size(16)));
+
+typedef struct {
+    int8_t cells[MAP_TILE_CELLS][MAP_TILE_CELLS];      // [row = y][column = x], log-odds
+} __attribute__((aligned(64))) MAP_TILE;
+
+static MAP_TILE tile_pool[MAP_TILE_POOL];
+static uint16_t tile_index[MAP_TILES_ACROSS][MAP_TILES_ACROSS];    // Pool index + 1, 0 if not mapped yet
+static MAP_STATS map_stats;
+static double motor_ms_per_cm = 1;
+static double motor_ms_per_deg = 1;
+
+// Ray updates staged for one tile
+static int8_t staged[MAP_TILE_CELLS][MAP_TILE_CELLS] __attribute__((aligned(16)));
+static uint32_t staged_rows = 0;        // Bit per row with updates in it
+static MAP_TILE *staged_tile = NULL;
+static int staged_tx = -1;
+static int staged_ty = -1;
+
+static MAP_TILE *find_tile(int tx, int ty, bool create) {
+    // NULL off the map, or if the tile isn't mapped and can't be
+    if (tx < 0 || ty < 0 || tx >= MAP_TILES_ACROSS || ty >= MAP_TILES_ACROSS) {
+        return NULL;
+    }
+    if (tile_index[ty][tx] == 0) {
+        if (!create || map_stats.tiles >= MAP_TILE_POOL) {
+            return NULL;
+        }
+        memset(&tile_pool[map_stats.tiles], 0, sizeof(MAP_TILE));
+        tile_index[ty][tx] = ++map_stats.tiles;
+    }
+    return &tile_pool[tile_index[ty][tx] - 1];
+}
+
+static int cell_log_odds(int cx, int cy) {
+    if (cx < 0 || cy < 0) {
+        return 0;
+    }
+    MAP_TILE *tile = find_tile(cx / MAP_TILE_CELLS, cy / MAP_TILE_CELLS, false);
+    return tile == NULL ? 0 : tile->cells[cy % MAP_TILE_CELLS][cx % MAP_TILE_CELLS];
+}
+
+static int cell_of(double mm) {
+    // Cell column or row, the start in the middle of the map
+    return (int) floor(mm / MAP_CELL_MM) + MAP_CELLS_ACROSS / 2;
+}
+
+static void flush_staged(void) {
+    // Staged rows into their tile - saturating at the log-odds limit
+    v16qi high = { 0 };
+    high += MAP_LOG_ODDS_LIMIT;
+    v16qi low = -high;
+    while (staged_rows != 0) {
+        int row = __builtin_ctz(staged_rows);
+        staged_rows &= staged_rows - 1;
+        if (staged_tile == NULL) {
+            memset(staged[row], 0, MAP_TILE_CELLS);
+            continue;
+        }
+        v16qi cells, updates;
+        memcpy(&cells, staged_tile->cells[row], sizeof(cells));
+        memcpy(&updates, staged[row], sizeof(updates));
+        cells += updates;
+        v16qi over = cells > high;
+        cells = (cells & ~over) | (high & over);
+        v16qi under = cells < low;
+        cells = (cells & ~under) | (low & under);
+        memcpy(staged_tile->cells[row], &cells, sizeof(cells));
+        memset(staged[row], 0, MAP_TILE_CELLS);
+    }
+}
+
+static void stage_cell(int cx, int cy, int update) {
+    if (cx < 0 || cy < 0) {
+        map_stats.dropped++;
+        return;
+    }
+    int tx = cx / MAP_TILE_CELLS;
+    int ty = cy / MAP_TILE_CELLS;
+    if (tx != staged_tx || ty != staged_ty) {
+        flush_staged();
+        staged_tx = tx;
+        staged_ty = ty;
+        staged_tile = find_tile(tx, ty, true);
+    }
+    if (staged_tile == NULL) {
+        map_stats.dropped++;
+        return;
+    }
+    staged[cy % MAP_TILE_CELLS][cx % MAP_TILE_CELLS] = update;
+    staged_rows |= 1U << (cy % MAP_TILE_CELLS);
+    map_stats.cells++;
+}
+
+void setup_map(double ms_per_cm, double ms_per_deg) {
+    // Empty map, and the motor rates move_pose reckons with
+    memset(tile_index, 0, sizeof(tile_index));
+    memset(&map_stats, 0, sizeof(map_stats));
+    staged_rows = 0;
+    staged_tile = NULL;
+    staged_tx = staged_ty = -1;
+    motor_ms_per_cm = ms_per_cm;
+    motor_ms_per_deg = ms_per_deg;
+}
+
+void move_pose(MAP_POSE *pose, char left_motion, char right_motion, long executed_us) {
+    // Dead reckon one motion's executed time - straight or turning in place, anything else stays put
+    double ms = executed_us / 1000.0;
+    double mm = 0;
+    if (left_motion == 'F' && right_motion == 'F') {
+        mm = ms / motor_ms_per_cm * 10;
+    } else if (left_motion == 'R' && right_motion == 'R') {
+        mm = -ms / motor_ms_per_cm * 10;
+    } else if (left_motion == 'F' && right_motion == 'R') {
+        pose->heading_deg = fmod(pose->heading_deg + ms / motor_ms_per_deg, 360);
+    } else if (left_motion == 'R' && right_motion == 'F') {
+        pose->heading_deg = fmod(pose->heading_deg - ms / motor_ms_per_deg + 360, 360);
+    }
+    pose->x_mm += mm * sin(pose->heading_deg * M_PI / 180);
+    pose->y_mm += mm * cos(pose->heading_deg * M_PI / 180);
+}
+
+void map_range(const MAP_POSE *pose, int range_mm) {
+    // One reading straight ahead of the pose - RANGE_MAX_MM or more is no echo
+    bool hit = range_mm > 0 && range_mm < MAP_MAX_RANGE_MM;
+    double length = hit ? range_mm : MAP_MAX_RANGE_MM;
+    double radians = pose->heading_deg * M_PI / 180;
+    int x = cell_of(pose->x_mm);
+    int y = cell_of(pose->y_mm);
+    int end_x = cell_of(pose->x_mm + length * sin(radians));
+    int end_y = cell_of(pose->y_mm + length * cos(radians));
+    map_stats.rays++;
+
+    int dx = abs(end_x - x);
+    int dy = -abs(end_y - y);
+    int step_x = x < end_x ? 1 : -1;
+    int step_y = y < end_y ? 1 : -1;
+    int error = dx + dy;
+    while (x != end_x || y != end_y) {
+        stage_cell(x, y, MAP_LOG_ODDS_FREE);
+        int doubled = 2 * error;
+        if (doubled >= dy) {
+            error += dy;
+            x += step_x;
+        }
+        if (doubled <= dx) {
+            error += dx;
+            y += step_y;
+        }
+    }
+    stage_cell(x, y, hit ? MAP_LOG_ODDS_OCCUPIED : MAP_LOG_ODDS_FREE);
+    flush_staged();
+}
+
+int map_log_odds(int x_mm, int y_mm) {
+    // 0 if never seen
+    return cell_log_odds(cell_of(x_mm), cell_of(y_mm));
+}
+
+int map_frontiers(const MAP_POSE *pose, MAP_FRONTIER *frontiers, int max_frontiers) {
+    // The nearest known free cells next to unknown ones, nearest first - returns how many
+    int count = 0;
+    int tx, ty;
+    if (max_frontiers <= 0) {
+        return 0;
+    }
+    for (ty = 0; ty < MAP_TILES_ACROSS; ty++) {
+        for (tx = 0; tx < MAP_TILES_ACROSS; tx++) {
+            if (tile_index[ty][tx] == 0) {
+                continue;
+            }
+            MAP_TILE *tile = &tile_pool[tile_index[ty][tx] - 1];
+            int row, column;
+            for (row = 0; row < MAP_TILE_CELLS; row++) {
+                for (column = 0; column < MAP_TILE_CELLS; column++) {
+                    if (tile->cells[row][column] >= MAP_FREE_BELOW) {
+                        continue;
+                    }
+                    int cx = tx * MAP_TILE_CELLS + column;
+                    int cy = ty * MAP_TILE_CELLS + row;
+                    if (cell_log_odds(cx - 1, cy) != 0 && cell_log_odds(cx + 1, cy) != 0
+                            && cell_log_odds(cx, cy - 1) != 0 && cell_log_odds(cx, cy + 1) != 0) {
+                        continue;
+                    }
+                    MAP_FRONTIER frontier;
+                    frontier.x_mm = (cx - MAP_CELLS_ACROSS / 2) * MAP_CELL_MM + MAP_CELL_MM / 2;
+                    frontier.y_mm = (cy - MAP_CELLS_ACROSS / 2) * MAP_CELL_MM + MAP_CELL_MM / 2;
+                    double east = frontier.x_mm - pose->x_mm;
+                    double north = frontier.y_mm - pose->y_mm;
+                    frontier.distance_mm = (int) sqrt(east * east + north * north);
+                    if (frontier.distance_mm < MAP_FRONTIER_MIN_MM
+                            || (count == max_frontiers && frontier.distance_mm >= frontiers[count - 1].distance_mm)) {
+                        continue;
+                    }
+                    int bearing = (int) lround(atan2(east, north) * 180 / M_PI - pose->heading_deg) % 360;
+                    bearing = bearing > 180 ? bearing - 360 : (bearing <= -180 ? bearing + 360 : bearing);
+                    frontier.bearing_deg = bearing;
+
+                    // Insert in distance order, dropping the farthest if full
+                    int i = count < max_frontiers ? count++ : count - 1;
+                    for (; i > 0 && frontiers[i - 1].distance_mm > frontier.distance_mm; i--) {
+                        frontiers[i] = frontiers[i - 1];
+                    }
+                    frontiers[i] = frontier;
+                }
+            }
+        }
+    }
+    return count;
+}
+
+void read_map_stats(MAP_STATS *stats) {
+    *stats = map_stats;
+}
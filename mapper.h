@@ -0,0 +1,61 @@
+/**
+* mapper.h - Occupancy grid from range readings and dead reckoning
+*
+* The grid is MAP_CELL_MM square cells holding log-odds of being
+* occupied, 0 for never seen. Cells come in MAP_TILE_CELLS square tiles,
+* taken from a fixed pool the first time a ray reaches them, so memory
+* is bounded whatever the mission - MAP_TILES_ACROSS tiles either way,
+* centred on where the robot started, and at most MAP_TILE_POOL of them
+* in use.
+*
+* The pose is dead reckoned from executed motion times and the motors'
+* calibrated rates, in mm from the start with x to the right of the start
+* heading and y ahead of it, and degrees clockwise from it.
+*
+* Not thread safe - one thread maps and queries.
+*/
+
+#ifndef MAPPER_H
+#define MAPPER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define MAP_CELL_MM             50
+#define MAP_TILE_CELLS          16      // Tile side - one 16 byte vector per row
+#define MAP_TILES_ACROSS        128     // 102 m square
+#define MAP_TILE_POOL           4096    // 1 MB of tiles, 2600 square metres mapped
+#define MAP_MAX_RANGE_MM        4000    // Readings are trusted this far, no echo maps free this far
+#define MAP_LOG_ODDS_FREE       -4      // Per ray passing through a cell
+#define MAP_LOG_ODDS_OCCUPIED   24      // Per ray ending in a cell
+#define MAP_LOG_ODDS_LIMIT      100     // Clamped to +/- this, so no update can wrap
+#define MAP_FREE_BELOW          -8      // Log-odds a cell needs to count as known free
+
+typedef struct {
+    double x_mm;
+    double y_mm;
+    double heading_deg;     // Clockwise, 0 - 360
+} MAP_POSE;
+
+typedef struct {
+    int x_mm;               // Centre of a known free cell next to unknown space
+    int y_mm;
+    int distance_mm;        // From the pose the query was made at
+    int bearing_deg;        // Turn to face it from that pose, clockwise, -179 to 180
+} MAP_FRONTIER;
+
+typedef struct {
+    uint32_t tiles;         // Tiles taken from the pool
+    uint32_t dropped;       // Ray cells off the map or past a full pool
+    uint64_t rays;
+    uint64_t cells;         // Cell updates
+} MAP_STATS;
+
+void setup_map(double, double);
+void move_pose(MAP_POSE *, char, char, long);
+void map_range(const MAP_POSE *, int);
+int map_log_odds(int, int);
+int map_frontiers(const MAP_POSE *, MAP_FRONTIER *, int);
+void read_map_stats(MAP_STATS *);
+
+#endif
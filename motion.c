@@ -0,0 +1,308 @@
+/**
+* motion.c - Run uv1 left and right motors until done or halted by sensors
+*
+* Shared by the actuator daemon and anything else that owns the motor pins.
+*
+* compile with sensors.o pwm.o + a GPIO backend + -pthread
+*/
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/prctl.h>
+#include "gpio.h"
+#include "gpio_pins.h"
+#include "sensors.h"
+#include "pwm.h"
+#include "motion.h"
+#include "stats.h"
+
+#define MOTION_TIMER_SLACK_NS   1000L   // Wakeup slack the kernel may add to a motion's deadline
+
+static SENSOR_MEMORY *sensor_memory;
+static int left_trim = PWM_FULL;        // Percent of speed for each motor
+static int right_trim = PWM_FULL;
+static uint32_t sweep_us_per_deg = 0;   // Set while run_sweep has run_motion take a range sweep
+
+// Pin bits for each motor setting, in MOTOR_SETTINGS order
+typedef struct {
+    uint64_t set_bits;
+    uint64_t clear_bits;
+    int pwm_pin;            // Driven pin the PWM thread switches, -1 if none
+} MOTOR_PINS;
+
+#define MOTOR_SETTINGS      "FRBC"      // Forward, reverse, brake, coast
+#define MOTOR_PINS_FOR(fwd, rev) { \
+    { PIN_BIT(fwd), PIN_BIT(rev), fwd }, \
+    { PIN_BIT(rev), PIN_BIT(fwd), rev }, \
+    { PIN_BIT(fwd) | PIN_BIT(rev), 0, -1 }, \
+    { 0, PIN_BIT(fwd) | PIN_BIT(rev), -1 } }
+
+static const MOTOR_PINS left_motor_pins[4] = MOTOR_PINS_FOR(LEFT_MOTOR_FWD_GPIO, LEFT_MOTOR_REV_GPIO);
+static const MOTOR_PINS right_motor_pins[4] = MOTOR_PINS_FOR(RIGHT_MOTOR_FWD_GPIO, RIGHT_MOTOR_REV_GPIO);
+
+static int motor_setting(char setting) {
+    // Index into MOTOR_SETTINGS, -1 if not a setting
+    switch (setting)
+    {
+        case 'F':
+        case 'f':
+            return 0;
+        case 'R':
+        case 'r':
+            return 1;
+        case 'B':
+        case 'b':
+            return 2;
+        case 'C':
+        case 'c':
+            return 3;
+    }
+    return -1;
+}
+
+static int motor_duty(int speed, int trim) {
+    int duty = speed * trim / PWM_FULL;
+    return duty < 1 ? 1 : (duty > PWM_FULL ? PWM_FULL : duty);
+}
+
+void setup_motion(SENSOR_MEMORY *memory) {
+    // Call once after setup_gpio
+    sensor_memory = memory;
+    set_pin_mode (LEFT_MOTOR_FWD_GPIO, OUTPUT);
+    set_pin_mode (LEFT_MOTOR_REV_GPIO, OUTPUT);
+    set_pin_mode (RIGHT_MOTOR_FWD_GPIO, OUTPUT);
+    set_pin_mode (RIGHT_MOTOR_REV_GPIO, OUTPUT);
+}
+
+bool motor_setting_err(char setting) {
+    return motor_setting(setting) < 0;
+}
+
+bool motion_syntax_err(char *motion) {
+    int duration;
+    int speed;
+    return !parse_motion(motion, &duration, &speed);
+}
+
+bool parse_motion(char *motion, int *duration, int *speed) {
+    // {left}{right}{duration}[@{speed}] - speed is percent, default full
+    int length = 0;
+    if (strlen(motion) < 3) {
+        return false;
+    }
+    if (motor_setting_err(motion[0]) || motor_setting_err(motion[1])) {
+        return false;
+    }
+    if (sscanf( (motion + 2), "%d%n", duration, &length ) < 1 || *duration < 0) {
+        return false;
+    }
+    *speed = PWM_FULL;
+    char *rest = motion + 2 + length;
+    if (*rest == '\0') {
+        return true;
+    }
+    length = 0;
+    return sscanf(rest, "@%d%n", speed, &length) == 1 && rest[length] == '\0'
+            && *speed > 0 && *speed <= PWM_FULL;
+}
+
+void set_motor_trim(int left, int right) {
+    left_trim = left;
+    right_trim = right;
+}
+
+int execute_motion(char *motion, int halts, MOTION_RESULT *result)
+{
+    int duration = 0;
+    int speed = PWM_FULL;
+    parse_motion(motion, &duration, &speed);
+    return run_motion(motion[0], motion[1], duration, speed, halts, result);
+}
+
+int run_sweep(int degrees, double ms_per_deg, int halts, MOTION_RESULT *result)
+{
+    // Turn in place, clockwise for positive degrees, while sensord fills in the sweep profile
+    if (degrees == 0 || ms_per_deg <= 0) {
+        return 0;
+    }
+    int duration = (int) (abs(degrees) * ms_per_deg + 0.5);
+    sweep_us_per_deg = (uint32_t) (ms_per_deg * 1000 + 0.5);
+    int interrupted_duration = degrees > 0 ? run_motion('F', 'R', duration, PWM_FULL, halts, result)
+                                            : run_motion('R', 'F', duration, PWM_FULL, halts, result);
+    sweep_us_per_deg = 0;
+    return interrupted_duration;
+}
+
+char *halt_cause_name(uint32_t halt_cause) {
+    // Short name of the first sensor in a MOTION_RESULT halt cause, "done" if it completed
+    if (halt_cause & HALT_CAUSE_TTC) {
+        return "ttc";
+    }
+    int sensor_id;
+    for (sensor_id = SENSOR_ID_OBSTACLE_F; sensor_id < SENSOR_ID_COUNT; sensor_id++) {
+        if (halt_cause & STATE_FLAG(sensor_id)) {
+            return sensor_name(sensor_id);
+        }
+    }
+    return "done";
+}
+
+int run_motion(char left_motion, char right_motion, int remaining_duration, int speed, int halts,
+                MOTION_RESULT *result)
+{
+    // Both motors switch with one write_pins call, and the driven pin of a
+    // forward / reverse motor is then switched by the PWM thread
+    int left = motor_setting(left_motion);
+    int right = motor_setting(right_motion);
+    uint64_t set_bits = 0;
+    uint64_t clear_bits = 0;
+    int left_pwm_pin = -1;
+    int right_pwm_pin = -1;
+    set_pwm(-1, 0, -1, 0);      // Take all pins back from the PWM thread first
+
+    if (left >= 0) {
+        left_motion = MOTOR_SETTINGS[left];
+        set_bits |= left_motor_pins[left].set_bits;
+        clear_bits |= left_motor_pins[left].clear_bits;
+        left_pwm_pin = left_motor_pins[left].pwm_pin;
+    }
+    if (right >= 0) {
+        right_motion = MOTOR_SETTINGS[right];
+        set_bits |= right_motor_pins[right].set_bits;
+        clear_bits |= right_motor_pins[right].clear_bits;
+        right_pwm_pin = right_motor_pins[right].pwm_pin;
+    }
+    write_pins(set_bits, clear_bits);
+    uint64_t start_ns = monotonic_ns();
+    uint64_t pwm_bits = (left_pwm_pin >= 0 ? PIN_BIT(left_pwm_pin) : 0)
+                        | (right_pwm_pin >= 0 ? PIN_BIT(right_pwm_pin) : 0);
+    
+    // Speed and trim set each motor's duty cycle, so it runs straight without correction motions
+    set_pwm(left_pwm_pin, motor_duty(speed, left_trim), right_pwm_pin, motor_duty(speed, right_trim));
+    
+    // Let sensord pick its ping rate for this motion
+    uint32_t motion_state = 0;
+    if (left_motion == 'F' || right_motion == 'F') {
+        motion_state |= MOTION_MOVING | MOTION_FORWARD;
+    }
+    if (left_motion == 'R' || right_motion == 'R') {
+        motion_state |= MOTION_MOVING | MOTION_REVERSE;
+    }
+    if (sweep_us_per_deg != 0) {
+        begin_sweep(sensor_memory, left_motion == 'F' ? 1 : -1, sweep_us_per_deg, start_ns);
+        motion_state |= MOTION_SWEEP;
+    }
+    set_motion_state(sensor_memory, motion_state);
+    
+    // Sensor flags that end this motion - sound always does
+    uint32_t halt_state = STATE_SOUND;
+    if (halts & HALT_ON_IMPACT) {
+        if (motion_state & MOTION_FORWARD) {
+            halt_state |= STATE_FLAG(SENSOR_ID_IMPACT_F);
+        }
+        if (motion_state & MOTION_REVERSE) {
+            halt_state |= STATE_FLAG(SENSOR_ID_IMPACT_B);
+        }
+    }
+    if (halts & HALT_ON_OBSTACLE) {
+        if (left_motion == 'F') {
+            halt_state |= STATE_FLAG(SENSOR_ID_OBSTACLE_F) | STATE_FLAG(SENSOR_ID_OBSTACLE_R);
+        }
+        if (right_motion == 'F') {
+            halt_state |= STATE_FLAG(SENSOR_ID_OBSTACLE_F) | STATE_FLAG(SENSOR_ID_OBSTACLE_L);
+        }
+        if (motion_state & MOTION_REVERSE) {
+            halt_state |= STATE_FLAG(SENSOR_ID_OBSTACLE_B);
+        }
+    }
+
+    // Obstacle flags that only pause it
+    uint32_t pause_state = (halts & HALT_PAUSE_ON_OBSTACLE) ? (halt_state & STATE_OBSTACLE) : 0;
+
+    // Run until the deadline, from when the pins switched, sleeping on sensord halt events in between.
+    // The default 50 usec timer slack would let every motion run that much long.
+    prctl(PR_SET_TIMERSLACK, MOTION_TIMER_SLACK_NS);
+    uint64_t deadline_ns = start_ns + remaining_duration * 1000000ULL;
+    uint64_t now_ns = monotonic_ns();
+    uint64_t paused_ns = 0;         // Total time stopped for obstacles
+    uint64_t pause_start_ns = 0;    // Start of the current pause, 0 if driving
+    uint32_t halt_cause = 0;
+
+    // Time to collision from sensord's range track - only driving straight ahead, where the rangefinder points
+    bool watch_ttc = (halts & HALT_ON_TTC) && left_motion == 'F' && right_motion == 'F';
+    int drive_speed = speed;
+
+    while (now_ns < deadline_ns)
+    {
+        // Take the event count first so a change after the check cuts the wait short
+        uint32_t events = sensor_event_count(sensor_memory);
+        uint32_t state = read_sensor_state(sensor_memory) & halt_state;
+        if (state & ~pause_state) {
+            halt_cause = state & ~pause_state;
+            break;
+        }
+        if (watch_ttc) {
+            int ttc_ms = range_track_ttc_ms(read_range_track(sensor_memory), now_ns);
+            if (ttc_ms < MOTION_TTC_HALT_MS) {
+                halt_cause = HALT_CAUSE_TTC;
+                break;
+            }
+            int ttc_speed = ttc_ms < MOTION_TTC_SLOW_MS ? speed * MOTION_TTC_SLOW_PERCENT / PWM_FULL : speed;
+            if (ttc_speed != drive_speed && pause_start_ns == 0) {
+                set_pwm(left_pwm_pin, motor_duty(ttc_speed, left_trim), right_pwm_pin, motor_duty(ttc_speed, right_trim));
+                write_pins(pwm_bits, 0);    // On for the new period - or for good if back to full
+            }
+            drive_speed = ttc_speed;
+        }
+        if (state != 0 && pause_start_ns == 0) {
+            // Coast until the obstacle clears - the PWM'd pins are the driven ones
+            set_pwm(-1, 0, -1, 0);
+            write_pins(0, pwm_bits);
+            pause_start_ns = monotonic_ns();
+            STATS_HALT(sensor_memory, start_ns);
+        } else if (state == 0 && pause_start_ns != 0) {
+            write_pins(pwm_bits, 0);
+            set_pwm(left_pwm_pin, motor_duty(drive_speed, left_trim), right_pwm_pin, motor_duty(drive_speed, right_trim));
+            paused_ns += monotonic_ns() - pause_start_ns;
+            pause_start_ns = 0;
+        }
+
+        // An absolute deadline, so however often the wait is cut short the motion doesn't run long
+        wait_sensor_event_until(sensor_memory, events, deadline_ns);
+        now_ns = monotonic_ns();
+    }
+
+    // Halted - both motors coast before anything else, so nothing drives on into what halted it
+    uint64_t stopped_ns = 0;
+    if (halt_cause != 0) {
+        set_pwm(-1, 0, -1, 0);
+        write_pins(0, set_bits);
+        stopped_ns = monotonic_ns();
+        set_motion_state(sensor_memory, motion_state & MOTION_SWEEP);
+        STATS_HALT(sensor_memory, start_ns);
+    }
+    uint64_t end_ns = now_ns < deadline_ns ? now_ns : deadline_ns;     // Halted, or when it was due to end
+    if (pause_start_ns != 0) {
+        paused_ns += end_ns - pause_start_ns;       // Paused to the end
+    }
+    if (motion_state & MOTION_SWEEP) {
+        set_motion_state(sensor_memory, motion_state & ~MOTION_SWEEP);
+        end_sweep(sensor_memory, end_ns);
+    }
+    uint64_t interrupted_ns = (deadline_ns - end_ns) + paused_ns;
+    if (result != NULL) {
+        result->executed_us = (now_ns - start_ns - paused_ns) / 1000;
+        result->paused_us = paused_ns / 1000;
+        result->interrupted_us = interrupted_ns / 1000;
+        result->late_us = now_ns > deadline_ns ? (now_ns - deadline_ns) / 1000 : 0;
+        result->halt_cause = halt_cause;
+        result->stopped_ns = stopped_ns;
+    }
+    
+    // Interrupted duration in whole millisecs, rounded up so any halt or pause is non-zero
+    return (int) ((interrupted_ns + 999999ULL) / 1000000ULL);
+}
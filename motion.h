@@ -0,0 +1,71 @@
+/**
+* motion.h - Motor motions
+*
+* A motion is 2 letters, one each for the left and right motor
+* ([F]wd, [R]ev, [B]rake or [C]oast/Off), followed by the duration
+* in millisecs, optionally followed by @ and a speed of 1-100 percent,
+* e.g. "FF1000" or "FF1000@60".
+*
+* With HALT_PAUSE_ON_OBSTACLE as well as HALT_ON_OBSTACLE, an obstacle
+* stops the motors until it clears rather than ending the motion - meant
+* for obstacles sensord level tracks (sensord -l). The motion still ends
+* at its deadline, and reports the time it spent paused as interrupted.
+*
+* With HALT_ON_TTC, an FF motion slows down once sensord's range track
+* says it will reach something within MOTION_TTC_SLOW_MS, and halts
+* within MOTION_TTC_HALT_MS - before the obstacle sensors or the bumper
+* would. Slowing needs the PWM thread.
+*
+* run_sweep turns in place through the degrees given at the turn rate
+* given, while sensord pings flat out and bins each range by the heading
+* the elapsed turn time gives - see SWEEP_PROFILE. A pause for obstacles
+* would throw the headings off, so a sweep shouldn't be given
+* HALT_PAUSE_ON_OBSTACLE.
+*
+* A motion runs to an absolute deadline from when its pins switched. It
+* returns its interrupted duration in millisecs, and fills in a
+* MOTION_RESULT, if given one, with what actually happened in usecs.
+* A motion that runs to its deadline leaves the motors in its setting,
+* for the next motion to take over from. One a sensor halts stops both
+* motors, with the same single pin write, before it returns.
+*/
+
+#ifndef MOTION_H
+#define MOTION_H
+
+#include <stdbool.h>
+#include "sensors.h"
+
+#define MOTORS_OFF          "CC0"
+#define HALT_ON_IMPACT      1
+#define HALT_ON_OBSTACLE    2
+#define HALT_PAUSE_ON_OBSTACLE  4
+#define HALT_ON_TTC         8
+#define HALT_DEFAULT        (HALT_ON_IMPACT | HALT_ON_OBSTACLE)
+
+// HALT_ON_TTC - time to collision from sensord's range track, driving straight ahead
+#define MOTION_TTC_HALT_MS      400
+#define MOTION_TTC_SLOW_MS      1000
+#define MOTION_TTC_SLOW_PERCENT 50      // Of the motion's speed, below MOTION_TTC_SLOW_MS
+#define HALT_CAUSE_TTC          STATE_FLAG(SENSOR_ID_RANGE)     // MOTION_RESULT halt_cause
+
+typedef struct {
+    long executed_us;       // Motors driven, pauses excluded
+    long paused_us;         // Stopped for obstacles
+    long interrupted_us;    // Not driven of the duration asked for - halted remainder plus pauses
+    long late_us;           // Past the deadline when it returned - 0 if halted
+    uint32_t halt_cause;    // STATE_* flags that halted it, 0 if it ran to its deadline
+    uint64_t stopped_ns;    // When a halt stopped the motors (CLOCK_MONOTONIC), 0 if not halted
+} MOTION_RESULT;
+
+void setup_motion(SENSOR_MEMORY *);
+bool motor_setting_err(char);
+bool motion_syntax_err(char *);
+bool parse_motion(char *, int *, int *);
+void set_motor_trim(int, int);
+int execute_motion(char *, int, MOTION_RESULT *);
+int run_motion(char, char, int, int, int, MOTION_RESULT *);
+int run_sweep(int, double, int, MOTION_RESULT *);
+char *halt_cause_name(uint32_t);
+
+#endif
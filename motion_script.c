@@ -0,0 +1,347 @@
+/**
+* motion_script.c - Compile and run motion scripts
+*
+* compile with motion.o sensors.o
+*/
+
+#include <ctype.h>
+#include <limits.h>
+#include <string.h>
+#include <strings.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include "sensors.h"
+#include "motion.h"
+#include "motion_script.h"
+
+#define BLOCK_REPEAT    1
+#define BLOCK_IF        2
+#define BLOCK_ELSE      3
+
+#define MAX_TOKENS      8       // Per line - a longest statement is a motion and its halt args
+
+typedef struct {
+    int kind;
+    int start;          // Index of the REPEAT / BRANCH op
+    int jump;           // Index of the ELSE jump op
+} SCRIPT_BLOCK;
+
+static bool compile_statement(MOTION_SCRIPT *, SCRIPT_BLOCK *, int *, char **, int, int);
+static bool compile_condition(MOTION_OP *, char **, int);
+static bool script_condition(MOTION_OP *, SENSOR_MEMORY *, bool);
+static MOTION_OP *add_op(MOTION_SCRIPT *, int);
+
+int load_motion_script(char *path, MOTION_SCRIPT *script, int halts) {
+    // Returns the number of ops, or -{line number} on a syntax error (-1 if unreadable)
+    FILE *script_file = fopen(path, "r");
+    if (script_file == NULL) {
+        return -1;
+    }
+
+    SCRIPT_BLOCK blocks[MOTION_SCRIPT_MAX_DEPTH];
+    int depth = 0;
+    int line_number = 0;
+    char line[256];
+    bool ok = true;
+    script->count = 0;
+
+    while (ok && fgets(line, sizeof(line), script_file) != NULL) {
+        line_number++;
+        char *comment = strchr(line, '#');
+        if (comment != NULL) {
+            *comment = '\0';
+        }
+
+        char *tokens[MAX_TOKENS];
+        int token_count = 0;
+        char *token = strtok(line, " \t\r\n");
+        while (token != NULL && token_count < MAX_TOKENS) {
+            tokens[token_count++] = token;
+            token = strtok(NULL, " \t\r\n");
+        }
+        if (token != NULL) {
+            ok = false;     // More than MAX_TOKENS - never run the start of a line alone
+        } else if (token_count > 0) {
+            ok = compile_statement(script, blocks, &depth, tokens, token_count, halts);
+        }
+    }
+    fclose(script_file);
+
+    if (ok && depth > 0) {
+        ok = false;         // Missing END
+    }
+    if (ok && add_op(script, OP_STOP) == NULL) {
+        ok = false;
+    }
+    return ok ? script->count : -(line_number > 0 ? line_number : 1);
+}
+
+static bool compile_statement(MOTION_SCRIPT *script, SCRIPT_BLOCK *blocks, int *depth,
+                                char **tokens, int token_count, int halts) {
+    MOTION_OP *op;
+    SCRIPT_BLOCK *block;
+    int i;
+
+    if (strcasecmp("REPEAT", tokens[0]) == 0) {
+        char *end;
+        long count = token_count == 2 ? strtol(tokens[1], &end, 10) : 0;
+        if (count <= 0 || count > INT_MAX || *end != '\0' || *depth >= MOTION_SCRIPT_MAX_DEPTH
+                || (op = add_op(script, OP_REPEAT)) == NULL) {
+            return false;
+        }
+        op->value = count;
+        op->slot = *depth;
+        block = &blocks[(*depth)++];
+        block->kind = BLOCK_REPEAT;
+        block->start = script->count - 1;
+        return true;
+    }
+
+    if (strcasecmp("IF", tokens[0]) == 0) {
+        if (*depth >= MOTION_SCRIPT_MAX_DEPTH || (op = add_op(script, OP_BRANCH)) == NULL
+                || !compile_condition(op, tokens + 1, token_count - 1)) {
+            return false;
+        }
+        block = &blocks[(*depth)++];
+        block->kind = BLOCK_IF;
+        block->start = script->count - 1;
+        return true;
+    }
+
+    if (strcasecmp("ELSE", tokens[0]) == 0) {
+        if (token_count != 1 || *depth == 0 || blocks[*depth - 1].kind != BLOCK_IF
+                || (op = add_op(script, OP_JUMP)) == NULL) {
+            return false;
+        }
+        block = &blocks[*depth - 1];
+        block->kind = BLOCK_ELSE;
+        block->jump = script->count - 1;
+        script->ops[block->start].target = script->count;   // False branch starts here
+        return true;
+    }
+
+    if (strcasecmp("END", tokens[0]) == 0) {
+        if (token_count != 1 || *depth == 0) {
+            return false;
+        }
+        block = &blocks[--(*depth)];
+        switch (block->kind) {
+            case BLOCK_REPEAT:
+                if ((op = add_op(script, OP_LOOP)) == NULL) {
+                    return false;
+                }
+                op->slot = *depth;
+                op->target = block->start + 1;
+                script->ops[block->start].target = script->count;
+                break;
+            case BLOCK_IF:
+                script->ops[block->start].target = script->count;
+                break;
+            case BLOCK_ELSE:
+                script->ops[block->jump].target = script->count;
+                break;
+        }
+        return true;
+    }
+
+    if (strcasecmp("STOP", tokens[0]) == 0) {
+        return token_count == 1 && add_op(script, OP_STOP) != NULL;
+    }
+
+    // Motion step with optional halt args
+    int duration;
+    int speed;
+    if (!parse_motion(tokens[0], &duration, &speed) || (op = add_op(script, OP_MOTION)) == NULL) {
+        return false;
+    }
+    op->left = toupper(tokens[0][0]);
+    op->right = toupper(tokens[0][1]);
+    op->value = duration;
+    op->speed = speed;
+    op->halts = halts;
+    for (i = 1; i < token_count; i++) {
+        if (strcmp("+i", tokens[i]) == 0) {
+            op->halts |= HALT_ON_IMPACT;
+        } else if (strcmp("-i", tokens[i]) == 0) {
+            op->halts &= ~HALT_ON_IMPACT;
+        } else if (strcmp("+o", tokens[i]) == 0) {
+            op->halts |= HALT_ON_OBSTACLE;
+        } else if (strcmp("-o", tokens[i]) == 0) {
+            op->halts &= ~HALT_ON_OBSTACLE;
+        } else if (strcmp("+p", tokens[i]) == 0) {
+            op->halts |= HALT_PAUSE_ON_OBSTACLE;
+        } else if (strcmp("-p", tokens[i]) == 0) {
+            op->halts &= ~HALT_PAUSE_ON_OBSTACLE;
+        } else if (strcmp("+t", tokens[i]) == 0) {
+            op->halts |= HALT_ON_TTC;
+        } else if (strcmp("-t", tokens[i]) == 0) {
+            op->halts &= ~HALT_ON_TTC;
+        } else if (strcmp("+c", tokens[i]) == 0) {
+            op->halts |= STEP_CONTINUE;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool compile_condition(MOTION_OP *op, char **tokens, int token_count) {
+    if (token_count > 0 && strcasecmp("NOT", tokens[0]) == 0) {
+        op->negate = 1;
+        tokens++;
+        token_count--;
+    }
+    if (token_count == 0) {
+        return false;
+    }
+
+    op->direction = -1;
+    if (strcasecmp("RANGE", tokens[0]) == 0) {
+        if (token_count != 3) {
+            return false;
+        }
+        if (strcmp("<", tokens[1]) == 0) {
+            op->condition = COND_RANGE_LT;
+        } else if (strcmp(">", tokens[1]) == 0) {
+            op->condition = COND_RANGE_GT;
+        } else {
+            return false;
+        }
+        op->value = atoi(tokens[2]);
+        return true;
+    }
+
+    if (strcasecmp("SOUND", tokens[0]) == 0 || strcasecmp("HALTED", tokens[0]) == 0) {
+        op->condition = toupper(tokens[0][0]) == 'S' ? COND_SOUND : COND_HALTED;
+        return token_count == 1;
+    }
+
+    if (strcasecmp("OBSTACLE", tokens[0]) == 0) {
+        op->condition = COND_OBSTACLE;
+    } else if (strcasecmp("IMPACT", tokens[0]) == 0) {
+        op->condition = COND_IMPACT;
+    } else {
+        return false;
+    }
+    if (token_count == 1) {
+        return true;
+    }
+    if (token_count != 2 || strlen(tokens[1]) != 1) {
+        return false;
+    }
+    switch (toupper(tokens[1][0])) {
+        case 'F':
+            op->direction = IDX_FWD;
+            break;
+        case 'B':
+            op->direction = IDX_BACK;
+            break;
+        case 'L':
+            op->direction = IDX_LEFT;
+            break;
+        case 'R':
+            op->direction = IDX_RIGHT;
+            break;
+        default:
+            return false;
+    }
+    return op->condition == COND_OBSTACLE || op->direction <= IDX_BACK;
+}
+
+static MOTION_OP *add_op(MOTION_SCRIPT *script, int opcode) {
+    if (script->count >= MOTION_SCRIPT_MAX_OPS) {
+        return NULL;
+    }
+    MOTION_OP *op = &script->ops[script->count++];
+    memset(op, 0, sizeof(MOTION_OP));
+    op->opcode = opcode;
+    return op;
+}
+
+int run_motion_script(MOTION_SCRIPT *script, SENSOR_MEMORY *sensor_memory, MOTION_RESULT *result) {
+    // Returns the interrupted duration of the step that ended the script, 0 if completed
+    // Motors are left in the last step's setting - caller turns them off
+    // *result, if given, has the times of every step run and the halt cause of the last
+    int counters[MOTION_SCRIPT_MAX_DEPTH];
+    bool halted = false;
+    int pc = 0;
+    MOTION_RESULT step;
+    if (result != NULL) {
+        memset(result, 0, sizeof(MOTION_RESULT));
+    }
+
+    while (pc < script->count) {
+        MOTION_OP *op = &script->ops[pc++];
+        switch (op->opcode) {
+            case OP_MOTION:
+                {
+                    int interrupted_duration = run_motion(op->left, op->right, op->value, op->speed,
+                                                            op->halts & ~STEP_CONTINUE, &step);
+                    if (result != NULL) {
+                        result->executed_us += step.executed_us;
+                        result->paused_us += step.paused_us;
+                        result->interrupted_us += step.interrupted_us;
+                        result->late_us += step.late_us;
+                        result->halt_cause = step.halt_cause;
+                    }
+                    halted = step.halt_cause != 0;     // A step that paused and ran to its deadline wasn't halted
+                    if (halted && !(op->halts & STEP_CONTINUE)) {
+                        return interrupted_duration;
+                    }
+                }
+                break;
+            case OP_REPEAT:
+                counters[op->slot] = op->value;     // At least 1 - compiled that way
+                break;
+            case OP_LOOP:
+                if (--counters[op->slot] > 0) {
+                    pc = op->target;
+                }
+                break;
+            case OP_BRANCH:
+                if (!script_condition(op, sensor_memory, halted)) {
+                    pc = op->target;
+                }
+                break;
+            case OP_JUMP:
+                pc = op->target;
+                break;
+            case OP_STOP:
+                return 0;
+        }
+    }
+    return 0;
+}
+
+static bool script_condition(MOTION_OP *op, SENSOR_MEMORY *sensor_memory, bool halted) {
+    if (op->condition == COND_HALTED) {
+        return op->negate ? !halted : halted;
+    }
+
+    uint32_t state = read_sensor_state(sensor_memory);
+    int range = STATE_RANGE_CM(state);
+    bool range_valid = (state & STATE_RANGE_VALID) != 0;
+    bool result = false;
+
+    switch (op->condition) {
+        case COND_RANGE_LT:
+            result = range_valid && range < op->value;
+            break;
+        case COND_RANGE_GT:
+            result = range_valid && range > op->value;
+            break;
+        case COND_OBSTACLE:
+            result = (state & (op->direction < 0 ? STATE_OBSTACLE
+                                : STATE_FLAG(SENSOR_ID_OBSTACLE_F + op->direction))) != 0;
+            break;
+        case COND_IMPACT:
+            result = (state & (op->direction < 0 ? STATE_IMPACT
+                                : STATE_FLAG(SENSOR_ID_IMPACT_F + op->direction))) != 0;
+            break;
+        case COND_SOUND:
+            result = (state & STATE_SOUND) != 0;
+            break;
+    }
+    return op->negate ? !result : result;
+}
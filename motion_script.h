@@ -0,0 +1,78 @@
+/**
+* motion_script.h - Compiled motion scripts
+*
+* A script is a text file, one statement per line, '#' starts a comment:
+*
+*   {motion} [+i|-i|+o|-o|+p|-p|+t|-t|+c]
+*                               Run a motion, e.g. FF1000 or FF1000@60. Halt args override
+*                               the script halts for this step only, +p pauses on
+*                               obstacles, +t slows and halts on time to collision
+*                               (see motion.h). A step halted by a sensor ends
+*                               the script unless marked +c - one that only
+*                               paused, then ran to its end, doesn't.
+*   REPEAT {n}                  Run the following statements n times, n at least 1
+*   IF [NOT] {condition}        Run the following statements if condition holds
+*   ELSE                        ...otherwise run these
+*   END                         Ends a REPEAT or IF
+*   STOP                        End the script
+*
+* Conditions read the sensors when evaluated:
+*
+*   RANGE < {cm}   RANGE > {cm}   OBSTACLE [F|B|L|R]   IMPACT [F|B]
+*   SOUND          HALTED (the last step was halted by a sensor, not just paused)
+*
+* A line has at most 8 words. A file of plain motions, one per line, is
+* a valid script. Scripts are compiled once into an array of MOTION_OPs
+* and run without reparsing.
+*/
+
+#ifndef MOTION_SCRIPT_H
+#define MOTION_SCRIPT_H
+
+#include <stdint.h>
+#include "sensors.h"
+#include "motion.h"
+
+#define MOTION_SCRIPT_MAX_OPS       1024
+#define MOTION_SCRIPT_MAX_DEPTH     16      // Nested REPEAT / IF blocks
+
+#define OP_MOTION       1   // left, right, value = duration, halts
+#define OP_REPEAT       2   // value = count, slot = loop counter, target = after END
+#define OP_LOOP         3   // slot = loop counter, target = first op of body
+#define OP_BRANCH       4   // Jump to target unless condition holds
+#define OP_JUMP         5   // target
+#define OP_STOP         6
+
+#define COND_RANGE_LT   1   // value = cm
+#define COND_RANGE_GT   2
+#define COND_OBSTACLE   3   // direction = IDX_* or -1 for any
+#define COND_IMPACT     4
+#define COND_SOUND      5
+#define COND_HALTED     6
+
+#define STEP_CONTINUE   0x80    // MOTION_OP halts flag - keep going if halted
+
+typedef struct {
+    uint8_t opcode;
+    uint8_t left;           // OP_MOTION motor settings
+    uint8_t right;
+    uint8_t halts;          // OP_MOTION halt mask | STEP_CONTINUE
+    uint8_t condition;      // OP_BRANCH
+    int8_t direction;       // OP_BRANCH sensor direction
+    uint8_t negate;         // OP_BRANCH
+    uint8_t slot;           // OP_REPEAT / OP_LOOP counter
+    uint16_t target;        // Jump target op index
+    uint8_t speed;          // OP_MOTION speed percent
+    uint8_t reserved;
+    int32_t value;          // Duration, count or threshold
+} MOTION_OP;
+
+typedef struct {
+    int count;
+    MOTION_OP ops[MOTION_SCRIPT_MAX_OPS];
+} MOTION_SCRIPT;
+
+int load_motion_script(char *, MOTION_SCRIPT *, int);
+int run_motion_script(MOTION_SCRIPT *, SENSOR_MEMORY *, MOTION_RESULT *);
+
+#endif
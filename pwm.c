@@ -0,0 +1,222 @@
+/**
+* pwm.c - Software PWM timing thread for motor speed control
+*
+* The thread owns the pins handed to it by set_pwm until the next
+* set_pwm call. Pin writes happen under pwm_mutex with the config
+* generation checked, so once set_pwm returns the thread never touches
+* the old pins again. Both motors switch on with one write_pins call at
+* the start of each period, and off together if their duty is the same.
+*
+* compile with a GPIO backend + -pthread
+*/
+
+#define _GNU_SOURCE     // pthread_setaffinity_np
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "gpio.h"
+#include "sensors.h"
+#include "pwm.h"
+
+typedef struct {
+    int pin;            // -1 if unused
+    int duty;           // Percent on per period
+} PWM_CHANNEL;
+
+static void *pwm_thread(void *);
+static void sleep_until(struct timespec *);
+static void add_ns(struct timespec *, long);
+
+static pthread_t pwm_thread_id;
+static pthread_mutex_t pwm_mutex;
+static pthread_cond_t pwm_changed = PTHREAD_COND_INITIALIZER;
+static PWM_CHANNEL channels[2] = { { -1, 0 }, { -1, 0 } };
+static uint32_t generation = 0;
+static bool running = false;
+static bool stopping = false;
+static PWM_STATS *stats;
+
+bool start_pwm(PWM_STATS *pwm_stats) {
+    stats = pwm_stats;
+    memset(stats, 0, sizeof(PWM_STATS));
+
+    // Priority inheritance, so a motion thread holding the mutex can't stall the timing thread
+    pthread_mutexattr_t mutex_attr;
+    pthread_mutexattr_init(&mutex_attr);
+    pthread_mutexattr_setprotocol(&mutex_attr, PTHREAD_PRIO_INHERIT);
+    pthread_mutex_init(&pwm_mutex, &mutex_attr);
+
+    // Fresh from a stop_pwm too - no old pins, and a thread that doesn't exit at once
+    pthread_mutex_lock(&pwm_mutex);
+    stopping = false;
+    channels[0].pin = channels[1].pin = -1;
+    pthread_mutex_unlock(&pwm_mutex);
+
+    // No page faults on the timing path
+    bool realtime = (mlockall(MCL_CURRENT | MCL_FUTURE) == 0);
+
+    pthread_attr_t attr;
+    struct sched_param param;
+    pthread_attr_init(&attr);
+    pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+    pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+    param.sched_priority = PWM_PRIORITY;
+    pthread_attr_setschedparam(&attr, &param);
+
+    if (pthread_create(&pwm_thread_id, &attr, pwm_thread, NULL) != 0) {
+        // Not privileged - run anyway, jitter will be worse
+        realtime = false;
+        if (pthread_create(&pwm_thread_id, NULL, pwm_thread, NULL) != 0) {
+            fprintf(stderr, "Cannot start PWM thread!\n");
+            return false;
+        }
+    }
+    pthread_attr_destroy(&attr);
+    if (!realtime) {
+        fprintf(stderr, "PWM thread is not real time - motor speed jitter will be higher\n");
+    }
+    stats->realtime = realtime;
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    CPU_SET(cpus > PWM_CPU ? PWM_CPU : (cpus > 0 ? cpus - 1 : 0), &cpu_set);
+    pthread_setaffinity_np(pwm_thread_id, sizeof(cpu_set), &cpu_set);
+
+    running = true;
+    return true;
+}
+
+void stop_pwm() {
+    if (!running) {
+        return;
+    }
+    pthread_mutex_lock(&pwm_mutex);
+    stopping = true;
+    pthread_cond_signal(&pwm_changed);
+    pthread_mutex_unlock(&pwm_mutex);
+    pthread_join(pwm_thread_id, NULL);
+    pthread_mutex_destroy(&pwm_mutex);
+    running = false;
+}
+
+void set_pwm(int left_pin, int left_duty, int right_pin, int right_duty) {
+    // Hand pins to the timing thread - pin -1 or duty 0 / PWM_FULL means no switching.
+    // The caller switches the pins on first, so without the thread they simply stay on.
+    if (!running) {
+        return;
+    }
+
+    pthread_mutex_lock(&pwm_mutex);
+    channels[0].pin = (left_duty > 0 && left_duty < PWM_FULL) ? left_pin : -1;
+    channels[0].duty = left_duty;
+    channels[1].pin = (right_duty > 0 && right_duty < PWM_FULL) ? right_pin : -1;
+    channels[1].duty = right_duty;
+    generation++;
+    pthread_cond_signal(&pwm_changed);
+    pthread_mutex_unlock(&pwm_mutex);
+}
+
+static void *pwm_thread(void *arg) {
+    (void) arg;
+    struct timespec period_start;
+    clock_gettime(CLOCK_MONOTONIC, &period_start);
+
+    pthread_mutex_lock(&pwm_mutex);
+    while (!stopping) {
+        if (channels[0].pin < 0 && channels[1].pin < 0) {
+            // Nothing to switch - sleep until set_pwm
+            pthread_cond_wait(&pwm_changed, &pwm_mutex);
+            clock_gettime(CLOCK_MONOTONIC, &period_start);
+            continue;
+        }
+
+        // Period start - switch on, then switch off in duty order
+        uint32_t period_generation = generation;
+        PWM_CHANNEL period_channels[2];
+        memcpy(period_channels, channels, sizeof(period_channels));
+        uint64_t on_bits = 0;
+        int i;
+        for (i = 0; i < 2; i++) {
+            if (period_channels[i].pin >= 0) {
+                on_bits |= PIN_BIT(period_channels[i].pin);
+            }
+        }
+        write_pins(on_bits, 0);
+        pthread_mutex_unlock(&pwm_mutex);
+
+        int first = (period_channels[1].pin >= 0
+                        && (period_channels[0].pin < 0 || period_channels[1].duty < period_channels[0].duty))
+                    ? 1 : 0;
+        int order[2] = { first, 1 - first };
+        bool changed = false;
+
+        for (i = 0; i < 2 && !changed; i++) {
+            PWM_CHANNEL *channel = &period_channels[order[i]];
+            if (channel->pin < 0) {
+                continue;
+            }
+            uint64_t off_bits = PIN_BIT(channel->pin);
+            PWM_CHANNEL *next = &period_channels[order[1]];
+            if (i == 0 && next->pin >= 0 && next->duty == channel->duty) {
+                off_bits |= PIN_BIT(next->pin);     // Same duty - both off in one write
+                i++;
+            }
+            struct timespec off_time = period_start;
+            add_ns(&off_time, PWM_PERIOD_NS / PWM_FULL * channel->duty);
+            sleep_until(&off_time);
+
+            pthread_mutex_lock(&pwm_mutex);
+            changed = (generation != period_generation);
+            if (!changed) {
+                write_pins(0, off_bits);
+            }
+            pthread_mutex_unlock(&pwm_mutex);
+        }
+
+        if (changed) {
+            clock_gettime(CLOCK_MONOTONIC, &period_start);     // New config starts a new period now
+        } else {
+            add_ns(&period_start, PWM_PERIOD_NS);
+            sleep_until(&period_start);
+        }
+        stats->periods++;
+        pthread_mutex_lock(&pwm_mutex);
+    }
+    pthread_mutex_unlock(&pwm_mutex);
+    return NULL;
+}
+
+static void sleep_until(struct timespec *deadline) {
+    // Sleep to an absolute time and record how late we woke
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, deadline, NULL) == EINTR) {
+        // Retry after signal
+    }
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long late_ns = (now.tv_sec - deadline->tv_sec) * 1000000000L + (now.tv_nsec - deadline->tv_nsec);
+    if (late_ns < 0) {
+        late_ns = 0;
+    }
+    if (late_ns > stats->max_jitter_ns) {
+        stats->max_jitter_ns = late_ns;
+    }
+    stats->mean_jitter_ns += ((long) late_ns - (long) stats->mean_jitter_ns) / 16;
+    stats->edges++;
+}
+
+static void add_ns(struct timespec *time, long ns) {
+    time->tv_nsec += ns;
+    while (time->tv_nsec >= 1000000000L) {
+        time->tv_nsec -= 1000000000L;
+        time->tv_sec++;
+    }
+}
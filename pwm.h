@@ -0,0 +1,24 @@
+/**
+* pwm.h - Software PWM for motor speed control
+*
+* A dedicated timing thread (SCHED_FIFO, memory locked, pinned to one
+* core) switches the active H-bridge pin of each motor on at the start
+* of every period and off after its duty cycle.
+*/
+
+#ifndef PWM_H
+#define PWM_H
+
+#include <stdbool.h>
+#include "sensors.h"
+
+#define PWM_PERIOD_NS       2000000L    // 500 Hz
+#define PWM_PRIORITY        80          // SCHED_FIFO priority of the timing thread
+#define PWM_CPU             3           // Core for the timing thread - last core if fewer
+#define PWM_FULL            100         // Duty cycle percent - full on, no switching
+
+bool start_pwm(PWM_STATS *);
+void stop_pwm(void);
+void set_pwm(int, int, int, int);
+
+#endif
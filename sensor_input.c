@@ -0,0 +1,841 @@
+/**
+* sensor_input.c - sensord GPIO input handling - edge handlers for the
+* obstacle, impact and sound sensors, and the rangefinder scan loop
+*
+* All input edges arrive on one event fd and are handled in order by a
+* single epoll loop thread, timestamped by the kernel when they happened.
+* The scan loop runs on the caller's thread, since it also sleeps on the
+* motion_state futex, which epoll cannot wait on.
+*
+* Changes are staged and published together at most once per publish
+* window, so a chattering sensor costs one seqlock update and one halt
+* wakeup per window rather than per edge. Impact and sound are halt
+* critical and publish at once, taking anything staged with them.
+*
+* Flag inputs are filtered first, so motor noise and contact bounce don't
+* become false halts. A pulse counts once the line has been active for
+* its min pulse time and idle for its debounce time before that; shorter
+* pulses are counted as glitches and dropped. Both edges are watched for
+* filtered lines, and a timerfd confirms pulses still active at their
+* deadline, so each edge costs the same whatever the line is doing.
+*
+* Flags latch until a client resets them, unless the line is level
+* tracked. A tracked flag clears itself once its line has been idle for
+* the release time, and not before it has been set for the hold time.
+* Going active again, even briefly, restarts the release time, so a
+* flickering obstacle stays set. The same timerfd runs the releases.
+*
+* The scan loop also filters each ping's range into the range track: a
+* median of the last 3 drops single bad echoes, an alpha-beta filter
+* gives range and closing speed, and a median too far from the track's
+* prediction is skipped as an outlier until there are enough in a row
+* to say the track is wrong. While the time to collision is short, every
+* sample wakes anything waiting to halt, so motions can act on it.
+*
+* While a range sweep is turning, pings go as fast as for driving
+* forward, and each one is binned by heading into the sweep profile.
+*
+* Publishing only touches the binary sensor record. The ASCII view for
+* file readers is redrawn from it at most once per view interval after a
+* publish, and once per ping cycle for changes made by anything else.
+*
+* compile with sensors.o + a GPIO backend + -pthread
+*/
+
+#define _GNU_SOURCE     // sem_clockwait
+
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/timerfd.h>
+#include "gpio.h"
+#include "gpio_pins.h"
+#include "sensors.h"
+#include "stats.h"
+#include "sensor_input.h"
+
+#define SOUND_MM_PER_S      343000      // Range in mm is echo ns * 343000 / 2e9
+#define VIEW_INTERVAL_NS    10000000L   // ASCII view redrawn at most this long after a publish
+
+// Ping scheduling - next ping is due interval after the last one,
+// but never sooner than the recovery time after its echo ended
+#define PING_MAX_ECHO_NS            60000000L       // 999 cm round trip is 58 msec
+#define PING_RECOVERY_NS            10000000ULL     // Let the last ping's reflections die away
+#define PING_RECOVERY_SWEEP_NS      3000000ULL      // ...turning, they come back from elsewhere anyway
+#define PING_INTERVAL_ACTIVE_NS     0ULL            // Driving forward - recovery time only
+#define PING_INTERVAL_NORMAL_NS     200000000ULL
+#define PING_INTERVAL_IDLE_NS       1000000000ULL
+#define PING_IDLE_AFTER_NS          5000000000ULL   // No motion or demand for this long = idle
+
+// Range track - see track_range
+#define TRACK_ALPHA                 0.5     // Share of each residual taken into the range
+#define TRACK_BETA                  0.1     // ...and into the closing speed
+#define TRACK_GATE_MM               300     // Median this far off the prediction is an outlier
+#define TRACK_MAX_MISSES            3       // Outliers or no echoes in a row before the track restarts
+#define TRACK_WATCH_TTC_MS          2000    // Below this each sample signals halt events
+
+#define INPUT_EVENT_BATCH           16      // Edges read per read_pin_events call
+
+// Input filter defaults - see set_input_filter
+#define OBSTACLE_MIN_PULSE_US       2000    // IR modules flicker at the edge of their range
+#define OBSTACLE_DEBOUNCE_US        10000
+#define IMPACT_MIN_PULSE_US         100     // Switch closures last far longer than motor spikes
+#define IMPACT_DEBOUNCE_US          1000
+#define SOUND_MIN_PULSE_US          0       // Sound module pulses can be very short
+#define SOUND_DEBOUNCE_US           5000
+
+typedef struct {
+    int pin;
+    int edge;           // INT_EDGE_*
+    int sensor_id;      // SENSOR_ID_*
+    bool immediate;     // Halt critical - publish without waiting for the window
+    int min_pulse_us;   // Flags - active this long to count
+    int debounce_us;    // Flags - idle this long before a pulse to count
+    bool tracking;      // Flags - clear when the line goes idle, instead of latching
+    int hold_us;        // Tracked flags - set at least this long
+    int release_us;     // Tracked flags - idle this long to clear
+    // Filter state - input loop thread only
+    uint64_t pulse_ns;      // Start of the current active pulse, 0 if idle
+    uint64_t confirm_ns;    // When the current pulse counts, 0 if it already has or was dropped
+    uint64_t idle_ns;       // Last change to idle
+    uint64_t set_ns;        // When the line last set its flag
+    uint64_t release_ns;    // When a tracked flag clears, 0 if not due to
+} SENSOR_INPUT;
+
+// Every setting spelled out - tracking is off until set_input_tracking, the filter state starts at 0
+#define INPUT_ENTRY(gpio, active_edge, id, halt_critical, min_pulse, debounce) \
+    { .pin = gpio, .edge = active_edge, .sensor_id = id, .immediate = halt_critical, .min_pulse_us = min_pulse, \
+        .debounce_us = debounce, .tracking = false, .hold_us = 0, .release_us = 0 }
+
+// edge is the active edge of flag inputs
+static SENSOR_INPUT inputs[] = {
+    INPUT_ENTRY(RANGE_ECHO_GPIO, INT_EDGE_BOTH, SENSOR_ID_RANGE, false, 0, 0),
+    INPUT_ENTRY(IMPACT_F_GPIO, INT_EDGE_RISING, SENSOR_ID_IMPACT_F, true, IMPACT_MIN_PULSE_US, IMPACT_DEBOUNCE_US),
+    INPUT_ENTRY(IMPACT_B_GPIO, INT_EDGE_RISING, SENSOR_ID_IMPACT_B, true, IMPACT_MIN_PULSE_US, IMPACT_DEBOUNCE_US),
+    INPUT_ENTRY(OBSTACLE_F_GPIO, INT_EDGE_FALLING, SENSOR_ID_OBSTACLE_F, false, OBSTACLE_MIN_PULSE_US, OBSTACLE_DEBOUNCE_US),
+    INPUT_ENTRY(OBSTACLE_B_GPIO, INT_EDGE_FALLING, SENSOR_ID_OBSTACLE_B, false, OBSTACLE_MIN_PULSE_US, OBSTACLE_DEBOUNCE_US),
+    INPUT_ENTRY(OBSTACLE_L_GPIO, INT_EDGE_FALLING, SENSOR_ID_OBSTACLE_L, false, OBSTACLE_MIN_PULSE_US, OBSTACLE_DEBOUNCE_US),
+    INPUT_ENTRY(OBSTACLE_R_GPIO, INT_EDGE_FALLING, SENSOR_ID_OBSTACLE_R, false, OBSTACLE_MIN_PULSE_US, OBSTACLE_DEBOUNCE_US),
+    INPUT_ENTRY(SOUND_GPIO, INT_EDGE_FALLING, SENSOR_ID_SOUND, true, SOUND_MIN_PULSE_US, SOUND_DEBOUNCE_US)
+};
+
+#define INPUT_COUNT     ((int) (sizeof(inputs) / sizeof(inputs[0])))
+
+void *input_loop(void *);
+void handle_edge(GPIO_EVENT *);
+void range_echo_edge(GPIO_EVENT *);
+void filter_edge(SENSOR_INPUT *, GPIO_EVENT *);
+void filter_deadlines(uint64_t);
+void arm_filter_timer(void);
+void start_release(SENSOR_INPUT *, uint64_t);
+void set_positive(SENSOR_INPUT *, uint64_t);
+void clear_positive(SENSOR_INPUT *, uint64_t);
+void track_range(int, uint64_t);
+void sweep_range(int, uint64_t);
+void stage_update(uint64_t, bool);
+void publish_pending(bool);
+uint64_t ping_interval_ns(uint32_t, uint64_t);
+long cpu_time_us(void);
+
+#define ECHO_IDLE       0   // No ping outstanding
+#define ECHO_WAITING    1   // Ping sent, waiting for echo pin to go HIGH
+#define ECHO_STARTED    2   // Echo pin HIGH, waiting for it to go LOW
+
+static uint64_t echo_start_ns;           // Kernel time of the echo's rising edge
+        // Rangefinder sets pin HIGH for the time it took the pulse to leave and return as echo
+static int echo_state = ECHO_IDLE;        // Shared with the input loop - access atomically
+static sem_t echo_done;                 // Posted by the input loop when a measurement completes
+static int echo_range_mm;               // Range and time of the completed echo, for the scan loop
+static uint64_t echo_end_ns;
+
+// Range track - scan loop thread only
+static int track_samples[3];            // Latest raw ranges, for the median
+static int track_sample_count = 0;
+static bool tracking = false;
+static double track_mm;
+static double track_mm_s;               // Rate of change - negative while closing
+static uint64_t track_ns;
+static int track_misses = 0;
+static bool track_watched = false;      // Last published time to collision was short
+
+static int pin_events = -1;             // All input edges
+static int stop_input = -1;             // eventfd - ends the input loop
+static int publish_timer = -1;          // timerfd - end of the publish window
+static int filter_timer = -1;           // timerfd - next pulse to confirm or flag to release
+static int view_timer = -1;             // timerfd - ASCII view redraw after a publish
+static uint64_t filter_timer_ns = 0;    // When it is armed for, 0 if disarmed - input loop thread only
+static pthread_t input_thread;
+
+// Staged changes - input loop thread only
+static long publish_window_ns;
+static bool publish_timer_armed = false;
+static bool view_timer_armed = false;
+static uint32_t pending_flags = 0;      // STATE_FLAG(SENSOR_ID_*) for flags to set
+static uint32_t pending_clears = 0;     // ...and for tracked flags to clear
+static int pending_range = -1;          // Range to publish, -1 if none
+static int pending_updates = 0;
+static uint64_t pending_since_ns;       // Edge time of the first staged change
+
+static SENSOR_MEMORY *sensor_memory;
+
+int set_input_filter(int sensor_id, int min_pulse_us, int debounce_us) {
+    // Before setup_sensor_input - returns 0, or -1 if sensor_id is not a flag input
+    int i;
+    for (i = 0; i < INPUT_COUNT; i++) {
+        if (inputs[i].sensor_id == sensor_id && sensor_id != SENSOR_ID_RANGE) {
+            inputs[i].min_pulse_us = min_pulse_us;
+            inputs[i].debounce_us = debounce_us;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+int parse_input_filter(char *spec) {
+    // "name=min_pulse_usec,debounce_usec" - name can be a prefix, e.g. "obstacle" for all four
+    // Returns 0, or -1 if malformed or no sensor matches
+    char name[32];
+    int min_pulse_us;
+    int debounce_us;
+    char extra;
+    if (sscanf(spec, "%31[a-z_]=%d,%d%c", name, &min_pulse_us, &debounce_us, &extra) != 3
+            || min_pulse_us < 0 || debounce_us < 0) {
+        return -1;
+    }
+    int matched = 0;
+    int sensor_id;
+    for (sensor_id = SENSOR_ID_OBSTACLE_F; sensor_id < SENSOR_ID_COUNT; sensor_id++) {
+        if (strncmp(name, sensor_name(sensor_id), strlen(name)) == 0
+                && set_input_filter(sensor_id, min_pulse_us, debounce_us) == 0) {
+            matched++;
+        }
+    }
+    return matched > 0 ? 0 : -1;
+}
+
+int set_input_tracking(int sensor_id, int hold_us, int release_us) {
+    // Before setup_sensor_input - hold_us -1 latches the flag again (the default)
+    // Returns 0, or -1 if sensor_id is not a flag input
+    int i;
+    for (i = 0; i < INPUT_COUNT; i++) {
+        if (inputs[i].sensor_id == sensor_id && sensor_id != SENSOR_ID_RANGE) {
+            inputs[i].tracking = hold_us >= 0;
+            inputs[i].hold_us = hold_us;
+            inputs[i].release_us = release_us;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+int parse_input_tracking(char *spec) {
+    // "name=hold_usec,release_usec" or "name=latch" - name can be a prefix, as for parse_input_filter
+    // Returns 0, or -1 if malformed or no sensor matches
+    char name[32];
+    int hold_us = -1;
+    int release_us = 0;
+    char extra;
+    int length = 0;
+    if (sscanf(spec, "%31[a-z_]=latch%n", name, &length) == 1 && length > 0 && spec[length] == '\0') {
+        // Latched
+    } else if (sscanf(spec, "%31[a-z_]=%d,%d%c", name, &hold_us, &release_us, &extra) != 3
+            || hold_us < 0 || release_us < 0) {
+        return -1;
+    }
+    int matched = 0;
+    int sensor_id;
+    for (sensor_id = SENSOR_ID_OBSTACLE_F; sensor_id < SENSOR_ID_COUNT; sensor_id++) {
+        if (strncmp(name, sensor_name(sensor_id), strlen(name)) == 0
+                && set_input_tracking(sensor_id, hold_us, release_us) == 0) {
+            matched++;
+        }
+    }
+    return matched > 0 ? 0 : -1;
+}
+
+int setup_sensor_input(SENSOR_MEMORY *memory, int window_us) {
+    // Call once after setup_gpio - returns 0, or -1 if the input lines are unavailable
+    // Changes are published within window_us of the edge, 0 publishes every change at once
+    sensor_memory = memory;
+    publish_window_ns = window_us * 1000L;
+    sensor_memory->publish_stats.window_us = window_us;
+
+    set_pin_mode (RANGE_TRIGGER_GPIO, OUTPUT);
+    sem_init(&echo_done, 0, 0);
+
+    int count = INPUT_COUNT;
+    int pins[count];
+    int edges[count];
+    int i;
+    for (i = 0; i < count; i++) {
+        pins[i] = inputs[i].pin;
+        edges[i] = inputs[i].edge;
+        if (inputs[i].min_pulse_us > 0 || inputs[i].debounce_us > 0 || inputs[i].tracking) {
+            edges[i] = INT_EDGE_BOTH;   // Filter and level tracking need to see the line go idle
+        }
+        if (inputs[i].sensor_id != SENSOR_ID_RANGE) {
+            FILTER_STATS *filter_stats = &sensor_memory->filter_stats;
+            filter_stats->min_pulse_us[inputs[i].sensor_id] = inputs[i].min_pulse_us;
+            filter_stats->debounce_us[inputs[i].sensor_id] = inputs[i].debounce_us;
+            filter_stats->hold_us[inputs[i].sensor_id] = inputs[i].tracking ? inputs[i].hold_us : -1;
+            filter_stats->release_us[inputs[i].sensor_id] = inputs[i].tracking ? inputs[i].release_us : -1;
+        }
+    }
+    pin_events = open_pin_events(pins, edges, count);
+    if (pin_events < 0) {
+        fprintf(stderr, "Cannot watch sensor inputs!\n");
+        return -1;
+    }
+
+    stop_input = eventfd(0, EFD_CLOEXEC);
+    publish_timer = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    filter_timer = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    view_timer = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    if (stop_input < 0 || publish_timer < 0 || filter_timer < 0 || view_timer < 0
+            || pthread_create(&input_thread, NULL, input_loop, NULL) != 0) {
+        fprintf(stderr, "Cannot start sensor input loop!\n");
+        close_pin_events(pin_events);
+        return -1;
+    }
+    return 0;
+}
+
+void stop_sensor_input() {
+    uint64_t one = 1;
+    if (write(stop_input, &one, sizeof(one)) == sizeof(one)) {
+        pthread_join(input_thread, NULL);
+    }
+    close(stop_input);
+    close(publish_timer);
+    close(filter_timer);
+    close(view_timer);
+    close_pin_events(pin_events);
+}
+
+void *input_loop(void *arg) {
+    (void) arg;
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event watch;
+    watch.events = EPOLLIN;
+    watch.data.fd = pin_events;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, pin_events, &watch);
+    watch.data.fd = stop_input;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, stop_input, &watch);
+    watch.data.fd = publish_timer;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, publish_timer, &watch);
+    watch.data.fd = filter_timer;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, filter_timer, &watch);
+    watch.data.fd = view_timer;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, view_timer, &watch);
+
+    GPIO_EVENT events[INPUT_EVENT_BATCH];
+    bool stopping = false;
+
+    while (!stopping) {
+        struct epoll_event ready[5];
+        int ready_count = epoll_wait(epoll_fd, ready, 5, -1);
+        if (ready_count < 0 && errno != EINTR) {
+            fprintf(stderr, "Sensor input loop failed!\n");
+            break;
+        }
+        uint64_t deadline_ns = 0;
+        int i;
+        for (i = 0; i < ready_count; i++) {
+            if (ready[i].data.fd == stop_input) {
+                stopping = true;
+            }
+            if (ready[i].data.fd == publish_timer) {
+                uint64_t expirations;
+                if (read(publish_timer, &expirations, sizeof(expirations)) > 0) {
+                    publish_timer_armed = false;
+                    publish_pending(false);
+                }
+            }
+            if (ready[i].data.fd == filter_timer) {
+                uint64_t expirations;
+                if (read(filter_timer, &expirations, sizeof(expirations)) > 0) {
+                    filter_timer_ns = 0;
+                    deadline_ns = monotonic_ns();
+                }
+            }
+            if (ready[i].data.fd == view_timer) {
+                uint64_t expirations;
+                if (read(view_timer, &expirations, sizeof(expirations)) > 0) {
+                    view_timer_armed = false;
+                    refresh_sensor_view(sensor_memory);
+                }
+            }
+        }
+
+        // Drain every pending edge, in the order they happened
+        int count;
+        while ((count = read_pin_events(pin_events, events, INPUT_EVENT_BATCH)) > 0) {
+            for (i = 0; i < count; i++) {
+                handle_edge(&events[i]);
+            }
+        }
+
+        // Confirm pulses only once edges queued before the timer fired have ended the short ones,
+        // and release flags only if their lines didn't go active again meanwhile
+        if (deadline_ns != 0) {
+            filter_deadlines(deadline_ns);
+        }
+    }
+    publish_pending(false);
+    refresh_sensor_view(sensor_memory);
+    close(epoll_fd);
+    return NULL;
+}
+
+void run_range_scan(volatile bool *stop) {
+    // Ping until *stop is set, then leave the trigger LOW
+    struct timespec pulse_width;            // Pulse width is 10 usec
+    pulse_width.tv_sec = 0;
+    pulse_width.tv_nsec = 10000L;
+
+    uint64_t stats_start = monotonic_ns();
+    uint64_t stats_pings = 0;
+    long stats_cpu_us = cpu_time_us();
+
+    while(!*stop) {
+        while (sem_trywait(&echo_done) == 0) {
+            // Drop a late completion from the previous ping
+        }
+        uint64_t ping_start = monotonic_ns();
+        __atomic_store_n(&echo_state, ECHO_WAITING, __ATOMIC_RELEASE);
+
+        // Send 10 usec pulse
+        write_pin(RANGE_TRIGGER_GPIO, HIGH);
+        nanosleep(&pulse_width, (struct timespec *)NULL);
+        write_pin(RANGE_TRIGGER_GPIO, LOW);
+        sensor_memory->ping_stats.pings++;
+        
+        // Wait for the echo to complete (echo_handler posts echo_done), not a fixed time
+        struct timespec echo_deadline;
+        clock_gettime(CLOCK_MONOTONIC, &echo_deadline);
+        echo_deadline.tv_nsec += PING_MAX_ECHO_NS;
+        echo_deadline.tv_sec += echo_deadline.tv_nsec / 1000000000L;
+        echo_deadline.tv_nsec %= 1000000000L;
+        while (sem_clockwait(&echo_done, CLOCK_MONOTONIC, &echo_deadline) < 0 && errno == EINTR
+                && !*stop) {
+            // Retry after signal
+        }
+        
+        // If there was no reading, set range to the maximum
+        if (__atomic_exchange_n(&echo_state, ECHO_IDLE, __ATOMIC_ACQ_REL) != ECHO_IDLE) {
+            uint64_t now = monotonic_ns();
+            update_sensor_state(sensor_memory, STATE_RANGE, STATE_RANGE_VALID | RANGE_MAX_MM);
+            log_sensor_event(sensor_memory, SENSOR_ID_RANGE, RANGE_MAX_MM, now);
+            sensor_memory->ping_stats.timeouts++;
+            track_range(RANGE_MAX_MM, now);
+            sweep_range(RANGE_MAX_MM, ping_start);
+        } else {
+            sensor_memory->ping_stats.echoes++;
+            STATS_LATENCY(sensor_memory, echo_ns, ping_start);
+            track_range(echo_range_mm, echo_end_ns);
+            sweep_range(echo_range_mm, echo_start_ns + (echo_end_ns - echo_start_ns) / 2);
+        }
+        uint64_t echo_end = monotonic_ns();
+
+        // Timeouts above and client resets don't go through the input loop
+        refresh_sensor_view(sensor_memory);
+        
+        // Wait until the next ping is due - sooner if motors start moving
+        for (;;) {
+            uint32_t motion_state = __atomic_load_n(&sensor_memory->motion_state, __ATOMIC_ACQUIRE);
+            uint64_t next_ping = ping_start + ping_interval_ns(motion_state, echo_end);
+            uint64_t recovery_ns = (motion_state & MOTION_SWEEP) ? PING_RECOVERY_SWEEP_NS : PING_RECOVERY_NS;
+            if (next_ping < echo_end + recovery_ns) {
+                next_ping = echo_end + recovery_ns;
+            }
+            uint64_t now = monotonic_ns();
+            if (now >= next_ping || *stop) {
+                break;
+            }
+            wait_motion_state(sensor_memory, motion_state, next_ping - now);
+        }
+        
+        // Publish achieved ping rate and CPU use once a second
+        uint64_t now = monotonic_ns();
+        if (now - stats_start >= 1000000000ULL) {
+            long cpu_us = cpu_time_us();
+            PING_STATS *ping_stats = &sensor_memory->ping_stats;
+            ping_stats->rate_x10 = (ping_stats->pings - stats_pings) * 10000000000ULL / (now - stats_start);
+            ping_stats->cpu_permille = (cpu_us - stats_cpu_us) * 1000000ULL / (now - stats_start);
+            stats_start = now;
+            stats_pings = ping_stats->pings;
+            stats_cpu_us = cpu_us;
+        }
+    }
+    
+    write_pin(RANGE_TRIGGER_GPIO, LOW); 
+}
+
+void handle_edge(GPIO_EVENT *event) {
+    int i;
+    for (i = 0; i < INPUT_COUNT && inputs[i].pin != event->pin; i++) {
+        // Find the sensor on this pin
+    }
+    if (i == INPUT_COUNT) {
+        return;
+    }
+    sensor_memory->publish_stats.edges++;
+    if (inputs[i].sensor_id == SENSOR_ID_RANGE) {
+        range_echo_edge(event);
+    } else {
+        filter_edge(&inputs[i], event);
+    }
+}
+
+void filter_edge(SENSOR_INPUT *input, GPIO_EVENT *event) {
+    // Pass on pulses that pass the line's filter, count the ones that don't
+    uint64_t edge_ns = event->timestamp_ns;
+    bool active = (event->value == HIGH) == (input->edge == INT_EDGE_RISING);
+
+    if (input->min_pulse_us == 0 && input->debounce_us == 0) {
+        // Unfiltered - only tracked lines see idle edges
+        if (active) {
+            input->release_ns = 0;
+            set_positive(input, edge_ns);
+        } else {
+            start_release(input, edge_ns);
+        }
+        return;
+    }
+    if (!active) {
+        if (input->confirm_ns != 0) {
+            if (edge_ns < input->confirm_ns) {
+                sensor_memory->filter_stats.glitches[input->sensor_id]++;
+            } else {
+                // Long enough, the timer just hasn't fired yet
+                set_positive(input, input->pulse_ns);
+            }
+            input->confirm_ns = 0;
+            arm_filter_timer();
+        }
+        input->pulse_ns = 0;
+        input->idle_ns = edge_ns;
+        start_release(input, edge_ns);
+        return;
+    }
+    if (input->pulse_ns != 0) {
+        return;         // Missed the idle edge - still the same pulse
+    }
+    input->pulse_ns = edge_ns;
+    input->release_ns = 0;      // Any activity holds a tracked flag, glitch or not
+
+    // Counts once it has lasted min_pulse_us and the line was idle for debounce_us before it
+    uint64_t confirm_ns = edge_ns + input->min_pulse_us * 1000ULL;
+    if (input->idle_ns != 0 && input->idle_ns + input->debounce_us * 1000ULL > confirm_ns) {
+        confirm_ns = input->idle_ns + input->debounce_us * 1000ULL;
+    }
+    if (confirm_ns <= edge_ns) {
+        set_positive(input, edge_ns);
+    } else {
+        input->confirm_ns = confirm_ns;
+        arm_filter_timer();
+    }
+}
+
+void filter_deadlines(uint64_t now_ns) {
+    // Pulses still active at their confirm time count from when they started,
+    // tracked flags still idle at their release time clear
+    int i;
+    for (i = 0; i < INPUT_COUNT; i++) {
+        if (inputs[i].confirm_ns != 0 && inputs[i].confirm_ns <= now_ns) {
+            inputs[i].confirm_ns = 0;
+            set_positive(&inputs[i], inputs[i].pulse_ns);
+        }
+        if (inputs[i].release_ns != 0 && inputs[i].release_ns <= now_ns) {
+            inputs[i].release_ns = 0;
+            clear_positive(&inputs[i], now_ns);
+        }
+    }
+    arm_filter_timer();
+}
+
+void arm_filter_timer() {
+    // One shot at the earliest confirm or release time, disarmed if nothing is waiting.
+    // Left alone if already due no later - an early expiry just arms it again.
+    uint64_t next_ns = 0;
+    int i;
+    for (i = 0; i < INPUT_COUNT; i++) {
+        if (inputs[i].confirm_ns != 0 && (next_ns == 0 || inputs[i].confirm_ns < next_ns)) {
+            next_ns = inputs[i].confirm_ns;
+        }
+        if (inputs[i].release_ns != 0 && (next_ns == 0 || inputs[i].release_ns < next_ns)) {
+            next_ns = inputs[i].release_ns;
+        }
+    }
+    if (filter_timer_ns != 0 && next_ns != 0 && filter_timer_ns <= next_ns) {
+        return;
+    }
+    filter_timer_ns = next_ns;
+    struct itimerspec deadline = { { 0, 0 }, { 0, 0 } };
+    deadline.it_value.tv_sec = next_ns / 1000000000ULL;
+    deadline.it_value.tv_nsec = next_ns % 1000000000ULL;
+    timerfd_settime(filter_timer, TFD_TIMER_ABSTIME, &deadline, NULL);
+}
+
+void start_release(SENSOR_INPUT *input, uint64_t idle_ns) {
+    // Line went idle - a tracked flag that is set clears release_us later,
+    // but not before it has been set for hold_us
+    uint32_t flag = STATE_FLAG(input->sensor_id);
+    if (!input->tracking || (pending_clears & flag)
+            || !((read_sensor_state(sensor_memory) | pending_flags) & flag)) {
+        return;
+    }
+    uint64_t release_ns = idle_ns + input->release_us * 1000ULL;
+    if (input->set_ns + input->hold_us * 1000ULL > release_ns) {
+        release_ns = input->set_ns + input->hold_us * 1000ULL;
+    }
+    if (release_ns <= idle_ns) {
+        clear_positive(input, idle_ns);
+        return;
+    }
+    input->release_ns = release_ns;
+    arm_filter_timer();
+}
+
+void set_positive(SENSOR_INPUT *input, uint64_t edge_ns) {
+    int sensor_id = input->sensor_id;
+    STATS_COUNT(sensor_memory, handler_calls[sensor_id]);
+    input->set_ns = edge_ns;
+
+    // Every pulse goes into the event history, even if the flag is already latched
+    log_sensor_event(sensor_memory, sensor_id, 1, edge_ns);
+
+    // A tracked flag about to clear just stays set
+    uint32_t flag = STATE_FLAG(sensor_id);
+    if (pending_clears & flag) {
+        pending_clears &= ~flag;
+        return;
+    }
+    // If sensor value is already positive, or about to be, exit here
+    if ((read_sensor_state(sensor_memory) & flag) || (pending_flags & flag)) {
+        return;
+    }
+    // Otherwise stage it - halt critical flags go out now and wake anything waiting to halt
+    pending_flags |= flag;
+    stage_update(edge_ns, input->immediate);
+}
+
+void clear_positive(SENSOR_INPUT *input, uint64_t now_ns) {
+    // A tracked flag's line has been idle long enough - clears are never halt critical
+    int sensor_id = input->sensor_id;
+    uint32_t flag = STATE_FLAG(sensor_id);
+    log_sensor_event(sensor_memory, sensor_id, 0, now_ns);
+    sensor_memory->filter_stats.releases[sensor_id]++;
+    if (pending_flags & flag) {
+        pending_flags &= ~flag;     // Set and cleared within one window
+        return;
+    }
+    pending_clears |= flag;
+    stage_update(now_ns, false);
+}
+
+void stage_update(uint64_t edge_ns, bool immediate) {
+    // Count a staged change and publish it now, or make sure it is by the end of the window
+    if (pending_updates++ == 0) {
+        pending_since_ns = edge_ns;
+    }
+    sensor_memory->publish_stats.updates++;
+    if (immediate || publish_window_ns == 0) {
+        publish_pending(immediate);
+        return;
+    }
+    if (publish_timer_armed) {
+        return;
+    }
+    struct itimerspec window;
+    window.it_interval.tv_sec = 0;
+    window.it_interval.tv_nsec = 0;
+    window.it_value.tv_sec = publish_window_ns / 1000000000L;
+    window.it_value.tv_nsec = publish_window_ns % 1000000000L;
+    timerfd_settime(publish_timer, 0, &window, NULL);
+    publish_timer_armed = true;
+}
+
+void publish_pending(bool immediate) {
+    // Make every staged change visible in one state update
+    if (pending_updates == 0) {
+        return;
+    }
+    uint32_t clear = pending_clears;
+    uint32_t set = pending_flags;
+    if (pending_range >= 0) {
+        clear |= STATE_RANGE;
+        set |= STATE_RANGE_VALID | pending_range;
+    }
+    update_sensor_state(sensor_memory, clear, set);
+    if (pending_flags != 0 || pending_clears != 0) {
+        signal_sensor_event(sensor_memory);     // Clears too, for motions paused on an obstacle
+    }
+    STATS_LATENCY(sensor_memory, publish_ns, pending_since_ns);
+
+    PUBLISH_STATS *publish_stats = &sensor_memory->publish_stats;
+    publish_stats->publishes++;
+    publish_stats->merged += pending_updates - 1;
+    if (immediate) {
+        publish_stats->immediate++;
+    }
+    pending_flags = 0;
+    pending_clears = 0;
+    pending_range = -1;
+    pending_updates = 0;
+
+    if (publish_timer_armed) {
+        struct itimerspec disarm = { { 0, 0 }, { 0, 0 } };
+        timerfd_settime(publish_timer, 0, &disarm, NULL);
+        publish_timer_armed = false;
+    }
+
+    // File readers see the change within a view interval, however many publishes it covers
+    if (!view_timer_armed) {
+        struct itimerspec redraw = { { 0, 0 }, { 0, VIEW_INTERVAL_NS } };
+        timerfd_settime(view_timer, 0, &redraw, NULL);
+        view_timer_armed = true;
+    }
+}
+
+void range_echo_edge(GPIO_EVENT *event) {
+    STATS_COUNT(sensor_memory, handler_calls[SENSOR_ID_RANGE]);
+    
+    int state = __atomic_load_n(&echo_state, __ATOMIC_ACQUIRE);
+    if (state == ECHO_IDLE) {
+        return;         // If not waiting for measurement, exit here
+    }
+    
+    // Handle start of echo signal
+    if (state == ECHO_WAITING && event->value == HIGH) {
+        echo_start_ns = event->timestamp_ns;
+        __atomic_compare_exchange_n(&echo_state, &state, ECHO_STARTED, false,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+        return;
+    }
+    
+    if ( ! (state == ECHO_STARTED && event->value == LOW) ) {
+        return;
+    }
+    
+    // Both edges are kernel timestamps, so wakeup latency doesn't affect the range
+    uint64_t t = event->timestamp_ns - echo_start_ns;      // Time (nsec) for pulse echo to return
+    uint64_t r = (t * SOUND_MM_PER_S + 1000000000ULL) / 2000000000ULL;    // Range in mm, rounded
+    int range = (r > RANGE_MAX_MM) ? RANGE_MAX_MM : (int) r;             // 0-9990 mm
+    
+    // Handle end of echo signal, unless the scan loop already gave up on it - the
+    // exchange hands the range to the scan loop
+    echo_range_mm = range;
+    echo_end_ns = event->timestamp_ns;
+    if (!__atomic_compare_exchange_n(&echo_state, &state, ECHO_IDLE, false,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+    
+    pending_range = range;
+    stage_update(event->timestamp_ns, false);
+    log_sensor_event(sensor_memory, SENSOR_ID_RANGE, range, event->timestamp_ns);
+    sem_post(&echo_done);
+}
+
+void track_range(int range_mm, uint64_t sample_ns) {
+    // Fold one ping's range into the range track and publish it
+    if (range_mm >= RANGE_MAX_MM) {
+        // Nothing in range - a missed echo, or the track's object has gone.
+        // The median starts over either way, older ranges would drag on it
+        track_sample_count = 0;
+        if (tracking && ++track_misses >= TRACK_MAX_MISSES) {
+            tracking = false;
+            publish_range_track(sensor_memory, -1, 0, sample_ns);
+            if (track_watched) {
+                track_watched = false;
+                signal_sensor_event(sensor_memory);
+            }
+        }
+        return;
+    }
+
+    // Median of the last 3 raw ranges, or of what there is so far
+    track_samples[track_sample_count++ % 3] = range_mm;
+    int median = range_mm;
+    if (track_sample_count >= 3) {
+        int a = track_samples[0], b = track_samples[1], c = track_samples[2];
+        median = (a > b) ? ((b > c) ? b : ((a > c) ? c : a)) : ((a > c) ? a : ((b > c) ? c : b));
+    }
+
+    if (!tracking || sample_ns <= track_ns) {
+        tracking = true;
+        track_mm = median;
+        track_mm_s = 0;
+    } else {
+        double dt = (sample_ns - track_ns) / 1e9;
+        double predicted_mm = track_mm + track_mm_s * dt;
+        double residual = median - predicted_mm;
+        if (residual > TRACK_GATE_MM || residual < -TRACK_GATE_MM) {
+            if (++track_misses < TRACK_MAX_MISSES) {
+                return;     // Outlier - the published track ages meanwhile
+            }
+            track_mm = median;          // Consistently somewhere else - start over from here
+            track_mm_s = 0;
+        } else {
+            track_mm = predicted_mm + TRACK_ALPHA * residual;
+            track_mm_s += TRACK_BETA * residual / dt;
+        }
+    }
+    track_ns = sample_ns;
+    track_misses = 0;
+
+    int published_mm = track_mm > 0 ? (int) (track_mm + 0.5) : 0;
+    int ttc_ms = publish_range_track(sensor_memory, published_mm, (int) (-track_mm_s), sample_ns);
+    bool watched = ttc_ms < TRACK_WATCH_TTC_MS;
+    if (watched || track_watched) {
+        signal_sensor_event(sensor_memory);     // Closing in, or just stopped closing in
+    }
+    track_watched = watched;
+}
+
+void sweep_range(int range_mm, uint64_t sample_ns) {
+    // Bin a ping into the sweep profile if a sweep is turning - sample_ns is when the sound was
+    // at the target, halfway through the echo
+    if (__atomic_load_n(&sensor_memory->motion_state, __ATOMIC_ACQUIRE) & MOTION_SWEEP) {
+        record_sweep_range(sensor_memory, range_mm, sample_ns);
+    }
+}
+
+uint64_t ping_interval_ns(uint32_t motion_state, uint64_t now) {
+    // Pick the ping rate from what the motors are doing and who is reading
+    PING_STATS *ping_stats = &sensor_memory->ping_stats;
+    uint64_t demand_ns = __atomic_load_n(&sensor_memory->demand_ns, __ATOMIC_RELAXED);
+    
+    if (motion_state & (MOTION_FORWARD | MOTION_SWEEP)) {
+        ping_stats->mode = PING_MODE_ACTIVE;
+        ping_stats->interval_ms = PING_INTERVAL_ACTIVE_NS / 1000000;
+        return PING_INTERVAL_ACTIVE_NS;
+    }
+    if (motion_state & MOTION_MOVING || now < demand_ns + PING_IDLE_AFTER_NS) {
+        ping_stats->mode = PING_MODE_NORMAL;
+        ping_stats->interval_ms = PING_INTERVAL_NORMAL_NS / 1000000;
+        return PING_INTERVAL_NORMAL_NS;
+    }
+    ping_stats->mode = PING_MODE_IDLE;
+    ping_stats->interval_ms = PING_INTERVAL_IDLE_NS / 1000000;
+    return PING_INTERVAL_IDLE_NS;
+}
+
+long cpu_time_us() {
+    // User + system time of all sensord threads
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000L
+            + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
@@ -0,0 +1,24 @@
+/**
+* sensor_input.h - sensord GPIO input handling
+*
+* sensord runs these against wiringPi on the robot, bench runs them
+* against the GPIO simulator.
+*/
+
+#ifndef SENSOR_INPUT_H
+#define SENSOR_INPUT_H
+
+#include <stdbool.h>
+#include "sensors.h"
+
+#define SENSOR_PUBLISH_WINDOW_US    250     // Default - changes are visible this long after their edge at most
+
+int set_input_filter(int, int, int);
+int parse_input_filter(char *);
+int set_input_tracking(int, int, int);
+int parse_input_tracking(char *);
+int setup_sensor_input(SENSOR_MEMORY *, int);
+void stop_sensor_input(void);
+void run_range_scan(volatile bool *);
+
+#endif
@@ -8,66 +8,569 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <errno.h>
 #include <fcntl.h>
-#include <sys/shm.h>
+#include <limits.h>
+#include <sched.h>
+#include <string.h>
+#include <time.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
 #include <unistd.h>
-#include <wiringPi.h>
 #include "gpio_pins.h"
 #include "sensors.h"
+#include "stats.h"
 
-int access_sensor_memory(SENSOR_DATA **sensor_values_ptr, int mode) {
-
-    // Set the shared memory key    (Shared memory key, Size in bytes, Permission flags)
-    int shared_memory_id = shmget((key_t)SHARED_MEMORY_KEY, sizeof(SENSOR_DATA), mode & 011777);	
-        //  Permission flags
-        //  Operation permissions   Octal value
-        //  Open read-only          010000 - SHM_RDONLY
-        //  Create IPC mem segment  001000 - IPC_CREAT
-        //  Read by user            000400
-        //  Write by user           000200
-        //  Read by group           000040
-        //  Write by group          000020
-        //  Read by others          000004
-        //  Write by others         000002
-    if (shared_memory_id < 0)
+#if defined(__i386__) || defined(__x86_64__)
+#define cpu_relax()     __builtin_ia32_pause()
+#elif defined(__arm__) || defined(__aarch64__)
+#define cpu_relax()     __asm__ __volatile__("yield" ::: "memory")
+#else
+#define cpu_relax()     __asm__ __volatile__("" ::: "memory")
+#endif
+
+static void read_backoff(int);
+
+int access_sensor_memory(SENSOR_MEMORY **sensor_memory_ptr, int mode) {
+
+    /**
+    * Sensor memory is SENSOR_FILE mapped shared into every process, so
+    * writers update it in place and file readers see the same bytes.
+    *
+    *   Mode flags
+    *   SENSOR_MEMORY_RDONLY    Map read-only
+    *   SENSOR_MEMORY_CREATE    Create the file if needed and initialize it (sensord only)
+    *   0777 bits               Permissions for a created file
+    **/
+    
+    bool read_only = (mode & SENSOR_MEMORY_RDONLY) != 0;
+    bool create = (mode & SENSOR_MEMORY_CREATE) != 0 && !read_only;
+    
+    int flags = read_only ? O_RDONLY : O_RDWR;
+    if (create) {
+        flags |= O_CREAT;
+    }
+    int fd = open(SENSOR_FILE, flags, mode & 0777);
+    if (fd < 0)
     {
-        fprintf(stderr, "shmget failed!\n");
-        return shared_memory_id;
+        fprintf(stderr, "Cannot open %s!\n", SENSOR_FILE);
+        return -1;
     }
     
-    //Make the shared memory accessible to the program
-    *sensor_values_ptr = (SENSOR_DATA*) shmat(shared_memory_id, (void *)0, mode & SHM_RDONLY);
-    if ( *sensor_values_ptr < (SENSOR_DATA*) 0 )
-    {
-        fprintf(stderr, "shmat failed!\n");
-        if (mode & IPC_CREAT) {
-            shmctl( shared_memory_id, IPC_RMID, 0 );
+    if (create) {
+        if (ftruncate(fd, sizeof(SENSOR_MEMORY)) < 0) {
+            fprintf(stderr, "Cannot size %s!\n", SENSOR_FILE);
+            close(fd);
+            return -1;
+        }
+        fchmod(fd, mode & 0777);    // Not subject to umask
+    } else {
+        struct stat file_stat;
+        if (fstat(fd, &file_stat) < 0 || file_stat.st_size < (off_t) sizeof(SENSOR_MEMORY)) {
+            fprintf(stderr, "%s is not sensor memory - is sensord running?\n", SENSOR_FILE);
+            close(fd);
+            return -1;
         }
+    }
+    
+    void *mapped = mmap(NULL, sizeof(SENSOR_MEMORY), 
+                        read_only ? PROT_READ : (PROT_READ | PROT_WRITE), MAP_SHARED, fd, 0);
+    close(fd);      // Mapping stays valid
+    if (mapped == MAP_FAILED)
+    {
+        fprintf(stderr, "mmap failed!\n");
         return -1;
     }
+    
+    *sensor_memory_ptr = (SENSOR_MEMORY*) mapped;
+    if (create) {
+        memset(mapped, 0, sizeof(SENSOR_MEMORY));
+    }
+    return 0;
 }
 
-void release_sensor_memory(int shared_memory_id, SENSOR_DATA *sensor_values) {
-	shmdt( (void *) sensor_values );
-    shmctl( shared_memory_id, IPC_RMID, 0 );
+void release_sensor_memory(SENSOR_MEMORY *sensor_memory) {
+    munmap( (void *) sensor_memory, sizeof(SENSOR_MEMORY) );
 }
 
-size_t read_sensor_file(SENSOR_DATA *sensor_values) {
-    FILE *sensor_file = fopen(SENSOR_FILE, "r"); // Open read only
-    if (sensor_file == NULL) 
-    {
-        return -1;
+/**
+* Seqlock access to sensor memory
+*
+* Writers (refresh_sensor_view below) bracket every change to
+* sensor_memory->data with begin_sensor_update / end_sensor_update. The
+* sequence is odd while a change is in progress, so readers copy the data
+* and retry if the sequence was odd or moved underneath them. Readers never
+* write to the segment and can never hold up a writer.
+**/
+
+void begin_sensor_update(SENSOR_MEMORY *sensor_memory) {
+    uint32_t sequence = __atomic_load_n(&sensor_memory->sequence, __ATOMIC_RELAXED);
+    
+    // Writers claim the update by moving the sequence from even to odd
+    while ((sequence & 1) 
+            || !__atomic_compare_exchange_n(&sensor_memory->sequence, &sequence, sequence + 1,
+                                            true, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        if (sequence & 1) {
+            sched_yield();  // Another handler is mid-update
+            sequence = __atomic_load_n(&sensor_memory->sequence, __ATOMIC_RELAXED);
+        }
+    }
+    // Odd sequence must be visible before any data changes
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+void end_sensor_update(SENSOR_MEMORY *sensor_memory) {
+    __atomic_store_n(&sensor_memory->sequence, sensor_memory->sequence + 1, __ATOMIC_RELEASE);
+    STATS_COUNT(sensor_memory, publishes);
+}
+
+static void read_backoff(int attempt) {
+    // A writer on another core is done in a few hundred ns - one preempted on ours needs the CPU back
+    if (attempt < SENSOR_READ_SPINS) {
+        cpu_relax();
+    } else {
+        sched_yield();
+    }
+}
+
+bool read_sensor_snapshot(SENSOR_MEMORY *sensor_memory, SENSOR_DATA *snapshot) {
+    // A view older than the state is drawn locally - no need to write the segment
+    if (sensor_memory->record.version != 0) {
+        uint32_t state = read_sensor_state(sensor_memory);
+        if (__atomic_load_n(&sensor_memory->view_state, __ATOMIC_ACQUIRE) != state) {
+            render_sensor_data(snapshot, state);
+            return true;
+        }
+    }
+    int attempt;
+    for (attempt = 0; attempt < SENSOR_READ_RETRIES; attempt++) {
+        uint32_t sequence = __atomic_load_n(&sensor_memory->sequence, __ATOMIC_ACQUIRE);
+        if (!(sequence & 1)) {
+            memcpy(snapshot, &sensor_memory->data, sizeof(SENSOR_DATA));
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (__atomic_load_n(&sensor_memory->sequence, __ATOMIC_RELAXED) == sequence) {
+                return true;
+            }
+        }
+        read_backoff(attempt);      // Update in progress, or one came in while copying
+    }
+    return false;
+}
+
+/**
+* Sensor record - v2
+*
+* Every reading fits in the 32 bit state word in sensor_memory->record,
+* so a handler setting a flag, the scan publishing a range and a client
+* resetting flags are each a single compare-and-swap on it and can never
+* undo one another. The count of changes shares the 64 bit atomic word,
+* so a reader gets both from one load.
+*
+* The ASCII data record is only a view of the state, drawn on demand by
+* refresh_sensor_view. sensord calls it shortly after its own changes for
+* file readers, and read_sensor_snapshot draws a stale view into its copy. Code that only needs
+* the readings should load the state instead - it is always consistent
+* and never retries.
+**/
+
+void setup_sensor_record(SENSOR_MEMORY *sensor_memory) {
+    // sensord, once at start - no readings yet, and a view to match
+    __atomic_store_n(&sensor_memory->record.state, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&sensor_memory->record.range_track, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&sensor_memory->sweep.sequence, 0, __ATOMIC_RELEASE);     // Nor any sweep left half done
+    sensor_memory->record.changed_ns = monotonic_ns();
+    begin_sensor_update(sensor_memory);
+    clear_sensor_values(&sensor_memory->data);
+    sensor_memory->view_state = 0;
+    end_sensor_update(sensor_memory);
+    __atomic_store_n(&sensor_memory->record.version, SENSOR_RECORD_VERSION, __ATOMIC_RELEASE);
+}
+
+uint32_t read_sensor_state(SENSOR_MEMORY *sensor_memory) {
+    return (uint32_t) __atomic_load_n(&sensor_memory->record.state, __ATOMIC_ACQUIRE);
+}
+
+uint32_t read_sensor_record(SENSOR_MEMORY *sensor_memory, uint32_t *changes) {
+    // STATE_* bits, and the number of changes so far in *changes
+    uint64_t record_state = __atomic_load_n(&sensor_memory->record.state, __ATOMIC_ACQUIRE);
+    *changes = (uint32_t) (record_state >> 32);
+    return (uint32_t) record_state;
+}
+
+uint32_t update_sensor_state(SENSOR_MEMORY *sensor_memory, uint32_t clear, uint32_t set) {
+    // Clears then sets STATE_* bits in one step - returns the state before
+    uint64_t record_state = __atomic_load_n(&sensor_memory->record.state, __ATOMIC_RELAXED);
+    uint64_t updated;
+    do {
+        uint32_t state = (uint32_t) record_state;
+        if (((state & ~clear) | set) == state) {
+            return state;       // No change - nothing to count
+        }
+        updated = (((record_state >> 32) + 1) << 32) | ((state & ~clear) | set);
+    } while (!__atomic_compare_exchange_n(&sensor_memory->record.state, &record_state, updated,
+                                            true, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+    __atomic_store_n(&sensor_memory->record.changed_ns, monotonic_ns(), __ATOMIC_RELAXED);
+    return (uint32_t) record_state;
+}
+
+void refresh_sensor_view(SENSOR_MEMORY *sensor_memory) {
+    // Redraw the ASCII view if the state has moved on since it was drawn
+    if (__atomic_load_n(&sensor_memory->view_state, __ATOMIC_ACQUIRE) == read_sensor_state(sensor_memory)) {
+        return;
+    }
+    // Draw whatever is latest once we hold the seqlock, so the last writer leaves it current
+    begin_sensor_update(sensor_memory);
+    uint32_t state = read_sensor_state(sensor_memory);
+    render_sensor_data(&sensor_memory->data, state);
+    __atomic_store_n(&sensor_memory->view_state, state, __ATOMIC_RELEASE);
+    end_sensor_update(sensor_memory);
+}
+
+uint32_t reset_sensor_state(SENSOR_MEMORY *sensor_memory, uint32_t clear) {
+    return update_sensor_state(sensor_memory, clear, 0);
+}
+
+uint32_t sensor_reset_bits(const char *which) {
+    // STATE_* bits for reset_sensors letters - any of r, o, s, i - 0 if any other
+    uint32_t bits = 0;
+    for (; *which != '\0'; which++) {
+        switch (*which) {
+            case 'r':
+            case 'R':
+                bits |= STATE_RANGE;
+                break;
+            case 'o':
+            case 'O':
+                bits |= STATE_OBSTACLE;
+                break;
+            case 's':
+            case 'S':
+                bits |= STATE_SOUND;
+                break;
+            case 'i':
+            case 'I':
+                bits |= STATE_IMPACT;
+                break;
+            default:
+                return 0;
+        }
+    }
+    return bits;
+}
+
+void render_sensor_data(SENSOR_DATA *sensor_values, uint32_t state) {
+    // ASCII record for a state word
+    clear_sensor_values(sensor_values);
+    if (state & STATE_RANGE_VALID) {
+        int range = STATE_RANGE_CM(state);
+        sensor_values->range_indic = RANGE_INDICATOR;
+        sensor_values->range_val[0] = '0' + (range / 100);          // Hundreds
+        sensor_values->range_val[1] = '0' + ((range / 10) % 10);    // Tens
+        sensor_values->range_val[2] = '0' + (range % 10);           // Ones
+    }
+    int i;
+    for (i = IDX_FWD; i <= IDX_RIGHT; i++) {
+        if (state & STATE_FLAG(SENSOR_ID_OBSTACLE_F + i)) {
+            sensor_values->obstacle_indic = OBSTACLE_INDICATOR;
+            sensor_values->obstacle_val[i] = POSITIVE_VAL;
+        }
+    }
+    for (i = IDX_FWD; i <= IDX_BACK; i++) {
+        if (state & STATE_FLAG(SENSOR_ID_IMPACT_F + i)) {
+            sensor_values->impact_indic = IMPACT_INDICATOR;
+            sensor_values->impact_val[i] = POSITIVE_VAL;
+        }
+    }
+    if (state & STATE_SOUND) {
+        sensor_values->sound_indic = SOUND_INDICATOR;
+        sensor_values->sound_val = POSITIVE_VAL;
+    }
+}
+
+/**
+* Range track
+*
+* sensord filters the raw ranges into a track - range, closing speed and
+* the time to collision at that speed - and stores each sample's as one
+* word in the record, next to the raw range in the state word. A reader
+* takes the time to collision from it with range_track_ttc_ms, which
+* counts down the time since the sample and gives none for an old one.
+**/
+
+int publish_range_track(SENSOR_MEMORY *sensor_memory, int range_mm, int closing_mm_s, uint64_t sample_ns) {
+    // range_mm -1 drops the track - returns the time to collision published
+    if (range_mm < 0) {
+        __atomic_store_n(&sensor_memory->record.range_track, 0, __ATOMIC_RELEASE);
+        return TTC_NONE;
+    }
+    range_mm = range_mm > RANGE_MAX_MM ? RANGE_MAX_MM : range_mm;
+    closing_mm_s = closing_mm_s > INT16_MAX ? INT16_MAX : (closing_mm_s < INT16_MIN ? INT16_MIN : closing_mm_s);
+    int ttc_ms = TTC_NONE;
+    if (closing_mm_s >= TRACK_MIN_CLOSING_MM_S) {
+        int ttc = range_mm * 1000 / closing_mm_s;
+        ttc_ms = ttc < TTC_NONE ? ttc : TTC_NONE - 1;
+    }
+    uint64_t track = (uint64_t) range_mm | TRACK_VALID
+                    | ((uint64_t) (uint16_t) closing_mm_s << 16)
+                    | ((uint64_t) ttc_ms << 32)
+                    | ((sample_ns / 1000000ULL) << 48);
+    __atomic_store_n(&sensor_memory->record.range_track, track, __ATOMIC_RELEASE);
+    return ttc_ms;
+}
+
+uint64_t read_range_track(SENSOR_MEMORY *sensor_memory) {
+    return __atomic_load_n(&sensor_memory->record.range_track, __ATOMIC_ACQUIRE);
+}
+
+int range_track_ttc_ms(uint64_t track, uint64_t now_ns) {
+    // Time to collision left at now_ns - TTC_NONE without a recent closing track
+    if (!(track & TRACK_VALID) || TRACK_TTC_MS(track) == TTC_NONE) {
+        return TTC_NONE;
+    }
+    int age_ms = (uint16_t) (now_ns / 1000000ULL - TRACK_TIME_MS(track));
+    if (age_ms > TRACK_STALE_MS) {
+        return TTC_NONE;
+    }
+    int ttc_ms = TRACK_TTC_MS(track) - age_ms;
+    return ttc_ms > 0 ? ttc_ms : 0;
+}
+
+/**
+* Range sweep
+*
+* Whoever turns the robot in place for a sweep starts the profile with
+* begin_sweep once its motors are on, and sets MOTION_SWEEP so sensord
+* pings flat out. sensord puts each range into the bin for the heading
+* the turn rate says the robot was at when the ping was in flight, keeping
+* the nearest. end_sweep closes it when the motors stop. The sequence is
+* odd meanwhile, so readers copy the profile between two even loads.
+**/
+
+void begin_sweep(SENSOR_MEMORY *sensor_memory, int direction, uint32_t us_per_deg, uint64_t start_ns) {
+    SWEEP_PROFILE *sweep = &sensor_memory->sweep;
+    // Before MOTION_SWEEP is set, so sensord isn't putting ranges in yet
+    __atomic_store_n(&sweep->sequence, sweep->sequence | 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memset(sweep->range_mm, 0, sizeof(sweep->range_mm));
+    sweep->direction = direction < 0 ? -1 : 1;
+    sweep->us_per_deg = us_per_deg;
+    sweep->samples = 0;
+    sweep->end_ns = 0;
+    sweep->start_ns = start_ns;
+}
+
+void record_sweep_range(SENSOR_MEMORY *sensor_memory, int range_mm, uint64_t sample_ns) {
+    // sensord, for each ping while MOTION_SWEEP is set - pings outside the turn are dropped
+    SWEEP_PROFILE *sweep = &sensor_memory->sweep;
+    if (!(__atomic_load_n(&sweep->sequence, __ATOMIC_ACQUIRE) & 1)) {
+        return;
+    }
+    uint64_t start_ns = sweep->start_ns;
+    if (sample_ns < start_ns || sweep->us_per_deg == 0) {
+        return;
+    }
+    uint64_t degrees = (sample_ns - start_ns) / 1000ULL / sweep->us_per_deg;
+    if (degrees >= SWEEP_BINS) {
+        return;
+    }
+    int bin = sweep->direction > 0 ? (int) degrees : (SWEEP_BINS - (int) degrees) % SWEEP_BINS;
+    range_mm = range_mm > RANGE_MAX_MM ? RANGE_MAX_MM : range_mm;
+    uint16_t held = __atomic_load_n(&sweep->range_mm[bin], __ATOMIC_RELAXED);
+    if (held == SWEEP_NO_SAMPLE || range_mm < held) {
+        __atomic_store_n(&sweep->range_mm[bin], range_mm > 0 ? range_mm : 1, __ATOMIC_RELAXED);
+    }
+    sweep->samples++;
+}
+
+void end_sweep(SENSOR_MEMORY *sensor_memory, uint64_t end_ns) {
+    SWEEP_PROFILE *sweep = &sensor_memory->sweep;
+    sweep->end_ns = end_ns;
+    __atomic_store_n(&sweep->sequence, sweep->sequence + 1, __ATOMIC_RELEASE);
+}
+
+bool read_sweep_profile(SENSOR_MEMORY *sensor_memory, SWEEP_PROFILE *profile) {
+    // Copy of the last finished sweep - false while one is running, or if there has been none
+    int attempt;
+    for (attempt = 0; attempt < SENSOR_READ_RETRIES; attempt++) {
+        uint32_t sequence = __atomic_load_n(&sensor_memory->sweep.sequence, __ATOMIC_ACQUIRE);
+        if (sequence == 0 || (sequence & 1)) {
+            return false;
+        }
+        memcpy(profile, &sensor_memory->sweep, sizeof(SWEEP_PROFILE));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&sensor_memory->sweep.sequence, __ATOMIC_RELAXED) == sequence) {
+            return true;
+        }
+        read_backoff(attempt);
     }
-    size_t result = fread(sensor_values, sizeof(SENSOR_DATA), 1, sensor_file);
-    fclose(sensor_file);
-    return result;
+    return false;
+}
+
+/**
+* Halt event notification
+*
+* halt_events is a shared futex word. Waiters read it with
+* sensor_event_count, check the sensor state, then sleep in
+* wait_sensor_event until it changes or the timeout passes - or in
+* wait_sensor_event_until, to an absolute deadline, so a wait that is cut
+* short and resumed doesn't drift. Writers call
+* signal_sensor_event after publishing a halt-relevant change. Those are
+* rare by construction (handlers return early once a flag is latched),
+* so the wake syscall is not on the per-edge path.
+**/
+
+static bool futex_wait(uint32_t *word, uint32_t observed, long timeout_ns) {
+    // Returns false on timeout - shared (not private) futex, waiters and wakers are in other processes
+    struct timespec timeout;
+    timeout.tv_sec = timeout_ns / 1000000000L;
+    timeout.tv_nsec = timeout_ns % 1000000000L;
+    
+    return !(syscall(SYS_futex, word, FUTEX_WAIT, observed, &timeout, NULL, 0) < 0 && errno == ETIMEDOUT);
 }
 
-size_t write_sensor_file(SENSOR_DATA *sensor_values) {
-    FILE *sensor_file = fopen(SENSOR_FILE, "w");
-    size_t result = fwrite(sensor_values, sizeof(SENSOR_DATA), 1, sensor_file);
-    fclose(sensor_file);
-    return result;    
+static bool futex_wait_until(uint32_t *word, uint32_t observed, uint64_t deadline_ns) {
+    // As futex_wait, to an absolute CLOCK_MONOTONIC time
+    struct timespec deadline;
+    deadline.tv_sec = deadline_ns / 1000000000ULL;
+    deadline.tv_nsec = deadline_ns % 1000000000ULL;
+    
+    return !(syscall(SYS_futex, word, FUTEX_WAIT_BITSET, observed, &deadline, NULL, FUTEX_BITSET_MATCH_ANY) < 0
+                && errno == ETIMEDOUT);
+}
+
+static void futex_wake(uint32_t *word) {
+    syscall(SYS_futex, word, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+uint32_t sensor_event_count(SENSOR_MEMORY *sensor_memory) {
+    return __atomic_load_n(&sensor_memory->halt_events, __ATOMIC_ACQUIRE);
+}
+
+void signal_sensor_event(SENSOR_MEMORY *sensor_memory) {
+    STATS_COUNT(sensor_memory, halt_signals);
+    STATS_MARK(sensor_memory, last_signal_ns);
+    __atomic_fetch_add(&sensor_memory->halt_events, 1, __ATOMIC_RELEASE);
+    futex_wake(&sensor_memory->halt_events);
+}
+
+bool wait_sensor_event(SENSOR_MEMORY *sensor_memory, uint32_t observed, long timeout_ns) {
+    // Returns true if halt_events moved on from observed, false on timeout
+    if (!futex_wait(&sensor_memory->halt_events, observed, timeout_ns)) {
+        return false;
+    }
+    return sensor_event_count(sensor_memory) != observed;
+}
+
+bool wait_sensor_event_until(SENSOR_MEMORY *sensor_memory, uint32_t observed, uint64_t deadline_ns) {
+    // As wait_sensor_event, until monotonic_ns() reaches deadline_ns
+    if (!futex_wait_until(&sensor_memory->halt_events, observed, deadline_ns)) {
+        return false;
+    }
+    return sensor_event_count(sensor_memory) != observed;
+}
+
+/**
+* Ping scheduling hints for sensord
+*
+* Whoever runs the motors publishes the motion state, and clients that
+* want fresh readings note their demand. sensord pings fastest while
+* driving forward and backs off when stationary and nobody is asking.
+**/
+
+void set_motion_state(SENSOR_MEMORY *sensor_memory, uint32_t motion_state) {
+    note_sensor_demand(sensor_memory);
+    if (__atomic_exchange_n(&sensor_memory->motion_state, motion_state, __ATOMIC_RELEASE) != motion_state) {
+        futex_wake(&sensor_memory->motion_state);   // sensord may be sleeping between pings
+    }
+}
+
+bool wait_motion_state(SENSOR_MEMORY *sensor_memory, uint32_t observed, long timeout_ns) {
+    // Returns true if the motion state moved on from observed, false on timeout
+    if (!futex_wait(&sensor_memory->motion_state, observed, timeout_ns)) {
+        return false;
+    }
+    return __atomic_load_n(&sensor_memory->motion_state, __ATOMIC_ACQUIRE) != observed;
+}
+
+void note_sensor_demand(SENSOR_MEMORY *sensor_memory) {
+    __atomic_store_n(&sensor_memory->demand_ns, monotonic_ns(), __ATOMIC_RELAXED);
+}
+
+uint64_t monotonic_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+/**
+* Sensor event history
+*
+* Every sensor event is also logged to a ring of fixed size records in
+* sensor memory, so consumers can see when and how often events fired,
+* not just the latest latched state. Writers claim an event number with
+* one atomic add and mark the record complete by storing number + 1, so
+* handlers on any thread can log without locks or syscalls. Each reader
+* keeps its own cursor; a reader that falls more than a ring behind
+* skips ahead and counts the lost events as overruns.
+**/
+
+void log_sensor_event(SENSOR_MEMORY *sensor_memory, int sensor_id, int value, uint64_t timestamp_ns) {
+    // timestamp_ns is when the sensor saw it - CLOCK_MONOTONIC
+    uint64_t number = __atomic_fetch_add(&sensor_memory->event_head, 1, __ATOMIC_RELAXED);
+    SENSOR_EVENT *event = &sensor_memory->events[number & (SENSOR_EVENT_RING_SIZE - 1)];
+
+    __atomic_store_n(&event->number, 0, __ATOMIC_RELAXED);     // Incomplete
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    event->timestamp_ns = timestamp_ns;
+    event->sensor_id = sensor_id;
+    event->value = value;
+    __atomic_store_n(&event->number, number + 1, __ATOMIC_RELEASE);
+}
+
+char *sensor_name(int sensor_id) {
+    // Short name of a SENSOR_ID_*, NULL if out of range
+    static char *names[SENSOR_ID_COUNT] = {
+        "range", "obstacle_f", "obstacle_b", "obstacle_l", "obstacle_r", "impact_f", "impact_b", "sound"
+    };
+    return (sensor_id >= 0 && sensor_id < SENSOR_ID_COUNT) ? names[sensor_id] : NULL;
+}
+
+void open_sensor_event_cursor(SENSOR_MEMORY *sensor_memory, SENSOR_EVENT_CURSOR *cursor) {
+    // Start with the next event logged
+    cursor->next = __atomic_load_n(&sensor_memory->event_head, __ATOMIC_ACQUIRE);
+    cursor->overruns = 0;
+}
+
+bool next_sensor_event(SENSOR_MEMORY *sensor_memory, SENSOR_EVENT_CURSOR *cursor, SENSOR_EVENT *event) {
+    // Returns false when no further complete event is available yet
+    for (;;) {
+        uint64_t head = __atomic_load_n(&sensor_memory->event_head, __ATOMIC_ACQUIRE);
+        if (cursor->next >= head) {
+            return false;
+        }
+        if (head - cursor->next > SENSOR_EVENT_RING_SIZE) {
+            cursor->overruns += head - SENSOR_EVENT_RING_SIZE - cursor->next;
+            cursor->next = head - SENSOR_EVENT_RING_SIZE;
+        }
+
+        SENSOR_EVENT *slot = &sensor_memory->events[cursor->next & (SENSOR_EVENT_RING_SIZE - 1)];
+        uint64_t number = __atomic_load_n(&slot->number, __ATOMIC_ACQUIRE);
+        if (number == cursor->next + 1) {
+            memcpy(event, slot, sizeof(SENSOR_EVENT));
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (__atomic_load_n(&slot->number, __ATOMIC_RELAXED) == number) {
+                cursor->next++;
+                return true;
+            }
+        } else if (number > cursor->next + 1) {
+            cursor->overruns++;     // Overwritten by a later event
+            cursor->next++;
+            continue;
+        }
+        return false;               // Still being written
+    }
 }
 
 void clear_sensor_values(SENSOR_DATA *sensor_values) {
@@ -5,10 +5,15 @@
 *
 */
 
+#ifndef SENSORS_H
+#define SENSORS_H
+
 #include <stdbool.h>
+#include <stdint.h>
 
-#define SENSOR_FILE         "/dev/shm/sensor_data"
-#define SHARED_MEMORY_KEY   14721
+#define SENSOR_FILE         "/dev/shm/sensor_data"   // Mapped by all processes as SENSOR_MEMORY
+#define SENSOR_MEMORY_CREATE    001000  // access_sensor_memory mode flags, OR'd with permissions
+#define SENSOR_MEMORY_RDONLY    010000
 #define RANGE_INDICATOR         'R'
 #define OBSTACLE_INDICATOR      'O'
 #define SOUND_INDICATOR         'S'
@@ -24,6 +29,62 @@
 #define IDX_LEFT                2
 #define IDX_RIGHT               3
 #define SENSOR_DATA_END_MARK    '\n'
+#define SENSOR_READ_RETRIES     100     // Attempts at a consistent snapshot before giving up
+#define SENSOR_READ_SPINS       10      // Of those, spun on before yielding to a preempted writer
+#define SENSOR_EVENT_RING_SIZE  1024    // Events kept in sensor memory - power of 2
+#define SENSOR_RECORD_VERSION   2       // SENSOR_RECORD layout - v1 was the ASCII SENSOR_DATA alone
+
+// SENSOR_MEMORY motion_state flags
+#define MOTION_MOVING           1
+#define MOTION_FORWARD          2       // At least one motor forward
+#define MOTION_REVERSE          4       // At least one motor in reverse
+#define MOTION_SWEEP            8       // Turning in place for a range sweep - ping flat out
+
+// PING_STATS modes
+#define PING_MODE_ACTIVE        0       // Driving forward - ping as fast as the sensor allows
+#define PING_MODE_NORMAL        1
+#define PING_MODE_IDLE          2       // Stationary and nobody asking for readings
+
+// SENSOR_EVENT sensor ids
+#define SENSOR_ID_RANGE         0       // value is range in mm, 9990 if no echo
+#define SENSOR_ID_OBSTACLE_F    1       // Flag events - value is 1 when set, 0 when level tracking clears it
+#define SENSOR_ID_OBSTACLE_B    2
+#define SENSOR_ID_OBSTACLE_L    3
+#define SENSOR_ID_OBSTACLE_R    4
+#define SENSOR_ID_IMPACT_F      5
+#define SENSOR_ID_IMPACT_B      6
+#define SENSOR_ID_SOUND         7
+#define SENSOR_ID_COUNT         8
+
+// SENSOR_RECORD state word - every reading packed so each change is one atomic update
+#define STATE_RANGE_MASK        0x3fff          // Range in mm, 0-9990
+#define STATE_RANGE_VALID       0x4000
+#define STATE_FLAG(sensor_id)   (0x4000 << (sensor_id))     // Flag sensors, SENSOR_ID_OBSTACLE_F-SOUND
+#define STATE_RANGE_CM(state)   ((((state) & STATE_RANGE_MASK) + 5) / 10)
+#define RANGE_MAX_MM            9990            // No echo
+#define STATE_RANGE             (STATE_RANGE_MASK | STATE_RANGE_VALID)
+#define STATE_OBSTACLE          (STATE_FLAG(SENSOR_ID_OBSTACLE_F) | STATE_FLAG(SENSOR_ID_OBSTACLE_B) \
+                                    | STATE_FLAG(SENSOR_ID_OBSTACLE_L) | STATE_FLAG(SENSOR_ID_OBSTACLE_R))
+#define STATE_IMPACT            (STATE_FLAG(SENSOR_ID_IMPACT_F) | STATE_FLAG(SENSOR_ID_IMPACT_B))
+#define STATE_SOUND             STATE_FLAG(SENSOR_ID_SOUND)
+#define STATE_ALL               (STATE_RANGE | STATE_OBSTACLE | STATE_IMPACT | STATE_SOUND)
+
+// SENSOR_RECORD range track word - sensord's filtered range, closing speed and time to
+// collision, all from one sample
+#define TRACK_VALID             0x8000ULL
+#define TRACK_RANGE_MM(track)   ((int) ((track) & STATE_RANGE_MASK))
+#define TRACK_CLOSING_MM_S(track)   ((int) (int16_t) ((track) >> 16))   // Negative while opening
+#define TRACK_TTC_MS(track)     ((int) (((track) >> 32) & 0xffff))      // TTC_NONE if not closing
+#define TRACK_TIME_MS(track)    ((uint16_t) ((track) >> 48))            // Low 16 bits of the sample's ms
+#define TTC_NONE                0xffff
+#define TRACK_MIN_CLOSING_MM_S  20      // Slower than this is not closing
+#define TRACK_STALE_MS          250     // An older track gives no time to collision
+
+// SWEEP_PROFILE - ranges by heading from one turn in place
+#define SWEEP_BINS              360     // One per degree, clockwise from the heading the turn started at
+#define SWEEP_NO_SAMPLE         0       // Bin no ping landed in
+
+#define STATS_BUCKETS           32      // Latency histogram bucket b counts times in [2^(b-1), 2^b) ns
 
 typedef struct {
     char range_indic;       // 'R'/'r'
@@ -37,12 +98,142 @@ typedef struct {
     char end_mark;          
 } SENSOR_DATA;
 
-int access_sensor_memory(SENSOR_DATA**, int);
-void release_sensor_memory(int, SENSOR_DATA*);
-size_t read_sensor_file(SENSOR_DATA *);
-size_t write_sensor_file(SENSOR_DATA *);
+typedef struct {
+    uint32_t version;       // SENSOR_RECORD_VERSION once sensord has set it up
+    uint32_t reserved;
+    uint64_t state;         // STATE_* in the low 32 bits, changes so far in the high 32 - one atomic word
+    uint64_t changed_ns;    // Time of the last change (CLOCK_MONOTONIC)
+    uint64_t range_track;   // TRACK_*, 0 if there is no track - one atomic word
+} __attribute__((aligned(64))) SENSOR_RECORD;
+
+typedef struct {
+    uint64_t number;        // Event number + 1 once the record is complete, 0 while it is written
+    uint64_t timestamp_ns;  // CLOCK_MONOTONIC
+    uint16_t sensor_id;     // SENSOR_ID_*
+    uint16_t reserved;
+    int32_t value;
+} SENSOR_EVENT;
+
+typedef struct {
+    uint64_t next;          // Number of the next event to read
+    uint64_t overruns;      // Events lost because writers lapped this reader
+} SENSOR_EVENT_CURSOR;
+
+typedef struct {
+    uint32_t mode;          // PING_MODE_*
+    uint32_t interval_ms;   // Current time between pings
+    uint64_t pings;
+    uint64_t echoes;
+    uint64_t timeouts;
+    uint32_t rate_x10;      // Pings per sec * 10 over the last second
+    uint32_t cpu_permille;  // sensord CPU use over the last second
+} PING_STATS;
+
+typedef struct {
+    uint64_t edges;         // Input edges handled
+    uint64_t updates;       // Edges that changed a value
+    uint64_t publishes;     // Seqlock updates that made them visible
+    uint64_t merged;        // Updates that shared a publish with an earlier one
+    uint64_t immediate;     // Publishes that skipped the window - impact or sound
+    uint32_t window_us;     // Coalescing window, 0 publishes every update
+    uint32_t reserved;
+} PUBLISH_STATS;
+
+typedef struct {
+    uint64_t glitches[SENSOR_ID_COUNT];     // Pulses the input filter rejected per SENSOR_ID_*
+    uint32_t min_pulse_us[SENSOR_ID_COUNT]; // Filter settings in use
+    uint32_t debounce_us[SENSOR_ID_COUNT];
+    uint64_t releases[SENSOR_ID_COUNT];     // Flags cleared by level tracking
+    int32_t hold_us[SENSOR_ID_COUNT];       // Level tracking settings, -1 if the flag latches
+    int32_t release_us[SENSOR_ID_COUNT];
+} FILTER_STATS;
+
+typedef struct {
+    uint32_t sequence;      // Odd while a sweep is being taken - read with read_sweep_profile
+    int32_t direction;      // 1 turning clockwise, -1 anticlockwise
+    uint32_t us_per_deg;    // Turn rate headings are estimated from
+    uint32_t samples;       // Ranges that went into the bins
+    uint64_t start_ns;      // Motors switched on, heading 0 (CLOCK_MONOTONIC)
+    uint64_t end_ns;        // Motors stopped, 0 while sweeping
+    uint16_t range_mm[SWEEP_BINS];  // Nearest range at each heading, RANGE_MAX_MM if no echo
+} SWEEP_PROFILE;
+
+typedef struct {
+    uint64_t periods;
+    uint64_t edges;
+    uint32_t max_jitter_ns;     // Worst lateness of a pin edge since start
+    uint32_t mean_jitter_ns;    // Running mean lateness
+    uint32_t realtime;          // 1 if the timing thread got SCHED_FIFO and locked memory
+    uint32_t reserved;
+} PWM_STATS;
+
+typedef struct {
+    uint32_t enabled;       // 1 if sensord was built with STATS=1 - see stats.h
+    uint32_t reserved;
+    uint64_t handler_calls[SENSOR_ID_COUNT];    // GPIO handler invocations per SENSOR_ID_*
+    uint64_t publishes;     // Completed sensor data updates
+    uint64_t halt_signals;  // signal_sensor_event calls
+    uint64_t halts;         // Motions stopped early by a sensor
+    uint64_t last_signal_ns;            // Time of the last halt signal
+    uint64_t publish_ns[STATS_BUCKETS]; // Handler entry to data published
+    uint64_t echo_ns[STATS_BUCKETS];    // Ping trigger to echo complete
+    uint64_t halt_ns[STATS_BUCKETS];    // Halt signal to motion loop stopping
+} SENSOR_STATS;
+
+typedef struct {
+    SENSOR_DATA data;       // ASCII view of record - first so file readers see it at offset 0
+    uint32_t sequence;      // Seqlock counter - odd while a writer is updating data
+    uint32_t view_state;    // STATE_* data was last drawn from
+    uint32_t halt_events;   // Bumped on every obstacle/impact/sound change - futex word for waiters
+    uint32_t motion_state;  // MOTION_* flags from whoever runs the motors - futex word for sensord
+    uint64_t demand_ns;     // Last time a client asked for fresh readings (CLOCK_MONOTONIC)
+    SENSOR_RECORD record;   // The readings themselves, on a cache line of their own
+    PING_STATS ping_stats;  // Written by sensord
+    PUBLISH_STATS publish_stats;    // Written by sensord
+    FILTER_STATS filter_stats;      // Written by sensord
+    PWM_STATS pwm_stats;    // Written by the motor PWM timing thread
+    SENSOR_STATS stats;     // Hot path instrumentation, all zero unless built with STATS=1
+    SWEEP_PROFILE sweep;    // Bins written by sensord, the rest by whoever runs the sweep
+    uint64_t event_head;    // Number of events ever logged
+    SENSOR_EVENT events[SENSOR_EVENT_RING_SIZE];    // Event history, indexed by number % size
+} SENSOR_MEMORY;
+
+int access_sensor_memory(SENSOR_MEMORY**, int);
+void release_sensor_memory(SENSOR_MEMORY*);
+void begin_sensor_update(SENSOR_MEMORY *);
+void end_sensor_update(SENSOR_MEMORY *);
+bool read_sensor_snapshot(SENSOR_MEMORY *, SENSOR_DATA *);
+void setup_sensor_record(SENSOR_MEMORY *);
+uint32_t read_sensor_state(SENSOR_MEMORY *);
+uint32_t read_sensor_record(SENSOR_MEMORY *, uint32_t *);
+void refresh_sensor_view(SENSOR_MEMORY *);
+uint32_t update_sensor_state(SENSOR_MEMORY *, uint32_t, uint32_t);
+uint32_t reset_sensor_state(SENSOR_MEMORY *, uint32_t);
+uint32_t sensor_reset_bits(const char *);
+void render_sensor_data(SENSOR_DATA *, uint32_t);
+int publish_range_track(SENSOR_MEMORY *, int, int, uint64_t);
+uint64_t read_range_track(SENSOR_MEMORY *);
+int range_track_ttc_ms(uint64_t, uint64_t);
+void begin_sweep(SENSOR_MEMORY *, int, uint32_t, uint64_t);
+void record_sweep_range(SENSOR_MEMORY *, int, uint64_t);
+void end_sweep(SENSOR_MEMORY *, uint64_t);
+bool read_sweep_profile(SENSOR_MEMORY *, SWEEP_PROFILE *);
+uint32_t sensor_event_count(SENSOR_MEMORY *);
+void signal_sensor_event(SENSOR_MEMORY *);
+bool wait_sensor_event(SENSOR_MEMORY *, uint32_t, long);
+bool wait_sensor_event_until(SENSOR_MEMORY *, uint32_t, uint64_t);
+void set_motion_state(SENSOR_MEMORY *, uint32_t);
+bool wait_motion_state(SENSOR_MEMORY *, uint32_t, long);
+void note_sensor_demand(SENSOR_MEMORY *);
+uint64_t monotonic_ns(void);
+void log_sensor_event(SENSOR_MEMORY *, int, int, uint64_t);
+char *sensor_name(int);
+void open_sensor_event_cursor(SENSOR_MEMORY *, SENSOR_EVENT_CURSOR *);
+bool next_sensor_event(SENSOR_MEMORY *, SENSOR_EVENT_CURSOR *, SENSOR_EVENT *);
 void clear_sensor_values(SENSOR_DATA *);
 void reset_range(SENSOR_DATA *);
 void reset_obstacle(SENSOR_DATA *);
 void reset_sound(SENSOR_DATA *);
 void reset_impact(SENSOR_DATA *);
+
+#endif
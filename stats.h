@@ -0,0 +1,66 @@
+/**
+* stats.h - Hot path instrumentation
+*
+* Counters and log2 latency histograms in sensor_memory->stats, read by
+* uv1stat. Build with "make clean; make STATS=1" to compile them in.
+* Without UV1_STATS every macro expands to nothing, so the hot paths
+* are exactly as they were.
+*/
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+#include "sensors.h"
+
+#ifdef UV1_STATS
+
+// Mark the stats block as live - sensord only
+#define STATS_ENABLE(memory)    ((memory)->stats.enabled = 1)
+
+// Count an event
+#define STATS_COUNT(memory, counter) \
+    __atomic_fetch_add(&(memory)->stats.counter, 1, __ATOMIC_RELAXED)
+
+// Record the current time in a stats field
+#define STATS_MARK(memory, field) \
+    __atomic_store_n(&(memory)->stats.field, monotonic_ns(), __ATOMIC_RELAXED)
+
+// Start a latency measurement in a local
+#define STATS_START(name)       uint64_t name = monotonic_ns()
+
+// Add the time since start to a histogram
+#define STATS_LATENCY(memory, histogram, start) \
+    stats_record((memory)->stats.histogram, monotonic_ns() - (start))
+
+// A motion that started at start_ns was halted - count it, and its reaction
+// time if the halt signal came during the motion
+#define STATS_HALT(memory, start_ns) \
+    do { \
+        uint64_t signal_ns = __atomic_load_n(&(memory)->stats.last_signal_ns, __ATOMIC_RELAXED); \
+        STATS_COUNT(memory, halts); \
+        if (signal_ns >= (start_ns)) { \
+            STATS_LATENCY(memory, halt_ns, signal_ns); \
+        } \
+    } while (0)
+
+static inline void stats_record(uint64_t *histogram, uint64_t ns) {
+    int bucket = (ns == 0) ? 0 : 64 - __builtin_clzll(ns);
+    if (bucket >= STATS_BUCKETS) {
+        bucket = STATS_BUCKETS - 1;
+    }
+    __atomic_fetch_add(&histogram[bucket], 1, __ATOMIC_RELAXED);
+}
+
+#else
+
+#define STATS_ENABLE(memory)                    do { } while (0)
+#define STATS_COUNT(memory, counter)            do { } while (0)
+#define STATS_MARK(memory, field)               do { } while (0)
+#define STATS_START(name)                       do { } while (0)
+#define STATS_LATENCY(memory, histogram, start) do { } while (0)
+#define STATS_HALT(memory, start_ns)            do { } while (0)
+
+#endif
+
+#endif
@@ -0,0 +1,547 @@
+/**
+* telemetry.c - Mission log writer, segment compression and segment reader
+*
+* Writers only copy into the mapped segment under log_mutex. Everything
+* that can block - msync, creating and preallocating the next segment,
+* trimming and compressing a full one - happens on the log thread.
+*
+* compile with -pthread
+*/
+
+#define _GNU_SOURCE     // pthread_cond_timedwait on CLOCK_MONOTONIC
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "sensors.h"
+#include "motion.h"
+#include "telemetry.h"
+
+typedef struct {
+    int fd;
+    uint32_t number;
+    uint8_t *base;          // Mapped segment, NULL if none
+} SEGMENT;
+
+static void *log_thread(void *);
+static int create_segment(uint32_t, SEGMENT *);
+static void start_segment(SEGMENT *);
+static void finish_segment(SEGMENT *);
+static void append_record(TLM_RECORD *, int, uint16_t, uint64_t);
+
+static pthread_mutex_t log_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t log_wake;         // Log thread has work - a segment to finish, or stopping
+static pthread_cond_t log_done = PTHREAD_COND_INITIALIZER;     // Log thread finished a segment
+static pthread_t log_thread_id;
+static char log_dir[TELEMETRY_PATH_MAX];
+static bool running = false;            // Log thread started and not yet stopped
+static bool logging = false;            // Records are being taken
+static bool stopping = false;
+static uint32_t next_number;            // Next segment file to create
+static SEGMENT current = { -1, 0, NULL };
+static SEGMENT ready = { -1, 0, NULL }; // Created ahead, for when current fills
+static SEGMENT closing = { -1, 0, NULL };   // Full or closed, for the log thread to finish
+
+int segment_path(char *path, const char *dir, uint32_t number, bool compressed) {
+    // Length of the path, -1 if it doesn't fit in TELEMETRY_PATH_MAX - never use a truncated one
+    int length = snprintf(path, TELEMETRY_PATH_MAX, "%s/uv1-%06u.%s", dir, number, compressed ? "tlz" : "tlm");
+    return length < 0 || length >= TELEMETRY_PATH_MAX ? -1 : length;
+}
+
+int open_telemetry(const char *dir) {
+    // Starts a new segment after any already in dir - -1 if it can't
+    if (running || strlen(dir) >= TELEMETRY_PATH_MAX - 16) {
+        return -1;
+    }
+    mkdir(dir, 0755);
+    DIR *listing = opendir(dir);
+    if (listing == NULL) {
+        return -1;
+    }
+    strcpy(log_dir, dir);
+    next_number = 1;
+    struct dirent *entry;
+    while ((entry = readdir(listing)) != NULL) {
+        uint32_t number;
+        if (sscanf(entry->d_name, "uv1-%6u.tl", &number) == 1 && number >= next_number) {
+            next_number = number + 1;
+        }
+    }
+    closedir(listing);
+
+    if (create_segment(next_number++, &current) < 0) {
+        return -1;
+    }
+    start_segment(&current);
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&log_wake, &attr);
+    stopping = false;
+    if (pthread_create(&log_thread_id, NULL, log_thread, NULL) != 0) {
+        finish_segment(&current);
+        return -1;
+    }
+    running = true;
+    logging = true;
+    return 0;
+}
+
+void close_telemetry() {
+    // Finishes the open segment - compressed like any other
+    pthread_mutex_lock(&log_mutex);
+    if (!running) {
+        pthread_mutex_unlock(&log_mutex);
+        return;
+    }
+    running = false;
+    logging = false;
+    while (closing.base != NULL) {
+        pthread_cond_wait(&log_done, &log_mutex);
+    }
+    closing = current;
+    current.base = NULL;
+    stopping = true;
+    pthread_cond_signal(&log_wake);
+    pthread_mutex_unlock(&log_mutex);
+    pthread_join(log_thread_id, NULL);
+
+    // The one made ahead was never written to
+    if (ready.base != NULL) {
+        char path[TELEMETRY_PATH_MAX];
+        munmap(ready.base, TELEMETRY_SEGMENT_SIZE);
+        close(ready.fd);
+        if (segment_path(path, log_dir, ready.number, false) >= 0) {
+            unlink(path);
+        }
+        ready.base = NULL;
+    }
+}
+
+void log_sensor_record(uint64_t time_ns, int sensor_id, int value) {
+    TLM_SENSOR_RECORD record;
+    record.sensor_id = sensor_id;
+    record.value = value;
+    append_record(&record.record, sizeof(record), TLM_SENSOR, time_ns);
+}
+
+void log_motion_record(uint64_t time_ns, const char *motion, int halts, const MOTION_RESULT *result) {
+    TLM_MOTION_RECORD record;
+    memset(record.motion, 0, sizeof(record.motion));
+    strncpy(record.motion, motion, sizeof(record.motion) - 1);
+    record.halts = halts;
+    record.halt_cause = result->halt_cause;
+    record.executed_us = result->executed_us;
+    record.paused_us = result->paused_us;
+    record.interrupted_us = result->interrupted_us;
+    record.late_us = result->late_us;
+    append_record(&record.record, sizeof(record), TLM_MOTION, time_ns);
+}
+
+void log_sweep_record(uint64_t time_ns, const SWEEP_PROFILE *profile) {
+    TLM_SWEEP_RECORD record;
+    record.direction = profile->direction;
+    record.duration_us = (profile->end_ns - profile->start_ns) / 1000;
+    memcpy(record.range_mm, profile->range_mm, sizeof(record.range_mm));
+    append_record(&record.record, sizeof(record), TLM_SWEEP, time_ns);
+}
+
+void log_image_record(uint64_t time_ns, const char *path) {
+    TLM_IMAGE_RECORD record;
+    int length = strlen(path);
+    if (length >= (int) sizeof(record.path)) {
+        length = sizeof(record.path) - 1;
+    }
+    memset(record.path, 0, sizeof(record.path));
+    memcpy(record.path, path, length);
+    int size = (sizeof(TLM_RECORD) + length + 1 + 7) & ~7;
+    append_record(&record.record, size, TLM_IMAGE, time_ns);
+}
+
+static void append_record(TLM_RECORD *record, int size, uint16_t type, uint64_t time_ns) {
+    record->time_ns = time_ns;
+    record->type = type;
+    record->size = size;
+    record->reserved = 0;
+
+    pthread_mutex_lock(&log_mutex);
+    if (!logging) {
+        pthread_mutex_unlock(&log_mutex);
+        return;
+    }
+    TLM_SEGMENT_HEADER *header = (TLM_SEGMENT_HEADER *) current.base;
+    if (TELEMETRY_DATA_OFFSET + header->used + size > TELEMETRY_SEGMENT_SIZE) {
+        // Full - hand it to the log thread and carry on in the one made ahead
+        while (closing.base != NULL) {
+            pthread_cond_wait(&log_done, &log_mutex);
+        }
+        closing = current;
+        if (ready.base != NULL) {
+            current = ready;
+            ready.base = NULL;
+        } else if (create_segment(next_number++, &current) < 0) {
+            fprintf(stderr, "Cannot create telemetry segment - logging stopped!\n");
+            current.base = NULL;
+            logging = false;
+            pthread_cond_signal(&log_wake);
+            pthread_mutex_unlock(&log_mutex);
+            return;
+        }
+        start_segment(&current);
+        pthread_cond_signal(&log_wake);
+        header = (TLM_SEGMENT_HEADER *) current.base;
+    }
+
+    uint64_t offset = TELEMETRY_DATA_OFFSET + header->used;
+    if (header->records % TELEMETRY_INDEX_EVERY == 0 && header->index_count < TELEMETRY_INDEX_SIZE) {
+        header->index[header->index_count].time_ns = time_ns;
+        header->index[header->index_count].offset = offset;
+        header->index_count++;
+    }
+    memcpy(current.base + offset, record, size);
+    header->records++;
+    __atomic_store_n(&header->used, header->used + size, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&log_mutex);
+}
+
+static void *log_thread(void *arg) {
+    (void) arg;
+    pthread_mutex_lock(&log_mutex);
+    for (;;) {
+        if (closing.base != NULL) {
+            SEGMENT full = closing;
+            pthread_mutex_unlock(&log_mutex);
+            finish_segment(&full);
+            pthread_mutex_lock(&log_mutex);
+            closing.base = NULL;
+            pthread_cond_broadcast(&log_done);
+            continue;
+        }
+        if (stopping) {
+            break;
+        }
+        if (ready.base == NULL && logging) {
+            SEGMENT made;
+            uint32_t number = next_number++;
+            pthread_mutex_unlock(&log_mutex);
+            int created = create_segment(number, &made);
+            pthread_mutex_lock(&log_mutex);
+            if (created == 0) {
+                ready = made;
+                continue;
+            }
+        }
+
+        struct timespec due;
+        clock_gettime(CLOCK_MONOTONIC, &due);
+        due.tv_sec += TELEMETRY_SYNC_MS / 1000;
+        due.tv_nsec += (TELEMETRY_SYNC_MS % 1000) * 1000000L;
+        due.tv_sec += due.tv_nsec / 1000000000L;
+        due.tv_nsec %= 1000000000L;
+        if (pthread_cond_timedwait(&log_wake, &log_mutex, &due) == ETIMEDOUT && current.base != NULL) {
+            // Only this thread unmaps, so current stays mapped through the sync
+            uint8_t *base = current.base;
+            size_t length = TELEMETRY_DATA_OFFSET + ((TLM_SEGMENT_HEADER *) base)->used;
+            pthread_mutex_unlock(&log_mutex);
+            msync(base, length, MS_SYNC);
+            pthread_mutex_lock(&log_mutex);
+        }
+    }
+    pthread_mutex_unlock(&log_mutex);
+    return NULL;
+}
+
+static int create_segment(uint32_t number, SEGMENT *segment) {
+    // Preallocated and mapped, header filled in but for the start time
+    char path[TELEMETRY_PATH_MAX];
+    if (segment_path(path, log_dir, number, false) < 0) {
+        return -1;
+    }
+    int fd = open(path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return -1;
+    }
+    void *base = MAP_FAILED;
+    if (posix_fallocate(fd, 0, TELEMETRY_SEGMENT_SIZE) == 0) {
+        base = mmap(NULL, TELEMETRY_SEGMENT_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);
+    }
+    if (base == MAP_FAILED) {
+        close(fd);
+        unlink(path);
+        return -1;
+    }
+    TLM_SEGMENT_HEADER *header = (TLM_SEGMENT_HEADER *) base;
+    memset(header, 0, sizeof(TLM_SEGMENT_HEADER));
+    memcpy(header->magic, TELEMETRY_MAGIC, sizeof(header->magic));
+    header->version = TELEMETRY_VERSION;
+    header->segment = number;
+    segment->fd = fd;
+    segment->number = number;
+    segment->base = base;
+    return 0;
+}
+
+static void start_segment(SEGMENT *segment) {
+    TLM_SEGMENT_HEADER *header = (TLM_SEGMENT_HEADER *) segment->base;
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    header->start_ns = monotonic_ns();
+    header->start_realtime_ns = now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+static void finish_segment(SEGMENT *segment) {
+    // Trim to what was written and compress - an empty one is just removed
+    char path[TELEMETRY_PATH_MAX];
+    char compressed_path[TELEMETRY_PATH_MAX];
+    bool paths_ok = segment_path(path, log_dir, segment->number, false) >= 0
+                        && segment_path(compressed_path, log_dir, segment->number, true) >= 0;
+    TLM_SEGMENT_HEADER *header = (TLM_SEGMENT_HEADER *) segment->base;
+    uint64_t used = header->used;
+    uint32_t records = header->records;
+    msync(segment->base, TELEMETRY_DATA_OFFSET + used, MS_SYNC);
+    munmap(segment->base, TELEMETRY_SEGMENT_SIZE);
+    ftruncate(segment->fd, TELEMETRY_DATA_OFFSET + used);
+    close(segment->fd);
+    segment->base = NULL;
+    if (paths_ok && (records == 0 || compress_segment(path, compressed_path) == 0)) {
+        unlink(path);
+    }
+}
+
+
+/**
+* Delta compression
+**/
+
+static uint8_t *put_varint(uint8_t *out, uint64_t value) {
+    while (value >= 0x80) {
+        *out++ = (value & 0x7f) | 0x80;
+        value >>= 7;
+    }
+    *out++ = value;
+    return out;
+}
+
+static bool get_varint(const uint8_t *data, uint64_t end, uint64_t *offset, uint64_t *value) {
+    // False if it runs off the end
+    int shift;
+    *value = 0;
+    for (shift = 0; shift < 64 && *offset < end; shift += 7) {
+        uint8_t byte = data[(*offset)++];
+        *value |= (uint64_t) (byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static uint64_t zigzag(int64_t value) {
+    return ((uint64_t) value << 1) ^ (uint64_t) (value >> 63);
+}
+
+static int64_t unzigzag(uint64_t value) {
+    return (int64_t) (value >> 1) ^ -(int64_t) (value & 1);
+}
+
+static bool index_point(const TLM_SEGMENT_HEADER *header, uint32_t number) {
+    // Where the differences restart
+    return number % TELEMETRY_INDEX_EVERY == 0 && number / TELEMETRY_INDEX_EVERY < header->index_count;
+}
+
+int compress_segment(const char *path, const char *compressed_path) {
+    // A finished .tlm rewritten as a .tlz - 0 if it was
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    struct stat status;
+    fstat(fd, &status);
+    if (status.st_size < TELEMETRY_DATA_OFFSET) {
+        close(fd);
+        return -1;
+    }
+    uint8_t *data = mmap(NULL, status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return -1;
+    }
+    TLM_SEGMENT_HEADER header;
+    memcpy(&header, data, sizeof(header));
+    uint64_t end = TELEMETRY_DATA_OFFSET + header.used;
+    end = end < (uint64_t) status.st_size ? end : (uint64_t) status.st_size;
+
+    // Worst case a word takes 5 bytes and a record header 14
+    uint8_t *stream = malloc(sizeof(header) + (end - TELEMETRY_DATA_OFFSET) * 5 / 4 + 16 * (header.records + 1));
+    if (stream == NULL) {
+        munmap(data, status.st_size);
+        return -1;
+    }
+    static uint32_t last_words[TLM_TYPES][TLM_RECORD_WORDS];
+    uint64_t last_time_ns = 0;
+    uint8_t *out = stream + sizeof(header);
+    uint64_t offset = TELEMETRY_DATA_OFFSET;
+    uint32_t number;
+    for (number = 0; number < header.records && offset + sizeof(TLM_RECORD) <= end; number++) {
+        TLM_RECORD record;
+        memcpy(&record, data + offset, sizeof(record));
+        if (record.size < sizeof(TLM_RECORD) || record.size > TELEMETRY_MAX_RECORD
+                || offset + record.size > end || record.type >= TLM_TYPES) {
+            break;
+        }
+        if (index_point(&header, number)) {
+            header.index[number / TELEMETRY_INDEX_EVERY].offset = out - stream;
+            memset(last_words, 0, sizeof(last_words));
+            last_time_ns = 0;
+        }
+        int words = (record.size - sizeof(TLM_RECORD)) / 4;
+        out = put_varint(out, zigzag((int64_t) (record.time_ns - last_time_ns)));
+        out = put_varint(out, record.type);
+        out = put_varint(out, words);
+        last_time_ns = record.time_ns;
+        int i;
+        for (i = 0; i < words; i++) {
+            uint32_t word;
+            memcpy(&word, data + offset + sizeof(TLM_RECORD) + i * 4, 4);
+            out = put_varint(out, zigzag((int32_t) (word - last_words[record.type][i])));
+            last_words[record.type][i] = word;
+        }
+        offset += record.size;
+    }
+    munmap(data, status.st_size);
+    header.records = number;
+    header.used = out - stream - sizeof(header);
+    header.compressed = 1;
+    memcpy(stream, &header, sizeof(header));
+
+    int written = -1;
+    fd = open(compressed_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd >= 0) {
+        written = write(fd, stream, out - stream) == out - stream && fsync(fd) == 0 ? 0 : -1;
+        close(fd);
+    }
+    free(stream);
+    if (written < 0) {
+        unlink(compressed_path);
+    }
+    return written;
+}
+
+/**
+* Segment reader
+**/
+
+int open_segment_reader(TLM_READER *reader, const char *path) {
+    // A .tlm, even one still being written, or a .tlz - -1 if it isn't a segment
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    struct stat status;
+    fstat(fd, &status);
+    reader->size = status.st_size;
+    reader->data = reader->size >= sizeof(TLM_SEGMENT_HEADER)
+        ? mmap(NULL, reader->size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (reader->data == MAP_FAILED) {
+        return -1;
+    }
+    reader->header = (const TLM_SEGMENT_HEADER *) reader->data;
+    if (memcmp(reader->header->magic, TELEMETRY_MAGIC, sizeof(reader->header->magic)) != 0
+            || reader->header->version != TELEMETRY_VERSION) {
+        munmap(reader->data, reader->size);
+        return -1;
+    }
+    uint64_t start = reader->header->compressed ? sizeof(TLM_SEGMENT_HEADER) : TELEMETRY_DATA_OFFSET;
+    reader->end = start + __atomic_load_n(&reader->header->used, __ATOMIC_ACQUIRE);
+    reader->end = reader->end < reader->size ? reader->end : reader->size;
+    reader->records = reader->header->records;
+    reader->offset = start;
+    reader->number = 0;
+    return 0;
+}
+
+void seek_segment_reader(TLM_READER *reader, uint64_t time_ns) {
+    // To the index point before time_ns - records from there on may still be earlier
+    const TLM_SEGMENT_HEADER *header = reader->header;
+    uint32_t count = header->index_count < TELEMETRY_INDEX_SIZE ? header->index_count : TELEMETRY_INDEX_SIZE;
+    uint32_t low = 0;
+    uint32_t high = count;
+    while (low < high) {
+        uint32_t middle = (low + high) / 2;
+        if (header->index[middle].time_ns < time_ns) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    if (low > 0) {
+        reader->offset = header->index[low - 1].offset;
+        reader->number = (low - 1) * TELEMETRY_INDEX_EVERY;
+    }
+}
+
+bool next_segment_record(TLM_READER *reader, TLM_RECORD *record) {
+    // Into a TELEMETRY_MAX_RECORD byte buffer - false at the end, or at damage
+    if (reader->number >= reader->records || reader->offset + 1 > reader->end) {
+        return false;
+    }
+    if (!reader->header->compressed) {
+        if (reader->offset + sizeof(TLM_RECORD) > reader->end) {
+            return false;
+        }
+        memcpy(record, reader->data + reader->offset, sizeof(TLM_RECORD));
+        if (record->size < sizeof(TLM_RECORD) || record->size > TELEMETRY_MAX_RECORD
+                || reader->offset + record->size > reader->end) {
+            return false;
+        }
+        memcpy(record, reader->data + reader->offset, record->size);
+        reader->offset += record->size;
+        reader->number++;
+        return true;
+    }
+
+    if (index_point(reader->header, reader->number)) {
+        memset(reader->last_words, 0, sizeof(reader->last_words));
+        reader->last_time_ns = 0;
+    }
+    uint64_t delta, type, words;
+    if (!get_varint(reader->data, reader->end, &reader->offset, &delta)
+            || !get_varint(reader->data, reader->end, &reader->offset, &type)
+            || !get_varint(reader->data, reader->end, &reader->offset, &words)
+            || type >= TLM_TYPES || words > TLM_RECORD_WORDS) {
+        return false;
+    }
+    reader->last_time_ns += unzigzag(delta);
+    record->time_ns = reader->last_time_ns;
+    record->type = type;
+    record->size = sizeof(TLM_RECORD) + words * 4;
+    record->reserved = 0;
+    uint8_t *body = (uint8_t *) (record + 1);
+    uint64_t i;
+    for (i = 0; i < words; i++) {
+        uint64_t difference;
+        if (!get_varint(reader->data, reader->end, &reader->offset, &difference)) {
+            return false;
+        }
+        uint32_t word = reader->last_words[type][i] + (uint32_t) unzigzag(difference);
+        reader->last_words[type][i] = word;
+        memcpy(body + i * 4, &word, 4);
+    }
+    reader->number++;
+    return true;
+}
+
+void close_segment_reader(TLM_READER *reader) {
+    munmap(reader->data, reader->size);
+}
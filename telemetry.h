@@ -0,0 +1,135 @@
+/**
+* telemetry.h - Append only binary mission log
+*
+* A log is a directory of numbered segment files. The open segment,
+* uv1-NNNNNN.tlm, is preallocated and mapped with its pages faulted in, so
+* a record is a copy into memory under a mutex - no syscalls or page
+* faults. A background thread msyncs it every TELEMETRY_SYNC_MS, has the
+* next segment ready before it is needed, and once a segment fills, trims
+* it and rewrites it as uv1-NNNNNN.tlz, delta compressed. A .tlm left by a
+* crash stays as it is - readable, up to the last msync.
+*
+* Every segment starts with a TLM_SEGMENT_HEADER whose sparse index holds
+* the time and offset of every TELEMETRY_INDEX_EVERY'th record, so a reader
+* can seek by time. Records are a TLM_RECORD and a fixed body per type,
+* padded to 8 bytes.
+*
+* Compressed segments keep the header, index offsets into the compressed
+* stream. Each record is then varints - the time difference from the last
+* record, the type, the body's 32 bit word count, and each body word as the
+* zigzag difference from the same word of the last record of that type.
+* Both differences restart from 0 at every index point.
+*
+* Times are CLOCK_MONOTONIC ns - the header has CLOCK_REALTIME to match.
+* Not for sharing between processes - each writer has its own directory.
+*/
+
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "sensors.h"
+#include "motion.h"
+
+#define TELEMETRY_DIR           "/home/pi/uv1-log"
+#define TELEMETRY_MAGIC         "UV1TLM\n"
+#define TELEMETRY_VERSION       1
+#define TELEMETRY_SEGMENT_SIZE  (4 << 20)
+#define TELEMETRY_DATA_OFFSET   20480   // Records start here, after the header
+#define TELEMETRY_INDEX_EVERY   256     // Records per sparse index entry
+#define TELEMETRY_INDEX_SIZE    1024    // Index entries a header holds - a full segment needs < 700
+#define TELEMETRY_SYNC_MS       1000
+#define TELEMETRY_MAX_RECORD    1024    // Bytes, header included
+#define TELEMETRY_PATH_MAX      256
+
+// TLM_RECORD types
+#define TLM_SENSOR              1       // TLM_SENSOR_RECORD - a sensor event, as logged by sensord
+#define TLM_MOTION              2       // TLM_MOTION_RECORD - a motion and what it did
+#define TLM_SWEEP               3       // TLM_SWEEP_RECORD - a range sweep
+#define TLM_IMAGE               4       // TLM_IMAGE_RECORD - a photo or video taken
+#define TLM_TYPES               5
+
+typedef struct {
+    uint64_t time_ns;
+    uint64_t offset;        // From the start of the file
+} TLM_INDEX_ENTRY;
+
+typedef struct {
+    char magic[8];          // TELEMETRY_MAGIC
+    uint32_t version;
+    uint32_t segment;
+    uint64_t start_ns;      // CLOCK_MONOTONIC when the segment was opened...
+    uint64_t start_realtime_ns;     // ...and CLOCK_REALTIME at the same moment
+    uint64_t used;          // Bytes of records after TELEMETRY_DATA_OFFSET
+    uint32_t records;
+    uint32_t index_count;
+    uint32_t compressed;    // 1 for a .tlz
+    uint32_t reserved;
+    TLM_INDEX_ENTRY index[TELEMETRY_INDEX_SIZE];
+} TLM_SEGMENT_HEADER;
+
+typedef struct {
+    uint64_t time_ns;
+    uint16_t type;          // TLM_*
+    uint16_t size;          // Whole record in bytes, a multiple of 8
+    uint32_t reserved;
+} TLM_RECORD;
+
+typedef struct {
+    TLM_RECORD record;
+    int32_t sensor_id;      // SENSOR_ID_*
+    int32_t value;
+} TLM_SENSOR_RECORD;
+
+typedef struct {
+    TLM_RECORD record;
+    char motion[16];        // As given to execute_motion
+    int32_t halts;
+    uint32_t halt_cause;
+    int32_t executed_us;
+    int32_t paused_us;
+    int32_t interrupted_us;
+    int32_t late_us;
+} TLM_MOTION_RECORD;
+
+typedef struct {
+    TLM_RECORD record;
+    int32_t direction;
+    uint32_t duration_us;
+    uint16_t range_mm[SWEEP_BINS];      // As in SWEEP_PROFILE
+} TLM_SWEEP_RECORD;
+
+typedef struct {
+    TLM_RECORD record;
+    char path[TELEMETRY_MAX_RECORD - sizeof(TLM_RECORD)];  // Only as much as the path needs is logged
+} TLM_IMAGE_RECORD;
+
+#define TLM_RECORD_WORDS        ((TELEMETRY_MAX_RECORD - sizeof(TLM_RECORD)) / 4)
+
+typedef struct {
+    uint8_t *data;          // The segment file, mapped
+    size_t size;
+    const TLM_SEGMENT_HEADER *header;
+    uint64_t offset;        // Of the next record
+    uint64_t end;           // Of the records written when the reader opened
+    uint32_t records;
+    uint32_t number;        // Of the next record
+    uint64_t last_time_ns;  // Compressed segments' differences are from these
+    uint32_t last_words[TLM_TYPES][TLM_RECORD_WORDS];
+} TLM_READER;
+
+int open_telemetry(const char *);
+void close_telemetry(void);
+void log_sensor_record(uint64_t, int, int);
+void log_motion_record(uint64_t, const char *, int, const MOTION_RESULT *);
+void log_sweep_record(uint64_t, const SWEEP_PROFILE *);
+void log_image_record(uint64_t, const char *);
+int compress_segment(const char *, const char *);
+int segment_path(char *, const char *, uint32_t, bool);
+int open_segment_reader(TLM_READER *, const char *);
+void seek_segment_reader(TLM_READER *, uint64_t);
+bool next_segment_record(TLM_READER *, TLM_RECORD *);
+void close_segment_reader(TLM_READER *);
+
+#endif
@@ -8,7 +8,9 @@
 # Import required Python libraries
 import subprocess
 import time
+import collections
 import RPi.GPIO as GPIO
+import uv1      # uv1.so - make uv1.so
 
 # Use BCM GPIO references instead of physical pin numbers
 GPIO.setmode(GPIO.BCM)
@@ -38,6 +40,7 @@ camera_proc = None
 other_proc = None
 sensor_signals = None
 survey_data = None
+Vector = collections.namedtuple('Vector', 'degrees cm')
 movement_result = ['degrees': 0, 'cm': 0]
 log_file = None
 
@@ -115,23 +118,23 @@ def write_log_entry(movement, survey):
     log_file.write("{movement:" + movement_json(movement) + ", survey:" + survey_json(survey) + "}, \n" )
     
 def read_sensors():
-    results = ['touch':0, 'obstacle':0, 'sound':0, 'range':0 ]
-    with open(SENSOR_FILE, 'r') as file:
-        file_text = file.read()
-    if file_text[0:1]=='T' and file_text[1:2]=='+':
-        results.touch = 1
-    if file_text[2:3]=='O' and file_text[3:4]=='+':
-        results.obstacle = 1
-    if file_text[4:5]=='S' and file_text[5:6]=='+':
-        results.sound = 1
-    if file_text[6:7]=='R':
-        results.range = int(file_text[7:10], base=10)
-    return results
+    # { 'touch', 'obstacle', 'sound', 'range' } - straight from sensor memory
+    return uv1.read_sensors()
     
 def ambient_light:
     # TEMP CODE! Replace with photo light level analysis!
     return MIN_AVG_LIGHT_LEVEL + 50
 
+def determine_best_vector(survey_data):
+    # Heading and distance from the survey's range readings, one per partial turn. The turns
+    # make about a full circle, so they stand in for evenly spaced sweep bins - the last was
+    # taken facing where the robot is now, so it is heading 0
+    ranges_mm = [item.sensors.range * 10 if item.sensors.range else None for item in survey_data]
+    best = uv1.best_heading(ranges_mm[-1:] + ranges_mm[:-1]) if ranges_mm else None
+    if not best:
+        return Vector(degrees=180, cm=0)        # Boxed in - turn round
+    return Vector(degrees=best[0], cm=best[1] // 10)
+
 def survey_surroundings():
     results = []
     img_file_prefix = datetime.datetime.now().strftime(IMG_FILE)
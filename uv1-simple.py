@@ -4,33 +4,33 @@
 #
 # Author : Oren Camber
 # Date   : 2014-07-11
+#
+# Obstacle flags must clear themselves - run sensord -l obstacle=100000,50000
 
 # Import required Python libraries
 import random
 import subprocess
 import datetime
 import RPi.GPIO as GPIO
+import uv1      # uv1.so - make uv1.so
 
 IMG_FILE = '/home/pi/UV1-IMG-%Y%m%d%H%M%S-'
-SENSOR_FILE = '/dev/shm/sensor_data'
 SENSORD_CMD = '/home/pi/src/uv1/sensord'
-RESET_SENSORS_CMD = '/home/pi/src/uv1/reset_sensors'
-MOTORS_CMD = '/home/pi/src/uv1/motors'
 LIGHTS_CMD = '/home/pi/src/uv1/lights'
 LASER_CMD = '/home/pi/src/uv1/laser'
 PHOTO_CMD = 'raspistill'
 VIDEO_CMD = 'raspivid'
 LIGHTS_GPIO = 14
 LASER_GPIO  = 7
-FWD_MOTOR_CORRECTION = "FC"
-RVS_MOTOR_CORRECTION = "CF"
-MOTOR_CORRECTION_RATIO = 0.05
+MOTOR_TRIM_LEFT = 100     # Percent of motion speed per motor, so it drives straight
+MOTOR_TRIM_RIGHT = 95
 MAX_MOTOR_INTERVAL_CM = 20
 MOTOR_MS_PER_DEG = 5.83
 MOTOR_MS_PER_CM = 52.5
-PROXIMITY_SENSORS = "TO"
-PARTIAL_TURN = "FR190"
+IMPACT_SENSORS = "i"      # Latched - obstacles are level tracked by sensord
+SURVEY_DEGREES = 360
 BACK_AWAY = "RR200"
+MOTORS_OFF = "CC0"        # Coast - the motor pins stay ours for the next motion
 
 
 # Use BCM GPIO references instead of physical pin numbers
@@ -41,6 +41,12 @@ GPIO.setup(LASER_GPIO, GPIO.OUT)
 GPIO.output(LIGHTS_GPIO, False)
 GPIO.output(LASER_GPIO, False)
 
+# Motors are driven in-process - don't run actuatord alongside
+uv1.setup_motors(MOTOR_TRIM_LEFT, MOTOR_TRIM_RIGHT)
+
+# Motions and sweeps log themselves from here on - read back with uv1log
+uv1.open_log()
+
 
 def main():
 
@@ -62,9 +68,13 @@ def main():
             rotate_to_avoid_obstacle()
             continue
             
-        # Periodically scan surroundings
+        # Periodically scan surroundings, and head for the clearest way
         if random.randint(0,20)<1:
-            survey_surroundings()
+            vector = determine_best_vector(survey_surroundings())
+            if vector:
+                rotate(vector['degrees'])
+                go_forward(min(vector['cm'], MAX_MOTOR_INTERVAL_CM))
+                continue
 
         # Periodically rotate to new direction
         if random.randint(0,10)<2:
@@ -74,7 +84,7 @@ def main():
         # Go forward random cm to a new position
         go_forward(random.randint(0,MAX_MOTOR_INTERVAL_CM) + 10)
 
-def rotate(degrees):
+def rotate(degrees, halts=uv1.HALT_DEFAULT):
     if not degrees:
         return
 
@@ -83,7 +93,7 @@ def rotate(degrees):
     motors = "FR"
     if degrees < 0:
         motors = "RF"
-    movement_result = subprocess.call([MOTORS_CMD, motors+str(ms)])
+    movement_result = run_motion(motors+str(ms), halts)
     log_motion(movement_result)
     return movement_result
 
@@ -93,68 +103,69 @@ def go_forward(cm):
 
     # convert cm to motors / milliseconds
     ms = int(abs(cm) * MOTOR_MS_PER_CM + 0.5)
-    correction = "FC"
     motors = "FF"
+    halts = uv1.HALT_DEFAULT | uv1.HALT_ON_TTC    # Slow, then stop, short of what the rangefinder sees
     if cm < 0:
         motors = "RR"
-        movement_result = subprocess.call([MOTORS_CMD, motors+str(ms)])
-        motors = "CF"
-    else:
-        motors = "FF"
-        movement_result = subprocess.call([MOTORS_CMD, motors+str(ms)])
-        motors = "FC"
-
-    # Execute turn to correct straightness
-    subprocess.call([MOTORS_CMD, motors+str(int(MOTOR_CORRECTION_RATIO * ms))])
+        halts = uv1.HALT_DEFAULT
+    movement_result = run_motion(motors+str(ms), halts)
     log_motion(movement_result)
     return movement_result
 
 def back_away_from_obstacle():
-    subprocess.call([RESET_SENSORS_CMD, PROXIMITY_SENSORS])
-    movement_result = subprocess.call([MOTORS_CMD, BACK_AWAY])
-    subprocess.call([RESET_SENSORS_CMD, PROXIMITY_SENSORS])
+    movement_result = run_motion(BACK_AWAY)
+    uv1.reset_sensors(IMPACT_SENSORS)
     log_motion(movement_result)
     return movement_result
 
 def rotate_to_avoid_obstacle():
-    subprocess.call([RESET_SENSORS_CMD, PROXIMITY_SENSORS])
-    movement_result = rotate(random.randint(90,180))
-    subprocess.call([RESET_SENSORS_CMD, PROXIMITY_SENSORS])
-    log_motion(movement_result)
-    return movement_result
+    # Turning in place - an obstacle still in view doesn't stop it
+    return rotate(random.randint(90,180), uv1.HALT_ON_IMPACT)
+
+def run_motion(motion, halts=uv1.HALT_DEFAULT):
+    # Returns interrupted duration in ms, 0 if the motion completed
+    return uv1.run_motion(motion, halts)
 
 def read_sensors():
-    reading = { 'touch':0, 'obstacle':0, 'sound':0, 'range':0 }
-    with open(SENSOR_FILE, 'r') as file:
-        file_text = file.read()
-    if file_text[0:1]=='T' and file_text[1:2]=='+':
-        reading['touch'] = 1
-    if file_text[2:3]=='O' and file_text[3:4]=='+':
-        reading['obstacle'] = 1
-    if file_text[4:5]=='S' and file_text[5:6]=='+':
-        reading['sound'] = 1
-    if file_text[6:7]=='R':
-        reading['range'] = int(file_text[7:10], base=10)
-    return reading
+    # { 'touch', 'obstacle', 'sound', 'range' } - straight from sensor memory
+    return uv1.read_sensors()
 
 def survey_surroundings():
-    survey = []
-    img_group = datetime.datetime.now().strftime(IMG_FILE)
-    for i in range(0, 10):
-        sensor_signals = read_sensors()
-        img_file = img_group + str(i) + '.jpg'
-        subprocess.call([PHOTO_CMD, "-n", "-o", img_file])
-        survey.append({ 'sensors':sensor_signals, 'image':img_file })
-        if sensor_signals['sound'] or sensor_signals['touch']:
-            break
-        subprocess.call([MOTORS_CMD, PARTIAL_TURN])
+    # One full turn at a steady rate, filmed, while sensord bins ranges by heading
+    sensor_signals = read_sensors()
+    if sensor_signals['sound'] or sensor_signals['touch']:
+        return None
+    video_file = datetime.datetime.now().strftime(IMG_FILE) + 'sweep.h264'
+    sweep_ms = int(SURVEY_DEGREES * MOTOR_MS_PER_DEG + 0.5)
+    video = subprocess.Popen([VIDEO_CMD, "-n", "-t", str(sweep_ms), "-o", video_file])
+    uv1.sweep(SURVEY_DEGREES, MOTOR_MS_PER_DEG)
+    run_motion(MOTORS_OFF)  # A sweep that turns the full way leaves them turning
+    video.wait()
+    survey = uv1.read_sweep() or {}
+    survey.update({ 'sensors':sensor_signals, 'video':video_file })
     log_survey(survey)
     return survey
 
+def determine_best_vector(survey):
+    # { 'degrees', 'cm' } from a full turn's sweep, clockwise from where it started - None if
+    # there was no sweep or every way is blocked
+    if not survey or 'ranges_mm' not in survey:
+        return None
+    best = uv1.best_heading(survey['ranges_mm'])
+    if not best or best[1] < 10:
+        return None
+    return { 'degrees':best[0], 'cm':best[1] // 10 }
+
 def log_survey(survey):
-    pass
+    # The sweep itself is already logged - add the video and what sensord saw meanwhile
+    uv1.log_image(survey['video'])
+    uv1.log_sensor_events()
 
 def log_motion(movement_result):
-    pass
-    
-main()
\ No newline at end of file
+    uv1.log_sensor_events()
+
+try:
+    main()
+finally:
+    uv1.stop_motors()
+    uv1.close_log()
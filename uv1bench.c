@@ -0,0 +1,1262 @@
+/**
+* uv1bench.c - Benchmark sensord input handling and motion halts
+* against the GPIO simulator
+*
+* Runs the sensord handlers, rangefinder scan and run_motion in-process
+* with synthetic edges and reports:
+*   publish latency     edge to sensor data published
+*   publish cost        one sensor update published in place under the seqlock,
+*                       against the file write every update used to add
+*   seqlock stress      writer threads updating SENSOR_DATA, paced like busy
+*                       handlers, while reader threads take snapshots - fails
+*                       on any torn copy, or too few snapshots got through
+*   event ring          a producer logging events while cursors read them,
+*                       some slowly enough to be lapped - the losses each
+*                       cursor reported against the gaps it actually saw
+*   edge storm          handler throughput for a burst of edges
+*   chatter             obstacle flags set and cleared repeatedly - how many
+*                       updates the publish window merged
+*   glitch filter       short impact pulses rejected, and the delay the
+*                       filter adds to real ones
+*   halt latency        impact edge to run_motion's pin write stopping the
+*                       motors, and that they stayed stopped once it returned -
+*                       then less the impact filter's minimum pulse, against
+*                       a 100 us target
+*   level release       obstacle line idle to its level tracked flag clearing,
+*                       less the release time, and a motion paused by it - alone
+*                       and as a script step with more steps after it
+*   ttc halt            a forward motion closing on a simulated wall, with
+*                       spikes and missed echoes - where the range track
+*                       halted it, and the closing speed it measured
+*   range sweep         one turn in place in a simulated square room - bearings
+*                       the profile got, and how far they are from the walls -
+*                       then again with no echoes for part of the turn, long
+*                       enough to drop the range track
+*   heading             best_heading on a room with one doorway, at sweep
+*                       resolution and at HEADING_MAX_BINS - time per call
+*                       and the heading it picked
+*   map ray             mapper.c rays from random poses round a house sized
+*                       area - time per reading, tiles it took, and a
+*                       frontier query over the result
+*   telemetry           appending a mission's worth of sensor events, motions
+*                       and sweeps to a log in /tmp - time per record, the
+*                       size compressed, and reading it back with a seek
+*   motion timing       completed motions' overshoot past their deadline, idle
+*                       and with busy threads competing for the CPU
+*   script dispatch     a compiled script of zero length motions against the
+*                       same steps each parsed and run by execute_motion, as
+*                       the motors app ran them - time per step, and to compile
+*   motor switch        every change between motor settings - skew between
+*                       the motors' pin writes, register stores per change,
+*                       and any bridge passing through brake on the way
+*   ping rate           scan rate while driving forward, simulated echo
+*   actuator            ./actuatord round trips - a command with no motion, a
+*                       1 ms motion, and a batch of motions pipelined in one
+*                       write against the same motions sent one at a time
+*   pwm restart         half speed motions across stop_pwm / start_pwm cycles -
+*                       how often the timing thread switched the motor pins
+*                       off in each, so a restarted thread that never runs
+*                       shows
+*
+* Usage: uv1bench [publish_window_usec]
+*
+* Exits non-zero if a case's check fails.
+*
+* Obstacle and sound filtering is turned off so their cases measure the
+* handlers alone; impact keeps sensord's default filter. The left obstacle
+* is level tracked, the others latch.
+*
+* Creates its own sensor memory - do not run alongside sensord. The
+* actuator case starts ./actuatord from the current directory - build it
+* with make GPIO=sim, or the case is skipped.
+*
+* compile with sensors.o sensor_input.o motion.o pwm.o actuator.o gpio_sim.o gpio_regs.o + -pthread
+*/
+
+#include <math.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "gpio.h"
+#include "gpio_sim.h"
+#include "gpio_pins.h"
+#include "sensors.h"
+#include "sensor_input.h"
+#include "pwm.h"
+#include "motion.h"
+#include "heading.h"
+#include "mapper.h"
+#include "motion_script.h"
+#include "telemetry.h"
+#include "actuator.h"
+
+#define PUBLISH_SAMPLES     2000
+#define PUBLISH_COST_SAMPLES 20000
+#define PUBLISH_FILE        "/dev/shm/uv1bench_sensor_data"    // Not SENSOR_FILE - that is the live mapping
+#define SEQLOCK_WRITERS     2
+#define SEQLOCK_READERS     2
+#define SEQLOCK_RUN_NS      500000000L
+#define SEQLOCK_WRITE_GAP_NS 50000L     // Between one writer's updates - an edge storm on every input
+#define SEQLOCK_MIN_SNAPSHOTS 10000     // Across the readers in the run, or the readers are starved
+#define EVENT_COUNT         2000000
+#define EVENT_READERS       3           // Reader n pauses n * EVENT_PAUSE_NS every EVENT_PAUSE_EVERY events
+#define EVENT_PAUSE_EVERY   256
+#define EVENT_PAUSE_NS      50000L
+#define STORM_EDGES         200000
+#define CHATTER_ROUNDS      20000
+#define GLITCH_PULSES       5000
+#define GLITCH_WIDTH_US     5
+#define GLITCH_GAP_US       200
+#define PULSE_SAMPLES       200
+#define HALT_SAMPLES        200
+#define HALT_DELAY_NS       2000000L    // Motion runs this long before the impact
+#define HALT_TARGET_NS      100000L     // Impact edge to motors stopped
+#define RELEASE_SAMPLES     200
+#define RELEASE_US          1000        // Left obstacle's level tracking release time
+#define PAUSE_NS            20000000L   // Obstacle in view during the paused motion
+#define PAUSE_MOTION_MS     100
+#define PAUSE_SCRIPT_STEP_MS 20         // Steps after the paused one
+#define APPROACH_START_CM   150
+#define APPROACH_MM_S       500         // Closing speed of the simulated wall
+#define APPROACH_STEP_NS    5000000L
+#define APPROACH_SPIKE_EVERY 7          // Every nth step echoes from far away, or not at all
+#define SWEEP_MS_PER_DEG    5.83        // Turn rate, as calibrated for the robot
+#define SWEEP_ROOM_CM       100         // Robot to the nearest point of each wall
+#define SWEEP_STEP_NS       1000000L
+#define SWEEP_GAP_FROM_DEG  150         // Open space - enough missed echoes in a row to drop the range track
+#define SWEEP_GAP_TO_DEG    200
+#define HEADING_SAMPLES     1000
+#define HEADING_DOOR_DEG    100         // Doorway centre, clockwise from heading 0
+#define HEADING_DOOR_WIDTH  40          // Degrees wide, 3 m deep
+#define MAP_SAMPLES         100000
+#define MAP_AREA_MM         15000       // Square the poses are spread over
+#define MAP_FRONTIER_COUNT  16
+#define TELEMETRY_SAMPLES   500000      // About 3 segments
+#define TELEMETRY_STEP_NS   20000000L   // Sensor events 50 a second
+#define TELEMETRY_MOTION_EVERY 40       // A motion every 0.8 s...
+#define TELEMETRY_SWEEP_EVERY 3000      // ...and a sweep every minute
+#define TIMING_SAMPLES      100
+#define TIMING_MOTION_MS    5
+#define TIMING_LOAD_THREADS 2
+#define SCRIPT_STEPS        100000      // Zero length motions, so dispatch is all that's timed
+#define PING_RUN_NS         1000000000L
+#define ACTUATOR_SAMPLES    1000
+#define ACTUATOR_MOTION_SAMPLES 200
+#define ACTUATOR_PIPELINE   50          // Motions sent in one write
+#define ACTUATOR_START_NS   2000000000L // Wait this long for ./actuatord to listen
+#define PWM_CYCLES          3           // start_pwm, a motion, stop_pwm
+#define PWM_MOTION_MS       20
+#define PWM_SPEED           50
+#define BENCH_RANGE         100
+
+typedef struct {
+    SENSOR_EVENT_CURSOR cursor;
+    long pause_ns;          // Every EVENT_PAUSE_EVERY events read
+    uint64_t read;
+    uint64_t lost;          // Gaps in the event values
+    uint64_t disordered;
+    uint64_t miscounted;    // Events whose gap wasn't the overruns reported with them
+} EVENT_READER;
+
+void bench_publish(void);
+void legacy_publish(SENSOR_MEMORY *);
+void bench_seqlock(void);
+void bench_events(void);
+void bench_storm(void);
+void bench_chatter(void);
+void bench_glitch(void);
+void bench_halt(void);
+void bench_release(void);
+void bench_ttc(void);
+void bench_sweep(void);
+void sweep_room(char *, int, int);
+void bench_heading(void);
+void bench_map(void);
+void bench_telemetry(void);
+void bench_timing(void);
+void bench_script(void);
+void bench_switch(void);
+void bench_ping(void);
+void bench_actuator(void);
+void bench_pwm(void);
+void *scan_thread(void *);
+void *impact_thread(void *);
+void *obstacle_thread(void *);
+void *load_thread(void *);
+void *seqlock_writer(void *);
+void *seqlock_reader(void *);
+void *event_producer(void *);
+void *event_reader(void *);
+void *approach_thread(void *);
+void *room_thread(void *);
+int room_range_mm(double);
+void wait_state(uint32_t, bool);
+void report(char *, uint64_t *, int);
+int compare_ns(const void *, const void *);
+void sleep_ns(long);
+
+static SENSOR_MEMORY *sensor_memory;
+static volatile bool stop_scan = false;
+static uint64_t impact_ns;              // When impact_thread raised the edge
+static volatile bool stop_load = false;
+static volatile bool stop_approach = false;
+static volatile int approach_cm;        // Where approach_thread has the wall
+static volatile bool stop_room = false;
+static SENSOR_MEMORY seqlock_memory;    // Private to bench_seqlock and bench_events, so sensord's own publishes don't mix in
+static volatile bool stop_seqlock = false;
+static volatile bool events_done = false;
+static volatile int room_gap_from_deg;    // No echoes between these headings, -1 for none
+static volatile int room_gap_to_deg;
+static bool bench_failed = false;       // A case's check failed - exit status
+
+int main(int argc, char **argv) {
+    int publish_window_us = SENSOR_PUBLISH_WINDOW_US;
+    if (argc > 2 || (argc == 2 && (publish_window_us = atoi(argv[1])) < 0)) {
+        fprintf(stderr, "Usage: uv1bench [publish_window_usec]\n");
+        exit(EXIT_FAILURE);
+    }
+    if (access_sensor_memory( &sensor_memory, (0666 | SENSOR_MEMORY_CREATE) ) < 0)
+    {
+        fprintf(stderr, "Cannot access sensor memory!\n");
+        exit(EXIT_FAILURE);
+    }
+    if (setup_gpio() < 0) {
+        fprintf(stderr, "Cannot set up GPIO!\n");
+        exit(EXIT_FAILURE);
+    }
+    setup_sensor_record(sensor_memory);
+
+    // Idle inputs - obstacle and sound are active LOW
+    int idle_high[] = { OBSTACLE_F_GPIO, OBSTACLE_B_GPIO, OBSTACLE_L_GPIO, OBSTACLE_R_GPIO, SOUND_GPIO };
+    int i;
+    for (i = 0; i < (int) (sizeof(idle_high) / sizeof(idle_high[0])); i++) {
+        sim_set_pin(idle_high[i], HIGH);
+    }
+
+    parse_input_filter("obstacle=0,0");
+    parse_input_filter("sound=0,0");
+    set_input_tracking(SENSOR_ID_OBSTACLE_L, 0, RELEASE_US);
+    if (setup_sensor_input(sensor_memory, publish_window_us) < 0) {
+        exit(EXIT_FAILURE);
+    }
+    setup_motion(sensor_memory);
+    sim_set_range(BENCH_RANGE);
+
+    pthread_t scan;
+    if (pthread_create(&scan, NULL, scan_thread, NULL) != 0) {
+        fprintf(stderr, "Cannot start range scan!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    bench_publish();
+    bench_seqlock();
+    bench_events();
+    bench_storm();
+    bench_chatter();
+    bench_glitch();
+    bench_halt();
+    bench_release();
+    bench_ttc();
+    bench_sweep();
+    bench_heading();
+    bench_map();
+    bench_telemetry();
+    bench_timing();
+    bench_script();
+    bench_switch();
+    bench_ping();
+    bench_actuator();
+    bench_pwm();
+
+    stop_scan = true;
+    pthread_join(scan, NULL);
+    stop_sensor_input();
+    release_sensor_memory(sensor_memory);
+    exit(bench_failed ? EXIT_FAILURE : EXIT_SUCCESS);
+}
+
+void bench_publish() {
+    // Sound edge to sound_val published, as a reader spinning on the seqlock sees it
+    static uint64_t samples[PUBLISH_SAMPLES];
+    SENSOR_DATA snapshot;
+    int i;
+
+    for (i = 0; i < PUBLISH_SAMPLES; i++) {
+        reset_sensor_state(sensor_memory, STATE_SOUND);
+
+        uint64_t start = monotonic_ns();
+        sim_set_pin(SOUND_GPIO, LOW);
+        do {
+            read_sensor_snapshot(sensor_memory, &snapshot);
+        } while (snapshot.sound_val != POSITIVE_VAL);
+        samples[i] = monotonic_ns() - start;
+
+        sim_set_pin(SOUND_GPIO, HIGH);
+        sim_wait_handlers();
+    }
+    reset_sensor_state(sensor_memory, STATE_SOUND);
+    report("publish latency", samples, PUBLISH_SAMPLES);
+
+    // The handler's own cost - the seqlock update alone, then with the old file write after it
+    static uint64_t costs[PUBLISH_COST_SAMPLES];
+    memset(&seqlock_memory, 0, sizeof(seqlock_memory));
+    int with_file;
+    for (with_file = 0; with_file <= 1; with_file++) {
+        for (i = 0; i < PUBLISH_COST_SAMPLES; i++) {
+            uint64_t start = monotonic_ns();
+            begin_sensor_update(&seqlock_memory);
+            seqlock_memory.data.sound_val = i & 1 ? POSITIVE_VAL : NEGATIVE_VAL;
+            end_sensor_update(&seqlock_memory);
+            if (with_file) {
+                legacy_publish(&seqlock_memory);
+            }
+            costs[i] = monotonic_ns() - start;
+        }
+        report(with_file ? "publish + file" : "publish in place", costs, PUBLISH_COST_SAMPLES);
+    }
+    unlink(PUBLISH_FILE);
+}
+
+void legacy_publish(SENSOR_MEMORY *memory) {
+    // As sensord published before the file was mapped - a snapshot, then fopen/fwrite/fclose
+    SENSOR_DATA snapshot;
+    if (read_sensor_snapshot(memory, &snapshot)) {
+        FILE *sensor_file = fopen(PUBLISH_FILE, "w");
+        if (sensor_file != NULL) {
+            fwrite(&snapshot, sizeof(SENSOR_DATA), 1, sensor_file);
+            fclose(sensor_file);
+        }
+    }
+}
+
+void bench_seqlock() {
+    // Writers fill the whole SENSOR_DATA with one character per update while readers take snapshots -
+    // any snapshot with two characters in it is torn
+    pthread_t writers[SEQLOCK_WRITERS];
+    pthread_t readers[SEQLOCK_READERS];
+    uint64_t writes[SEQLOCK_WRITERS];
+    uint64_t reads[SEQLOCK_READERS][3];     // Snapshots, torn, given up on
+    int i;
+    memset(&seqlock_memory, 0, sizeof(seqlock_memory));     // Record version 0 - snapshots go through the seqlock
+    stop_seqlock = false;
+    for (i = 0; i < SEQLOCK_WRITERS; i++) {
+        writes[i] = i;
+        pthread_create(&writers[i], NULL, seqlock_writer, &writes[i]);
+    }
+    for (i = 0; i < SEQLOCK_READERS; i++) {
+        pthread_create(&readers[i], NULL, seqlock_reader, reads[i]);
+    }
+    sleep_ns(SEQLOCK_RUN_NS);
+    stop_seqlock = true;
+    uint64_t written = 0;
+    uint64_t snapshots = 0;
+    uint64_t torn = 0;
+    uint64_t given_up = 0;
+    for (i = 0; i < SEQLOCK_WRITERS; i++) {
+        pthread_join(writers[i], NULL);
+        written += writes[i];
+    }
+    for (i = 0; i < SEQLOCK_READERS; i++) {
+        pthread_join(readers[i], NULL);
+        snapshots += reads[i][0];
+        torn += reads[i][1];
+        given_up += reads[i][2];
+    }
+    bool failed = torn > 0 || snapshots < SEQLOCK_MIN_SNAPSHOTS;
+    printf("%-20s %llu updates by %d writers, %llu snapshots by %d readers, %llu torn, %llu retried out%s\n",
+            "seqlock stress", (unsigned long long) written, SEQLOCK_WRITERS, (unsigned long long) snapshots,
+            SEQLOCK_READERS, (unsigned long long) torn, (unsigned long long) given_up, failed ? " - FAILED" : "");
+    bench_failed = bench_failed || failed;
+}
+
+void bench_events() {
+    // Each event's value is its number, so a reader can count the events it never got and
+    // check them against the overruns its cursor reported
+    pthread_t producer;
+    pthread_t readers[EVENT_READERS];
+    EVENT_READER reader[EVENT_READERS];
+    int i;
+    memset(&seqlock_memory, 0, sizeof(seqlock_memory));
+    memset(reader, 0, sizeof(reader));
+    events_done = false;
+    for (i = 0; i < EVENT_READERS; i++) {
+        open_sensor_event_cursor(&seqlock_memory, &reader[i].cursor);
+        reader[i].pause_ns = i * EVENT_PAUSE_NS;
+    }
+    uint64_t start = monotonic_ns();
+    pthread_create(&producer, NULL, event_producer, NULL);
+    for (i = 0; i < EVENT_READERS; i++) {
+        pthread_create(&readers[i], NULL, event_reader, &reader[i]);
+    }
+    pthread_join(producer, NULL);
+    uint64_t elapsed = monotonic_ns() - start;
+    events_done = true;
+
+    for (i = 0; i < EVENT_READERS; i++) {
+        pthread_join(readers[i], NULL);
+        EVENT_READER *counts = &reader[i];
+        bool ok = counts->read + counts->cursor.overruns == EVENT_COUNT && counts->lost == counts->cursor.overruns
+                    && counts->disordered == 0 && counts->miscounted == 0;
+        printf("%-20s cursor %d read %llu, lost %llu reported, %llu seen - %s\n", i == 0 ? "event ring" : "", i,
+                (unsigned long long) counts->read, (unsigned long long) counts->cursor.overruns,
+                (unsigned long long) counts->lost, ok ? "counts match" : "LOSS MISCOUNTED");
+    }
+    printf("%-20s %d events logged at %.1f ns each\n", "", EVENT_COUNT, (double) elapsed / EVENT_COUNT);
+}
+
+void bench_storm() {
+    // Obstacle edges as fast as they can be raised, across all four sensors
+    int pins[] = { OBSTACLE_F_GPIO, OBSTACLE_B_GPIO, OBSTACLE_L_GPIO, OBSTACLE_R_GPIO };
+    uint64_t first_event = __atomic_load_n(&sensor_memory->event_head, __ATOMIC_ACQUIRE);
+    uint64_t start = monotonic_ns();
+    int i;
+
+    for (i = 0; i < STORM_EDGES; i++) {
+        sim_set_pin(pins[i & 3], LOW);
+        sim_set_pin(pins[i & 3], HIGH);
+    }
+    sim_wait_handlers();
+    uint64_t elapsed = monotonic_ns() - start;
+
+    // Includes any range pings logged meanwhile
+    uint64_t events = __atomic_load_n(&sensor_memory->event_head, __ATOMIC_ACQUIRE) - first_event;
+    printf("%-20s %d edges in %.1f ms = %.0f edges/sec, %llu events logged\n",
+            "edge storm", STORM_EDGES, elapsed / 1e6, STORM_EDGES * 1e9 / elapsed,
+            (unsigned long long) events);
+
+    reset_sensor_state(sensor_memory, STATE_OBSTACLE);
+}
+
+void bench_chatter() {
+    // Each round a reader clears the obstacle flags and all four sensors fire again
+    int pins[] = { OBSTACLE_F_GPIO, OBSTACLE_B_GPIO, OBSTACLE_L_GPIO, OBSTACLE_R_GPIO };
+    PUBLISH_STATS before = sensor_memory->publish_stats;
+    int i;
+    int j;
+
+    for (i = 0; i < CHATTER_ROUNDS; i++) {
+        reset_sensor_state(sensor_memory, STATE_OBSTACLE);
+        for (j = 0; j < 4; j++) {
+            sim_set_pin(pins[j], LOW);
+            sim_set_pin(pins[j], HIGH);
+        }
+        sim_wait_handlers();
+    }
+    sleep_ns(sensor_memory->publish_stats.window_us * 2000L);     // Last window closes
+
+    PUBLISH_STATS *after = &sensor_memory->publish_stats;
+    printf("%-20s %llu edges, %llu updates in %llu publishes, %llu merged (%u us window)\n", "chatter",
+            (unsigned long long) (after->edges - before.edges),
+            (unsigned long long) (after->updates - before.updates),
+            (unsigned long long) (after->publishes - before.publishes),
+            (unsigned long long) (after->merged - before.merged), after->window_us);
+
+    reset_sensor_state(sensor_memory, STATE_OBSTACLE);
+}
+
+void bench_glitch() {
+    // A burst of impact pulses a few usec wide, like motor noise, then real presses
+    static uint64_t samples[PULSE_SAMPLES];
+    static SIM_EDGE pulses[GLITCH_PULSES * 2];
+    uint64_t glitches = sensor_memory->filter_stats.glitches[SENSOR_ID_IMPACT_B];
+    SENSOR_DATA snapshot;
+    int i;
+
+    for (i = 0; i < GLITCH_PULSES; i++) {
+        SIM_EDGE rise = { GLITCH_GAP_US, IMPACT_B_GPIO, HIGH };
+        SIM_EDGE fall = { GLITCH_WIDTH_US, IMPACT_B_GPIO, LOW };
+        pulses[i * 2] = rise;
+        pulses[i * 2 + 1] = fall;
+    }
+    reset_sensor_state(sensor_memory, STATE_IMPACT);
+    sim_play_edges(pulses, GLITCH_PULSES * 2);
+    sim_wait_handlers();
+    sleep_ns(sensor_memory->filter_stats.debounce_us[SENSOR_ID_IMPACT_B] * 2000L);
+    glitches = sensor_memory->filter_stats.glitches[SENSOR_ID_IMPACT_B] - glitches;
+    printf("%-20s %d glitches of %d us, %llu rejected, %llu passed\n", "glitch filter",
+            GLITCH_PULSES, GLITCH_WIDTH_US, (unsigned long long) glitches,
+            (unsigned long long) (GLITCH_PULSES - glitches));
+
+    // Real press to impact published - includes the min pulse wait
+    for (i = 0; i < PULSE_SAMPLES; i++) {
+        uint64_t start = monotonic_ns();
+        sim_set_pin(IMPACT_B_GPIO, HIGH);
+        do {
+            read_sensor_snapshot(sensor_memory, &snapshot);
+        } while (snapshot.impact_val[IDX_BACK] != POSITIVE_VAL);
+        samples[i] = monotonic_ns() - start;
+
+        sim_set_pin(IMPACT_B_GPIO, LOW);
+        reset_sensor_state(sensor_memory, STATE_IMPACT);
+        sleep_ns(sensor_memory->filter_stats.debounce_us[SENSOR_ID_IMPACT_B] * 1000L);
+    }
+    report("filtered press", samples, PULSE_SAMPLES);
+}
+
+void bench_halt() {
+    // Impact edge during a forward motion to the pin write that stops the motors - run_motion
+    // has to stop them itself, so the pins are checked before anything else touches them
+    static uint64_t samples[HALT_SAMPLES];
+    int halted = 0;
+    int still_driven = 0;
+    int i;
+
+    for (i = 0; i < HALT_SAMPLES; i++) {
+        reset_sensor_state(sensor_memory, STATE_IMPACT);
+
+        pthread_t impact;
+        pthread_create(&impact, NULL, impact_thread, NULL);
+        MOTION_RESULT result;
+        run_motion('F', 'F', 1000, PWM_FULL, HALT_DEFAULT, &result);
+        pthread_join(impact, NULL);
+
+        if (result.halt_cause != 0) {
+            samples[halted++] = result.stopped_ns - impact_ns;
+            still_driven += read_pin(LEFT_MOTOR_FWD_GPIO) != LOW || read_pin(RIGHT_MOTOR_FWD_GPIO) != LOW;
+        }
+        sim_set_pin(IMPACT_F_GPIO, LOW);
+        sim_wait_handlers();
+    }
+    if (halted < HALT_SAMPLES) {
+        printf("%-20s %d of %d motions not halted!\n", "halt latency", HALT_SAMPLES - halted, HALT_SAMPLES);
+    }
+    if (still_driven > 0) {
+        printf("%-20s %d of %d halted motions left the motors driven!\n", "halt latency", still_driven, halted);
+    }
+    report("halt latency", samples, halted);
+
+    // The impact filter holds every edge for its minimum pulse by design - the target is for what comes after
+    uint64_t filter_ns = sensor_memory->filter_stats.min_pulse_us[SENSOR_ID_IMPACT_F] * 1000ULL;
+    int within = 0;
+    for (i = 0; i < halted; i++) {
+        samples[i] = samples[i] > filter_ns ? samples[i] - filter_ns : 0;
+        within += samples[i] <= HALT_TARGET_NS;
+    }
+    report("halt less filter", samples, halted);
+    printf("%-20s %d of %d stopped within %ld us of the %llu us filter passing the edge%s\n", "", within, halted,
+            HALT_TARGET_NS / 1000, (unsigned long long) filter_ns / 1000,
+            halted > 0 && samples[halted * 99 / 100] > HALT_TARGET_NS ? " - p99 OVER TARGET" : "");
+    reset_sensor_state(sensor_memory, STATE_IMPACT);
+}
+
+void bench_release() {
+    // Left obstacle line going idle to its flag clearing, as a reader spinning on the state word sees it
+    static uint64_t samples[RELEASE_SAMPLES];
+    int i;
+
+    for (i = 0; i < RELEASE_SAMPLES; i++) {
+        sim_set_pin(OBSTACLE_L_GPIO, LOW);
+        wait_state(STATE_FLAG(SENSOR_ID_OBSTACLE_L), true);
+
+        uint64_t start = monotonic_ns();
+        sim_set_pin(OBSTACLE_L_GPIO, HIGH);
+        wait_state(STATE_FLAG(SENSOR_ID_OBSTACLE_L), false);
+        samples[i] = monotonic_ns() - start - RELEASE_US * 1000L;
+    }
+    report("level release", samples, RELEASE_SAMPLES);
+
+    // A forward motion that pauses while the obstacle is in view, then finishes
+    pthread_t obstacle;
+    pthread_create(&obstacle, NULL, obstacle_thread, NULL);
+    int paused_ms = run_motion('F', 'F', PAUSE_MOTION_MS, PWM_FULL, HALT_DEFAULT | HALT_PAUSE_ON_OBSTACLE, NULL);
+    pthread_join(obstacle, NULL);
+    run_motion('C', 'C', 0, PWM_FULL, 0, NULL);
+    printf("%-20s %d ms motion paused %d ms for a %ld ms obstacle + %d us release\n", "obstacle pause",
+            PAUSE_MOTION_MS, paused_ms, PAUSE_NS / 1000000L, RELEASE_US);
+
+    // The same as a script step, with more after it - pausing isn't halting, so they all run
+    char path[] = "/tmp/uv1bench-script-XXXXXX";
+    int fd = mkstemp(path);
+    FILE *script_file = fd < 0 ? NULL : fdopen(fd, "w");
+    if (script_file == NULL) {
+        fprintf(stderr, "Cannot write motion script in /tmp!\n");
+        return;
+    }
+    fprintf(script_file, "FF%d +p\nFF%d\nIF HALTED\nSTOP\nEND\nFF%d\n", PAUSE_MOTION_MS,
+            PAUSE_SCRIPT_STEP_MS, PAUSE_SCRIPT_STEP_MS);
+    fclose(script_file);
+    static MOTION_SCRIPT script;
+    int op_count = load_motion_script(path, &script, HALT_DEFAULT);
+    unlink(path);
+    if (op_count < 0) {
+        fprintf(stderr, "Cannot compile motion script, line %d!\n", -op_count);
+        return;
+    }
+    MOTION_RESULT result;
+    pthread_create(&obstacle, NULL, obstacle_thread, NULL);
+    int interrupted_ms = run_motion_script(&script, sensor_memory, &result);
+    pthread_join(obstacle, NULL);
+    run_motion('C', 'C', 0, PWM_FULL, 0, NULL);
+    long wanted_us = (PAUSE_MOTION_MS + 2 * PAUSE_SCRIPT_STEP_MS) * 1000L;
+    long ran_us = result.executed_us + result.paused_us;     // Pausing comes out of the step's time
+    printf("%-20s paused %ld ms, ran %ld of %ld ms - %s, returned %d\n", "paused script",
+            result.paused_us / 1000, ran_us / 1000, wanted_us / 1000,
+            ran_us + 1000 >= wanted_us ? "every step ran" : "STEPS SKIPPED", interrupted_ms);
+}
+
+void bench_ttc() {
+    // Drive at a wall closing at APPROACH_MM_S until the range track halts the motion
+    pthread_t approach;
+    stop_approach = false;
+    approach_cm = APPROACH_START_CM;
+    sim_set_range(APPROACH_START_CM);
+    sleep_ns(PING_RUN_NS / 2);      // A track to start from
+    pthread_create(&approach, NULL, approach_thread, NULL);
+
+    MOTION_RESULT result;
+    run_motion('F', 'F', APPROACH_START_CM * 10000 / APPROACH_MM_S * 2, PWM_FULL, HALT_ON_TTC, &result);
+    int halted_cm = approach_cm;
+    uint64_t track = read_range_track(sensor_memory);
+    stop_approach = true;
+    pthread_join(approach, NULL);
+    run_motion('C', 'C', 0, PWM_FULL, 0, NULL);
+    sim_set_range(BENCH_RANGE);
+
+    printf("%-20s halted by %s at %d cm, %d ms out (%d ms wanted), tracked %d mm at %d mm/s (%d)\n",
+            "ttc halt", halt_cause_name(result.halt_cause), halted_cm, halted_cm * 10000 / APPROACH_MM_S,
+            MOTION_TTC_HALT_MS, TRACK_RANGE_MM(track), TRACK_CLOSING_MM_S(track), APPROACH_MM_S);
+}
+
+void bench_sweep() {
+    // A full circle, then one with no echoes for a stretch in the middle - long enough for sensord
+    // to drop the range track, which must not lose the rest of the sweep
+    sweep_room("range sweep", -1, -1);
+    sweep_room("sweep past a gap", SWEEP_GAP_FROM_DEG, SWEEP_GAP_TO_DEG);
+}
+
+void sweep_room(char *name, int gap_from_deg, int gap_to_deg) {
+    // Turn a full circle while room_thread moves the walls around the rangefinder
+    pthread_t room;
+    stop_room = false;
+    room_gap_from_deg = gap_from_deg;
+    room_gap_to_deg = gap_to_deg;
+    pthread_create(&room, NULL, room_thread, NULL);
+    MOTION_RESULT result;
+    run_sweep(SWEEP_BINS, SWEEP_MS_PER_DEG, HALT_ON_IMPACT, &result);
+    run_motion('C', 'C', 0, PWM_FULL, 0, NULL);
+    stop_room = true;
+    pthread_join(room, NULL);
+    sim_set_range(BENCH_RANGE);
+
+    SWEEP_PROFILE profile;
+    if (!read_sweep_profile(sensor_memory, &profile)) {
+        printf("%-20s no profile\n", name);
+        return;
+    }
+    int bearings = 0;
+    int after_gap = 0;
+    long error_mm = 0;
+    int i;
+    for (i = 0; i < SWEEP_BINS; i++) {
+        if (profile.range_mm[i] == SWEEP_NO_SAMPLE || (i >= gap_from_deg && i < gap_to_deg)) {
+            continue;
+        }
+        bearings++;
+        error_mm += labs((long) profile.range_mm[i] - room_range_mm(i + 0.5));
+        after_gap += gap_to_deg >= 0 && i >= gap_to_deg;
+    }
+    printf("%-20s %ld ms turn, %u pings into %d of %d bearings, mean %ld mm off the walls\n",
+            name, result.executed_us / 1000, profile.samples, bearings, SWEEP_BINS,
+            bearings > 0 ? error_mm / bearings : 0);
+    if (gap_to_deg >= 0) {
+        printf("%-20s no echo from %d to %d deg, %d bearings after it\n", "", gap_from_deg, gap_to_deg, after_gap);
+    }
+}
+
+void bench_heading() {
+    // Walls a metre round, with a gap to pick out - every ping taken, at two resolutions
+    static uint16_t range_mm[HEADING_MAX_BINS];
+    static uint64_t samples[HEADING_SAMPLES];
+    int bin_counts[] = { SWEEP_BINS, HEADING_MAX_BINS };
+    int b;
+    for (b = 0; b < 2; b++) {
+        int bins = bin_counts[b];
+        int i;
+        for (i = 0; i < bins; i++) {
+            double degrees = (i + 0.5) * 360 / bins;
+            bool door = degrees > HEADING_DOOR_DEG - HEADING_DOOR_WIDTH / 2
+                        && degrees < HEADING_DOOR_DEG + HEADING_DOOR_WIDTH / 2;
+            range_mm[i] = door ? 3000 : room_range_mm(degrees);
+        }
+        HEADING best = { 0, 0, 0 };
+        for (i = 0; i < HEADING_SAMPLES; i++) {
+            uint64_t start = monotonic_ns();
+            best_heading(range_mm, bins, 0, &best);
+            samples[i] = monotonic_ns() - start;
+        }
+        char name[32];
+        snprintf(name, sizeof(name), "heading %d bins", bins);
+        report(name, samples, HEADING_SAMPLES);
+        printf("%-20s picked %d deg, %d mm clear, density %.2f (doorway at %d deg)\n", "",
+                best.degrees, best.distance_mm, best.density, HEADING_DOOR_DEG);
+    }
+}
+
+void bench_map() {
+    // Readings at 0.2 - 5 m, a fifth of them no echo, from anywhere in the area facing any way
+    static uint64_t samples[MAP_SAMPLES];
+    setup_map(52.5, 5.83);
+    uint64_t seed = 0x9e3779b97f4a7c15ULL;
+    int i;
+    for (i = 0; i < MAP_SAMPLES; i++) {
+        seed ^= seed << 13;
+        seed ^= seed >> 7;
+        seed ^= seed << 17;
+        MAP_POSE pose;
+        pose.x_mm = (double) (seed % MAP_AREA_MM) - MAP_AREA_MM / 2;
+        pose.y_mm = (double) ((seed >> 16) % MAP_AREA_MM) - MAP_AREA_MM / 2;
+        pose.heading_deg = (seed >> 32) % 360;
+        int range_mm = 200 + (int) ((seed >> 40) % 4800);
+        uint64_t start = monotonic_ns();
+        map_range(&pose, range_mm >= 4000 ? RANGE_MAX_MM : range_mm);
+        samples[i] = monotonic_ns() - start;
+    }
+    report("map ray", samples, MAP_SAMPLES);
+
+    MAP_STATS stats;
+    MAP_FRONTIER frontiers[MAP_FRONTIER_COUNT];
+    MAP_POSE home = { 0, 0, 0 };
+    uint64_t start = monotonic_ns();
+    int found = map_frontiers(&home, frontiers, MAP_FRONTIER_COUNT);
+    uint64_t query_ns = monotonic_ns() - start;
+    read_map_stats(&stats);
+    printf("%-20s %u tiles (%u KB of %d), %llu cell updates, nearest of %d frontiers %d mm away, query %.1f ms\n",
+            "", stats.tiles, stats.tiles * MAP_TILE_CELLS * MAP_TILE_CELLS / 1024,
+            MAP_TILE_POOL * MAP_TILE_CELLS * MAP_TILE_CELLS / 1024, (unsigned long long) stats.cells,
+            found, found > 0 ? frontiers[0].distance_mm : 0, query_ns / 1e6);
+}
+
+void bench_telemetry() {
+    // A 2.8 hour mission's records, timed as the robot would log them, appended as fast as they go
+    static uint64_t samples[TELEMETRY_SAMPLES];
+    static uint64_t record_buffer[TELEMETRY_MAX_RECORD / sizeof(uint64_t)];
+    char dir[] = "/tmp/uv1bench-log-XXXXXX";
+    if (mkdtemp(dir) == NULL || open_telemetry(dir) < 0) {
+        fprintf(stderr, "Cannot open telemetry log in /tmp!\n");
+        return;
+    }
+    SWEEP_PROFILE profile;
+    memset(&profile, 0, sizeof(profile));
+    MOTION_RESULT result;
+    memset(&result, 0, sizeof(result));
+    uint64_t first_ns = monotonic_ns();
+    uint64_t time_ns = first_ns;
+    uint64_t raw_bytes = 0;
+    uint64_t checksum = 0;
+    int range_mm = 1000;
+    uint64_t seed = 0x9e3779b97f4a7c15ULL;
+    int i;
+    for (i = 0; i < TELEMETRY_SAMPLES; i++) {
+        seed ^= seed << 13;
+        seed ^= seed >> 7;
+        seed ^= seed << 17;
+        time_ns += TELEMETRY_STEP_NS + seed % 1000000;
+        range_mm += (int) (seed >> 20) % 41 - 20;
+        range_mm = range_mm < 100 ? 100 : (range_mm > 4000 ? 4000 : range_mm);
+        int value = (seed >> 40) % 20 == 0 ? RANGE_MAX_MM : range_mm;
+        uint64_t start = monotonic_ns();
+        log_sensor_record(time_ns, SENSOR_ID_RANGE, value);
+        samples[i] = monotonic_ns() - start;
+        raw_bytes += sizeof(TLM_SENSOR_RECORD);
+        checksum += value;
+        if (i % TELEMETRY_MOTION_EVERY == 0) {
+            result.executed_us = 200000 + seed % 400000;
+            log_motion_record(time_ns, "FF1000", HALT_DEFAULT, &result);
+            raw_bytes += sizeof(TLM_MOTION_RECORD);
+        }
+        if (i % TELEMETRY_SWEEP_EVERY == 0) {
+            int bin;
+            for (bin = 0; bin < SWEEP_BINS; bin++) {
+                profile.range_mm[bin] = bin % 2 ? SWEEP_NO_SAMPLE : room_range_mm(bin + i);
+            }
+            profile.start_ns = time_ns;
+            profile.end_ns = time_ns + 2100000000ULL;
+            log_sweep_record(time_ns, &profile);
+            raw_bytes += sizeof(TLM_SWEEP_RECORD);
+        }
+    }
+    uint64_t last_ns = time_ns;
+    close_telemetry();
+    report("telemetry append", samples, TELEMETRY_SAMPLES);
+
+    // All of it back, then a seek to the last minute
+    uint64_t log_bytes = 0;
+    uint64_t records = 0;
+    uint64_t read_checksum = 0;
+    int segments = 0;
+    uint64_t seek_records = 0;
+    uint64_t read_ns = 0;
+    uint64_t seek_ns = 0;
+    uint32_t number;
+    for (number = 1; ; number++) {
+        char path[TELEMETRY_PATH_MAX];
+        struct stat status;
+        if (segment_path(path, dir, number, true) < 0 || stat(path, &status) < 0) {
+            break;
+        }
+        log_bytes += status.st_size;
+        segments++;
+        static TLM_READER reader;
+        TLM_RECORD *record = (TLM_RECORD *) record_buffer;
+        uint64_t start = monotonic_ns();
+        if (open_segment_reader(&reader, path) == 0) {
+            while (next_segment_record(&reader, record)) {
+                records++;
+                if (record->type == TLM_SENSOR) {
+                    read_checksum += ((TLM_SENSOR_RECORD *) record)->value;
+                }
+            }
+            close_segment_reader(&reader);
+        }
+        read_ns += monotonic_ns() - start;
+        start = monotonic_ns();
+        if (open_segment_reader(&reader, path) == 0) {
+            seek_segment_reader(&reader, last_ns - 60000000000ULL);
+            while (next_segment_record(&reader, record)) {
+                seek_records++;
+            }
+            close_segment_reader(&reader);
+        }
+        seek_ns += monotonic_ns() - start;
+        unlink(path);
+    }
+    rmdir(dir);
+    uint64_t logged = TELEMETRY_SAMPLES + TELEMETRY_SAMPLES / TELEMETRY_MOTION_EVERY
+                        + TELEMETRY_SAMPLES / TELEMETRY_SWEEP_EVERY + 1;
+    double hours = (last_ns - first_ns) / 3.6e12;
+    printf("%-20s %llu records in %d segments, %.1f MB raw, %.2f MB compressed (%.1fx), %.1f bytes a record,"
+            " %.0f hours per GB\n", "", (unsigned long long) records, segments, raw_bytes / 1e6, log_bytes / 1e6,
+            (double) raw_bytes / log_bytes, (double) log_bytes / records, hours / (log_bytes / 1e9));
+    printf("%-20s read back %s in %.0f ms, last minute seeked to in %.1f ms (%llu records)\n", "",
+            records == logged && read_checksum == checksum ? "intact" : "DAMAGED", read_ns / 1e6,
+            seek_ns / 1e6, (unsigned long long) seek_records);
+}
+
+void bench_timing() {
+    // Motions that run to their deadline - how late run_motion returns
+    static uint64_t samples[TIMING_SAMPLES];
+    pthread_t load[TIMING_LOAD_THREADS];
+    int loaded;
+    int i;
+
+    for (loaded = 0; loaded <= TIMING_LOAD_THREADS; loaded += TIMING_LOAD_THREADS) {
+        stop_load = false;
+        for (i = 0; i < loaded; i++) {
+            pthread_create(&load[i], NULL, load_thread, NULL);
+        }
+        long error_us = 0;
+        for (i = 0; i < TIMING_SAMPLES; i++) {
+            MOTION_RESULT result;
+            run_motion('F', 'F', TIMING_MOTION_MS, PWM_FULL, 0, &result);
+            samples[i] = result.late_us * 1000ULL;
+            error_us += result.executed_us - TIMING_MOTION_MS * 1000L;
+        }
+        run_motion('C', 'C', 0, PWM_FULL, 0, NULL);
+        stop_load = true;
+        for (i = 0; i < loaded; i++) {
+            pthread_join(load[i], NULL);
+        }
+        char name[32];
+        snprintf(name, sizeof(name), "motion timing +%d", loaded);
+        report(name, samples, TIMING_SAMPLES);
+        printf("%-20s %d x %d ms motions executed %ld us longer in total\n", "", TIMING_SAMPLES,
+                TIMING_MOTION_MS, error_us);
+    }
+}
+
+void bench_script() {
+    // Steps as compiled ops against the motion strings parsed for every step
+    static char *steps[] = { "FF0", "RR0@60" };
+    int step_count = sizeof(steps) / sizeof(steps[0]);
+    char path[] = "/tmp/uv1bench-script-XXXXXX";
+    int fd = mkstemp(path);
+    FILE *script_file = fd < 0 ? NULL : fdopen(fd, "w");
+    if (script_file == NULL) {
+        fprintf(stderr, "Cannot write motion script in /tmp!\n");
+        return;
+    }
+    fprintf(script_file, "REPEAT %d\n", SCRIPT_STEPS / step_count);
+    int i;
+    for (i = 0; i < step_count; i++) {
+        fprintf(script_file, "%s\n", steps[i]);
+    }
+    fprintf(script_file, "END\n");
+    fclose(script_file);
+
+    static MOTION_SCRIPT script;
+    uint64_t start = monotonic_ns();
+    int op_count = load_motion_script(path, &script, 0);
+    uint64_t load_ns = monotonic_ns() - start;
+    unlink(path);
+    if (op_count < 0) {
+        fprintf(stderr, "Cannot compile motion script, line %d!\n", -op_count);
+        return;
+    }
+
+    MOTION_RESULT result;
+    start = monotonic_ns();
+    run_motion_script(&script, sensor_memory, &result);
+    uint64_t compiled_ns = monotonic_ns() - start;
+
+    start = monotonic_ns();
+    for (i = 0; i < SCRIPT_STEPS; i++) {
+        execute_motion(steps[i % step_count], 0, &result);
+    }
+    uint64_t parsed_ns = monotonic_ns() - start;
+    run_motion('C', 'C', 0, PWM_FULL, 0, NULL);
+
+    printf("%-20s compiled %.1f ns/step, execute_motion %.1f ns/step, %d ops compiled in %.1f us\n",
+            "script dispatch", (double) compiled_ns / SCRIPT_STEPS, (double) parsed_ns / SCRIPT_STEPS,
+            op_count, load_ns / 1e3);
+}
+
+void bench_switch() {
+    // Every left / right setting to every other, replaying the pin writes each made
+    static const char settings[] = "FRBC";
+    static const int motor_pins[4] = { LEFT_MOTOR_FWD_GPIO, LEFT_MOTOR_REV_GPIO,
+                                        RIGHT_MOTOR_FWD_GPIO, RIGHT_MOTOR_REV_GPIO };
+    int levels[4] = { LOW, LOW, LOW, LOW };
+    int changes = 0;
+    int brakes = 0;             // Bridge briefly had both inputs HIGH without braking
+    uint64_t max_skew_ns = 0;
+    uint64_t stores = sim_register_stores();
+    int from, to;
+
+    run_motion('C', 'C', 0, PWM_FULL, 0, NULL);
+    for (from = 0; from < 16; from++) {
+        for (to = 0; to < 16; to++) {
+            run_motion(settings[from / 4], settings[from % 4], 0, PWM_FULL, 0, NULL);
+            uint64_t first = sim_write_count();
+            run_motion(settings[to / 4], settings[to % 4], 0, PWM_FULL, 0, NULL);
+            uint64_t last = sim_write_count();
+            changes++;
+
+            uint64_t start_ns = 0;
+            uint64_t number;
+            SIM_WRITE write;
+            for (number = first; number < last && sim_read_write(number, &write); number++) {
+                int i;
+                for (i = 0; i < 4 && motor_pins[i] != write.pin; i++) {
+                    // Find the motor pin
+                }
+                if (i == 4) {
+                    continue;
+                }
+                if (start_ns == 0) {
+                    start_ns = write.time_ns;
+                }
+                if (write.time_ns - start_ns > max_skew_ns) {
+                    max_skew_ns = write.time_ns - start_ns;
+                }
+                levels[i] = write.value;
+                int bridge = i & ~1;
+                char setting = settings[bridge == 0 ? to / 4 : to % 4];
+                if (levels[bridge] == HIGH && levels[bridge + 1] == HIGH && setting != 'B') {
+                    brakes++;
+                }
+            }
+        }
+    }
+    run_motion('C', 'C', 0, PWM_FULL, 0, NULL);
+    stores = sim_register_stores() - stores;
+    printf("%-20s %d changes, skew %llu ns, %.1f register stores each, %d passed through brake\n",
+            "motor switch", changes, (unsigned long long) max_skew_ns,
+            (double) stores / (2 * changes + 2), brakes);
+}
+
+void bench_ping() {
+    // Driving forward, sensord pings back to back
+    uint64_t pings = sensor_memory->ping_stats.pings;
+    uint64_t echoes = sensor_memory->ping_stats.echoes;
+    set_motion_state(sensor_memory, MOTION_MOVING | MOTION_FORWARD);
+    sleep_ns(PING_RUN_NS);
+    set_motion_state(sensor_memory, 0);
+    pings = sensor_memory->ping_stats.pings - pings;
+    echoes = sensor_memory->ping_stats.echoes - echoes;
+
+    SENSOR_DATA snapshot;
+    read_sensor_snapshot(sensor_memory, &snapshot);
+    printf("%-20s %llu pings/sec, %llu echoes, range %.3s cm (simulated %d)\n",
+            "ping rate", (unsigned long long) (pings * 1000000000L / PING_RUN_NS),
+            (unsigned long long) echoes, snapshot.range_val, BENCH_RANGE);
+}
+
+void bench_actuator() {
+    // Through the daemon, as the motors app and scripts drive the robot
+    pid_t daemon = fork();
+    if (daemon == 0) {
+        execl("./actuatord", "actuatord", (char *) NULL);
+        _exit(EXIT_FAILURE);
+    }
+    ACTUATOR_CONNECTION actuator;
+    bool connected = false;
+    uint64_t start = monotonic_ns();
+    while (daemon > 0 && !(connected = connect_actuator(&actuator))
+            && waitpid(daemon, NULL, WNOHANG) == 0 && monotonic_ns() - start < ACTUATOR_START_NS) {
+        sleep_ns(1000000L);
+    }
+    if (!connected) {
+        printf("%-20s skipped - cannot start ./actuatord\n", "actuator");
+        if (daemon > 0) {
+            kill(daemon, SIGTERM);
+            waitpid(daemon, NULL, 0);
+        }
+        return;
+    }
+
+    static uint64_t samples[ACTUATOR_SAMPLES];
+    long result;
+    int i;
+    for (i = 0; i < ACTUATOR_SAMPLES; i++) {
+        start = monotonic_ns();
+        actuator_command(&actuator, "lights off", &result);
+        samples[i] = monotonic_ns() - start;
+    }
+    report("actuator command", samples, ACTUATOR_SAMPLES);
+
+    // No halts, so the bench's own sensor state can't cut the motions short
+    uint64_t one_at_a_time_ns = 0;
+    for (i = 0; i < ACTUATOR_MOTION_SAMPLES; i++) {
+        start = monotonic_ns();
+        actuator_command(&actuator, "motion FF1 0", &result);
+        samples[i] = monotonic_ns() - start;
+        one_at_a_time_ns += samples[i];
+    }
+    report("actuator motion 1ms", samples, ACTUATOR_MOTION_SAMPLES);
+
+    char batch[ACTUATOR_PIPELINE * 16] = "";
+    for (i = 0; i < ACTUATOR_PIPELINE; i++) {
+        strcat(batch, "motion FF1 0\n");
+    }
+    int replies = 0;
+    start = monotonic_ns();
+    if (write(actuator.fd, batch, strlen(batch)) == (ssize_t) strlen(batch)) {
+        while (replies < ACTUATOR_PIPELINE && read_actuator_reply(&actuator, &result)) {
+            replies++;
+        }
+    }
+    uint64_t pipelined_ns = monotonic_ns() - start;
+    printf("%-20s %d x 1 ms motions in %.2f ms, %.1f us between motions (one at a time %.1f us)\n",
+            "actuator pipeline", replies, pipelined_ns / 1e6,
+            (pipelined_ns / 1e3 - ACTUATOR_PIPELINE * 1000.0) / ACTUATOR_PIPELINE,
+            one_at_a_time_ns / 1e3 / ACTUATOR_MOTION_SAMPLES - 1000.0);
+
+    disconnect_actuator(&actuator);
+    kill(daemon, SIGTERM);
+    waitpid(daemon, NULL, 0);
+}
+
+void bench_pwm() {
+    // Last, as start_pwm locks the bench's memory. Only the timing thread switches a pin off mid-motion
+    static PWM_STATS pwm_stats;
+    int switched[PWM_CYCLES];
+    int cycle;
+    bool restarted = true;
+    for (cycle = 0; cycle < PWM_CYCLES; cycle++) {
+        if (!start_pwm(&pwm_stats)) {
+            bench_failed = true;
+            return;
+        }
+        uint64_t first = sim_write_count();
+        run_motion('F', 'F', PWM_MOTION_MS, PWM_SPEED, 0, NULL);
+        uint64_t last = sim_write_count();
+        run_motion('C', 'C', 0, PWM_FULL, 0, NULL);
+        stop_pwm();
+
+        switched[cycle] = 0;
+        uint64_t number;
+        SIM_WRITE write;
+        for (number = first; number < last && sim_read_write(number, &write); number++) {
+            switched[cycle] += write.pin == LEFT_MOTOR_FWD_GPIO && write.value == LOW;
+        }
+        restarted = restarted && switched[cycle] > 0;
+    }
+    printf("%-20s %d x %d ms motions at %d%%, left motor switched off", "pwm restart", PWM_CYCLES,
+            PWM_MOTION_MS, PWM_SPEED);
+    for (cycle = 0; cycle < PWM_CYCLES; cycle++) {
+        printf(" %d", switched[cycle]);
+    }
+    printf(" times%s\n", restarted ? "" : " - NOT SWITCHED after a restart");
+    bench_failed = bench_failed || !restarted;
+}
+
+void *scan_thread(void *arg) {
+    (void) arg;
+    run_range_scan(&stop_scan);
+    return NULL;
+}
+
+void *impact_thread(void *arg) {
+    (void) arg;
+    sleep_ns(HALT_DELAY_NS);
+    impact_ns = monotonic_ns();
+    sim_set_pin(IMPACT_F_GPIO, HIGH);
+    return NULL;
+}
+
+void *obstacle_thread(void *arg) {
+    (void) arg;
+    sleep_ns(HALT_DELAY_NS);
+    sim_set_pin(OBSTACLE_L_GPIO, LOW);
+    sleep_ns(PAUSE_NS);
+    sim_set_pin(OBSTACLE_L_GPIO, HIGH);
+    return NULL;
+}
+
+void *approach_thread(void *arg) {
+    // Moves the simulated wall in, with a far echo or none now and then
+    (void) arg;
+    uint64_t start = monotonic_ns();
+    int step;
+    for (step = 1; !stop_approach && approach_cm > 0; step++) {
+        sleep_ns(APPROACH_STEP_NS);
+        approach_cm = APPROACH_START_CM - (int) ((monotonic_ns() - start) * APPROACH_MM_S / 10000000000ULL);
+        if (step % APPROACH_SPIKE_EVERY == 0) {
+            sim_set_range(step % (2 * APPROACH_SPIKE_EVERY) == 0 ? -1 : 400);
+        } else {
+            sim_set_range(approach_cm > 0 ? approach_cm : 0);
+        }
+    }
+    return NULL;
+}
+
+void *room_thread(void *arg) {
+    // Range to the walls at the heading the sweep has reached, 0 before it starts
+    (void) arg;
+    while (!stop_room) {
+        uint32_t sequence = __atomic_load_n(&sensor_memory->sweep.sequence, __ATOMIC_ACQUIRE);
+        uint64_t start_ns = sensor_memory->sweep.start_ns;
+        uint64_t now_ns = monotonic_ns();
+        if ((sequence & 1) && now_ns > start_ns) {
+            double degrees = (now_ns - start_ns) / 1e6 / SWEEP_MS_PER_DEG;
+            bool gap = degrees >= room_gap_from_deg && degrees < room_gap_to_deg;
+            sim_set_range(gap ? -1 : (room_range_mm(degrees) + 5) / 10);
+        }
+        sleep_ns(SWEEP_STEP_NS);
+    }
+    return NULL;
+}
+
+int room_range_mm(double degrees) {
+    // Square room with the robot in the middle, walls square to heading 0
+    double radians = degrees * M_PI / 180;
+    double nearest = fabs(cos(radians)) > fabs(sin(radians)) ? fabs(cos(radians)) : fabs(sin(radians));
+    return (int) (SWEEP_ROOM_CM * 10 / nearest + 0.5);
+}
+
+void *seqlock_writer(void *arg) {
+    // One byte at a time, so an unguarded reader would see a mix - *arg is the first character, then the count
+    uint64_t *count = arg;
+    char fill = 'A' + *count;
+    *count = 0;
+    while (!stop_seqlock) {
+        begin_sensor_update(&seqlock_memory);
+        volatile char *data = (volatile char *) &seqlock_memory.data;
+        int i;
+        for (i = 0; i < (int) sizeof(SENSOR_DATA); i++) {
+            data[i] = fill;
+        }
+        end_sensor_update(&seqlock_memory);
+        fill = fill == 'Z' ? 'A' : fill + 1;
+        (*count)++;
+        sleep_ns(SEQLOCK_WRITE_GAP_NS);
+    }
+    return NULL;
+}
+
+void *seqlock_reader(void *arg) {
+    uint64_t *counts = arg;
+    counts[0] = counts[1] = counts[2] = 0;
+    while (!stop_seqlock) {
+        SENSOR_DATA snapshot;
+        if (!read_sensor_snapshot(&seqlock_memory, &snapshot)) {
+            counts[2]++;
+            continue;
+        }
+        const char *data = (const char *) &snapshot;
+        int i;
+        for (i = 1; i < (int) sizeof(SENSOR_DATA) && data[i] == data[0]; i++) {
+        }
+        counts[0]++;
+        counts[1] += i < (int) sizeof(SENSOR_DATA);
+    }
+    return NULL;
+}
+
+void *event_producer(void *arg) {
+    (void) arg;
+    int i;
+    for (i = 0; i < EVENT_COUNT; i++) {
+        log_sensor_event(&seqlock_memory, SENSOR_ID_RANGE, i, 0);
+    }
+    return NULL;
+}
+
+void *event_reader(void *arg) {
+    // Reads until the producer is done and the ring drained
+    EVENT_READER *reader = arg;
+    int64_t last_value = -1;
+    uint64_t last_overruns = 0;
+    for (;;) {
+        bool done = events_done;
+        SENSOR_EVENT event;
+        if (!next_sensor_event(&seqlock_memory, &reader->cursor, &event)) {
+            if (done) {
+                break;
+            }
+            continue;
+        }
+        int64_t skipped = event.value - last_value - 1;
+        reader->lost += skipped;
+        reader->disordered += skipped < 0;
+        reader->miscounted += (uint64_t) skipped != reader->cursor.overruns - last_overruns;
+        last_value = event.value;
+        last_overruns = reader->cursor.overruns;
+        if (++reader->read % EVENT_PAUSE_EVERY == 0 && reader->pause_ns > 0) {
+            sleep_ns(reader->pause_ns);
+        }
+    }
+    return NULL;
+}
+
+void *load_thread(void *arg) {
+    // Competes for the CPU until stop_load
+    (void) arg;
+    while (!stop_load) {
+        // Spin
+    }
+    return NULL;
+}
+
+void wait_state(uint32_t flag, bool set) {
+    // Spin until the flag is set or clear
+    while (((read_sensor_state(sensor_memory) & flag) != 0) != set) {
+        // Spin
+    }
+}
+
+void report(char *name, uint64_t *samples, int count) {
+    qsort(samples, count, sizeof(uint64_t), compare_ns);
+    printf("%-20s p50 %8.1f us   p99 %8.1f us   max %8.1f us   (%d samples)\n", name,
+            samples[count / 2] / 1e3, samples[count * 99 / 100] / 1e3, samples[count - 1] / 1e3, count);
+}
+
+int compare_ns(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *) a;
+    uint64_t y = *(const uint64_t *) b;
+    return x < y ? -1 : (x > y);
+}
+
+void sleep_ns(long ns) {
+    struct timespec duration;
+    duration.tv_sec = ns / 1000000000L;
+    duration.tv_nsec = ns % 1000000000L;
+    nanosleep(&duration, NULL);
+}
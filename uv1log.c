@@ -0,0 +1,257 @@
+/**
+* uv1log.c - Read a telemetry log back, as JSON or CSV
+*
+* Usage: uv1log [-c] [-s from_secs] [-e to_secs] [-t types] log_dir | segment...
+*
+* Prints the records of a log directory's segments, .tlm and .tlz alike,
+* in segment order - or of the segment files given. Times are seconds
+* from the start of the first segment, with the wall clock time beside.
+* -s and -e keep the records from and to those times, seeking in each
+* segment by its index rather than reading it all. -t keeps only the
+* types given, any of "smwi" - sensor, motion, sweep, image. JSON is an
+* array of one object per line, -c prints CSV with a header line instead.
+*
+* compile with sensors.o telemetry.o
+*/
+
+#include <dirent.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "sensors.h"
+#include "motion.h"
+#include "telemetry.h"
+
+#define MAX_SEGMENTS        4096
+#define LATE_NS             60000000000ULL  // Records can be logged this long after their time - a motion once it ends
+
+int find_segments(const char *, char **, int);
+int compare_paths(const void *, const void *);
+void print_record(const TLM_RECORD *, double, uint64_t);
+char *halt_name(uint32_t);
+
+static const char type_letters[TLM_TYPES + 1] = "?smwi";
+static const char *type_names[TLM_TYPES] = { "?", "sensor", "motion", "sweep", "image" };
+static bool csv = false;
+static bool printed = false;
+
+int main(int argc, char **argv) {
+    bool ok_args = true;
+    double from_secs = -1;
+    double to_secs = -1;
+    const char *types = "smwi";
+    int option;
+    while ((option = getopt(argc, argv, "cs:e:t:")) != -1) {
+        switch (option) {
+            case 'c':
+                csv = true;
+                break;
+            case 's':
+                from_secs = atof(optarg);
+                break;
+            case 'e':
+                to_secs = atof(optarg);
+                break;
+            case 't':
+                types = optarg;
+                ok_args = ok_args && strspn(types, "smwi") == strlen(types);
+                break;
+            default:
+                ok_args = false;
+        }
+    }
+    if (!ok_args || optind == argc) {
+        fprintf(stderr, "Usage: uv1log [-c] [-s from_secs] [-e to_secs] [-t types] log_dir | segment...\n");
+        exit(EXIT_FAILURE);
+    }
+
+    static char *paths[MAX_SEGMENTS];
+    int count = 0;
+    DIR *listing = opendir(argv[optind]);
+    if (listing != NULL && optind + 1 == argc) {
+        closedir(listing);
+        count = find_segments(argv[optind], paths, MAX_SEGMENTS);
+    } else {
+        if (listing != NULL) {
+            closedir(listing);
+        }
+        for (; optind < argc && count < MAX_SEGMENTS; optind++) {
+            paths[count++] = argv[optind];
+        }
+    }
+
+    if (csv) {
+        printf("time_s,wall,type,sensor,value,motion,halts,halt_cause,executed_us,paused_us,"
+                "interrupted_us,late_us,direction,duration_us,ranges_mm,path\n");
+    } else {
+        printf("[\n");
+    }
+    static TLM_READER reader;
+    uint64_t mission_start_ns = 0;
+    uint64_t record_buffer[TELEMETRY_MAX_RECORD / sizeof(uint64_t)];
+    TLM_RECORD *record = (TLM_RECORD *) record_buffer;
+    int i;
+    for (i = 0; i < count; i++) {
+        if (open_segment_reader(&reader, paths[i]) < 0) {
+            fprintf(stderr, "Cannot read telemetry segment %s!\n", paths[i]);
+            continue;
+        }
+        const TLM_SEGMENT_HEADER *header = reader.header;
+        if (mission_start_ns == 0) {
+            mission_start_ns = header->start_ns;
+        }
+        uint64_t from_ns = from_secs < 0 ? 0 : mission_start_ns + (uint64_t) (from_secs * 1e9);
+        uint64_t to_ns = to_secs < 0 ? UINT64_MAX : mission_start_ns + (uint64_t) (to_secs * 1e9);
+        if (header->start_ns > to_ns) {
+            close_segment_reader(&reader);
+            break;
+        }
+        if (from_ns > LATE_NS) {
+            seek_segment_reader(&reader, from_ns - LATE_NS);
+        }
+        bool past_end = false;
+        while (next_segment_record(&reader, record)) {
+            if (record->time_ns > to_ns && record->time_ns - to_ns > LATE_NS) {
+                past_end = true;
+                break;
+            }
+            if (record->time_ns < from_ns || record->time_ns > to_ns
+                    || strchr(types, type_letters[record->type]) == NULL) {
+                continue;
+            }
+            print_record(record, (int64_t) (record->time_ns - mission_start_ns) / 1e9,
+                            header->start_realtime_ns + (record->time_ns - header->start_ns));
+        }
+        if (!past_end && reader.number < reader.records) {
+            fprintf(stderr, "Telemetry segment %s is damaged after record %u!\n", paths[i], reader.number);
+        }
+        close_segment_reader(&reader);
+    }
+    if (!csv) {
+        printf("%s]\n", printed ? "\n" : "");
+    }
+    exit(EXIT_SUCCESS);
+}
+
+int find_segments(const char *dir, char **paths, int max_paths) {
+    // uv1-NNNNNN.tlz or .tlm in number order - the .tlz if it has both, as it does while compressing
+    DIR *listing = opendir(dir);
+    int count = 0;
+    struct dirent *entry;
+    while ((entry = readdir(listing)) != NULL && count < max_paths) {
+        uint32_t number;
+        char extension[4];
+        if (sscanf(entry->d_name, "uv1-%6u.%3s", &number, extension) != 2
+                || (strcmp(extension, "tlm") != 0 && strcmp(extension, "tlz") != 0)) {
+            continue;
+        }
+        char path[TELEMETRY_PATH_MAX];
+        char compressed_path[TELEMETRY_PATH_MAX];
+        if (segment_path(path, dir, number, extension[2] == 'z') < 0
+                || segment_path(compressed_path, dir, number, true) < 0) {
+            fprintf(stderr, "Cannot read telemetry segment %s - path too long!\n", entry->d_name);
+            continue;
+        }
+        if (extension[2] == 'm' && access(compressed_path, R_OK) == 0) {
+            continue;
+        }
+        paths[count++] = strdup(path);
+    }
+    closedir(listing);
+    qsort(paths, count, sizeof(char *), compare_paths);
+    return count;
+}
+
+int compare_paths(const void *a, const void *b) {
+    // Same directory and zero padded, so the number orders them
+    return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+void print_record(const TLM_RECORD *record, double secs, uint64_t realtime_ns) {
+    char wall[40];
+    time_t wall_secs = realtime_ns / 1000000000ULL;
+    struct tm local;
+    localtime_r(&wall_secs, &local);
+    int length = strftime(wall, sizeof(wall), "%Y-%m-%dT%H:%M:%S", &local);
+    snprintf(wall + length, sizeof(wall) - length, ".%03d", (int) (realtime_ns / 1000000 % 1000));
+
+    if (csv) {
+        printf("%.6f,%s,%s,", secs, wall, type_names[record->type]);
+    } else {
+        printf("%s{\"time_s\":%.6f,\"wall\":\"%s\",\"type\":\"%s\"", printed ? ",\n" : "", secs, wall,
+                type_names[record->type]);
+    }
+    printed = true;
+
+    if (record->type == TLM_SENSOR) {
+        const TLM_SENSOR_RECORD *sensor = (const TLM_SENSOR_RECORD *) record;
+        const char *name = sensor->sensor_id >= 0 && sensor->sensor_id < SENSOR_ID_COUNT
+                            ? sensor_name(sensor->sensor_id) : "?";
+        if (csv) {
+            printf("%s,%d,,,,,,,,,,,\n", name, sensor->value);
+        } else {
+            printf(",\"sensor\":\"%s\",\"value\":%d}", name, sensor->value);
+        }
+    } else if (record->type == TLM_MOTION) {
+        const TLM_MOTION_RECORD *motion = (const TLM_MOTION_RECORD *) record;
+        char name[sizeof(motion->motion) + 1];
+        memcpy(name, motion->motion, sizeof(motion->motion));
+        name[sizeof(motion->motion)] = '\0';
+        if (csv) {
+            printf(",,%s,%d,%s,%d,%d,%d,%d,,,,\n", name, motion->halts, halt_name(motion->halt_cause),
+                    motion->executed_us, motion->paused_us, motion->interrupted_us, motion->late_us);
+        } else {
+            printf(",\"motion\":\"%s\",\"halts\":%d,\"halt_cause\":\"%s\",\"executed_us\":%d,\"paused_us\":%d,"
+                    "\"interrupted_us\":%d,\"late_us\":%d}", name, motion->halts, halt_name(motion->halt_cause),
+                    motion->executed_us, motion->paused_us, motion->interrupted_us, motion->late_us);
+        }
+    } else if (record->type == TLM_SWEEP) {
+        // Ranges space separated in CSV, null where no ping landed in JSON
+        const TLM_SWEEP_RECORD *sweep = (const TLM_SWEEP_RECORD *) record;
+        if (csv) {
+            printf(",,,,,,,,,%d,%u,", sweep->direction, sweep->duration_us);
+        } else {
+            printf(",\"direction\":%d,\"duration_us\":%u,\"ranges_mm\":[", sweep->direction, sweep->duration_us);
+        }
+        int i;
+        for (i = 0; i < SWEEP_BINS; i++) {
+            if (csv) {
+                printf(i == 0 ? "%u" : " %u", sweep->range_mm[i]);
+            } else if (sweep->range_mm[i] == SWEEP_NO_SAMPLE) {
+                printf(i == 0 ? "null" : ",null");
+            } else {
+                printf(i == 0 ? "%u" : ",%u", sweep->range_mm[i]);
+            }
+        }
+        printf(csv ? ",\n" : "]}");
+    } else if (record->type == TLM_IMAGE) {
+        // Paths the scripts make have no quotes or commas to escape
+        const TLM_IMAGE_RECORD *image = (const TLM_IMAGE_RECORD *) record;
+        int length = strnlen(image->path, record->size - sizeof(TLM_RECORD));
+        if (csv) {
+            printf(",,,,,,,,,,,,%.*s\n", length, image->path);
+        } else {
+            printf(",\"path\":\"%.*s\"}", length, image->path);
+        }
+    } else {
+        printf(csv ? ",,,,,,,,,,,,\n" : "}");
+    }
+}
+
+char *halt_name(uint32_t halt_cause) {
+    // As halt_cause_name, without linking the motor code
+    if (halt_cause & HALT_CAUSE_TTC) {
+        return "ttc";
+    }
+    int sensor_id;
+    for (sensor_id = SENSOR_ID_OBSTACLE_F; sensor_id < SENSOR_ID_COUNT; sensor_id++) {
+        if (halt_cause & STATE_FLAG(sensor_id)) {
+            return sensor_name(sensor_id);
+        }
+    }
+    return "done";
+}
@@ -0,0 +1,423 @@
+/**
+* uv1module.c - Python module for sensor reads and motions in-process
+*
+* import uv1
+*   read_sensors()              Snapshot of the sensor data as a dict - range in cm, range_mm in mm,
+*                               and the filtered track_mm, closing_mm_s and ttc_ms (None if not closing)
+*   reset_sensors(which)        Clear readings - any of "rosi", as for reset_sensors
+*   wait_sensors(timeout_ms)    Sleep until a halt relevant change, True if there was one
+*   setup_motors(trim_left=100, trim_right=100)
+*                               Take the motor pins - instead of actuatord, not alongside it
+*   run_motion(motion, halts=HALT_DEFAULT)
+*                               Interrupted duration in ms, 0 if the motion completed - a
+*                               halted motion returns with the motors stopped, a completed
+*                               one with them still in its setting
+*   sweep(degrees, ms_per_deg, halts=HALT_ON_IMPACT)
+*                               Turn in place, clockwise if positive, taking a range sweep -
+*                               interrupted duration in ms, and stopped if halted, as for
+*                               run_motion
+*   read_sweep()                The last finished sweep, None if there is none - ranges_mm has
+*                               one entry per degree clockwise from the start heading, None
+*                               where no ping landed, 9990 for no echo
+*   best_heading(ranges_mm, preferred=0)
+*                               (degrees, distance_mm) to head for from evenly spaced ranges,
+*                               as in read_sweep - None if every way is blocked
+*   motion_result()             The last motion in usecs - executed_us, paused_us,
+*                               interrupted_us, late_us, and halt_cause ("done" if none)
+*   stop_motors()               Motors off and the pins released
+*   open_log(dir=TELEMETRY_DIR) Start a telemetry log - from then on every motion and sweep is
+*                               logged as it finishes. uv1log reads it back
+*   log_sensor_events()         Log the sensor events sensord has recorded since the last call,
+*                               or since open_log - returns how many
+*   log_image(path)             Log a photo or video taken
+*   close_log()                 Finish the log - also done at exit
+*
+* Sensor memory is mapped on first use. A read is one load of the sensor
+* state word and a reset one atomic update of it, with no syscalls.
+* Motions and waits release the GIL.
+*
+* build with make uv1.so - needs the Python headers
+*/
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <stdbool.h>
+#include "gpio.h"
+#include "sensors.h"
+#include "motion.h"
+#include "pwm.h"
+#include "heading.h"
+#include "telemetry.h"
+
+static SENSOR_MEMORY *sensor_memory = NULL;
+static bool motors_ready = false;
+static MOTION_RESULT last_result;
+static bool log_open = false;
+static SENSOR_EVENT_CURSOR log_cursor;
+
+static bool map_sensor_memory(void) {
+    // Read-write without create, so resets work - sensord creates it
+    if (sensor_memory == NULL && access_sensor_memory( &sensor_memory, 0 ) < 0) {
+        sensor_memory = NULL;
+        PyErr_SetString(PyExc_OSError, "Cannot access sensor memory - is sensord running?");
+        return false;
+    }
+    return true;
+}
+
+static PyObject *uv1_read_sensors(PyObject *self, PyObject *args) {
+    (void) self;
+    (void) args;
+    if (!map_sensor_memory()) {
+        return NULL;
+    }
+    uint32_t state = read_sensor_state(sensor_memory);
+    uint64_t track = read_range_track(sensor_memory);
+    note_sensor_demand(sensor_memory);
+    int ttc_ms = range_track_ttc_ms(track, monotonic_ns());
+    PyObject *ttc = ttc_ms == TTC_NONE ? (Py_INCREF(Py_None), Py_None) : PyLong_FromLong(ttc_ms);
+
+    bool range_valid = (state & STATE_RANGE_VALID) != 0;
+    int obstacle[4];
+    int impact[2];
+    int i;
+    for (i = IDX_FWD; i <= IDX_RIGHT; i++) {
+        obstacle[i] = (state & STATE_FLAG(SENSOR_ID_OBSTACLE_F + i)) != 0;
+    }
+    for (i = IDX_FWD; i <= IDX_BACK; i++) {
+        impact[i] = (state & STATE_FLAG(SENSOR_ID_IMPACT_F + i)) != 0;
+    }
+
+    // Same keys uv1-simple.py has always used, plus each direction, the range in mm and the range track
+    return Py_BuildValue("{s:i,s:i,s:i,s:i,s:i,s:i,s:i,s:N,s:(iiii),s:(ii)}",
+                            "touch", impact[IDX_FWD] || impact[IDX_BACK],
+                            "obstacle", obstacle[IDX_FWD] || obstacle[IDX_BACK]
+                                        || obstacle[IDX_LEFT] || obstacle[IDX_RIGHT],
+                            "sound", (state & STATE_SOUND) != 0,
+                            "range", range_valid ? STATE_RANGE_CM(state) : 0,
+                            "range_mm", range_valid ? (int) (state & STATE_RANGE_MASK) : 0,
+                            "track_mm", (track & TRACK_VALID) ? TRACK_RANGE_MM(track) : 0,
+                            "closing_mm_s", (track & TRACK_VALID) ? TRACK_CLOSING_MM_S(track) : 0,
+                            "ttc_ms", ttc,
+                            "obstacles", obstacle[IDX_FWD], obstacle[IDX_BACK],
+                                        obstacle[IDX_LEFT], obstacle[IDX_RIGHT],
+                            "touches", impact[IDX_FWD], impact[IDX_BACK]);
+}
+
+static PyObject *uv1_reset_sensors(PyObject *self, PyObject *args) {
+    (void) self;
+    const char *which;
+    if (!PyArg_ParseTuple(args, "s", &which)) {
+        return NULL;
+    }
+    uint32_t reset_bits = sensor_reset_bits(which);
+    if (reset_bits == 0) {
+        PyErr_SetString(PyExc_ValueError, "reset_sensors takes any of r, o, s, i");
+        return NULL;
+    }
+    if (!map_sensor_memory()) {
+        return NULL;
+    }
+    reset_sensor_state(sensor_memory, reset_bits);
+    Py_RETURN_NONE;
+}
+
+static PyObject *uv1_wait_sensors(PyObject *self, PyObject *args) {
+    (void) self;
+    long timeout_ms;
+    if (!PyArg_ParseTuple(args, "l", &timeout_ms)) {
+        return NULL;
+    }
+    if (!map_sensor_memory()) {
+        return NULL;
+    }
+    bool changed;
+    uint32_t observed = sensor_event_count(sensor_memory);
+    Py_BEGIN_ALLOW_THREADS
+    changed = wait_sensor_event(sensor_memory, observed, timeout_ms * 1000000L);
+    Py_END_ALLOW_THREADS
+    return PyBool_FromLong(changed);
+}
+
+static PyObject *uv1_setup_motors(PyObject *self, PyObject *args, PyObject *kwargs) {
+    (void) self;
+    static char *keywords[] = { "trim_left", "trim_right", NULL };
+    int trim_left = PWM_FULL;
+    int trim_right = PWM_FULL;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|ii", keywords, &trim_left, &trim_right)) {
+        return NULL;
+    }
+    if (trim_left < 1 || trim_left > PWM_FULL || trim_right < 1 || trim_right > PWM_FULL) {
+        PyErr_SetString(PyExc_ValueError, "trim is 1-100 percent");
+        return NULL;
+    }
+    if (!motors_ready) {
+        if (!map_sensor_memory()) {
+            return NULL;
+        }
+        if (setup_gpio() < 0) {
+            PyErr_SetString(PyExc_OSError, "Cannot set up GPIO!");
+            return NULL;
+        }
+        setup_motion(sensor_memory);
+        start_pwm(&sensor_memory->pwm_stats);
+        motors_ready = true;
+    }
+    set_motor_trim(trim_left, trim_right);
+    Py_RETURN_NONE;
+}
+
+static PyObject *uv1_run_motion(PyObject *self, PyObject *args, PyObject *kwargs) {
+    (void) self;
+    static char *keywords[] = { "motion", "halts", NULL };
+    const char *motion;
+    int halts = HALT_DEFAULT;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s|i", keywords, &motion, &halts)) {
+        return NULL;
+    }
+    if (!motors_ready) {
+        PyErr_SetString(PyExc_RuntimeError, "setup_motors first");
+        return NULL;
+    }
+    if (motion_syntax_err((char *) motion)) {
+        PyErr_Format(PyExc_ValueError, "Bad motion %s", motion);
+        return NULL;
+    }
+    int interrupted_duration;
+    Py_BEGIN_ALLOW_THREADS
+    uint64_t start_ns = monotonic_ns();
+    interrupted_duration = execute_motion((char *) motion, halts, &last_result);     // Stopped if halted
+    if (log_open) {
+        log_motion_record(start_ns, motion, halts, &last_result);
+    }
+    Py_END_ALLOW_THREADS
+    return PyLong_FromLong(interrupted_duration);
+}
+
+static PyObject *uv1_sweep(PyObject *self, PyObject *args, PyObject *kwargs) {
+    (void) self;
+    static char *keywords[] = { "degrees", "ms_per_deg", "halts", NULL };
+    int degrees;
+    double ms_per_deg;
+    int halts = HALT_ON_IMPACT;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "id|i", keywords, &degrees, &ms_per_deg, &halts)) {
+        return NULL;
+    }
+    if (!motors_ready) {
+        PyErr_SetString(PyExc_RuntimeError, "setup_motors first");
+        return NULL;
+    }
+    if (degrees < -SWEEP_BINS || degrees > SWEEP_BINS || ms_per_deg <= 0) {
+        PyErr_SetString(PyExc_ValueError, "sweep is up to 360 degrees either way, at a positive ms_per_deg");
+        return NULL;
+    }
+    int interrupted_duration;
+    Py_BEGIN_ALLOW_THREADS
+    uint64_t start_ns = monotonic_ns();
+    interrupted_duration = run_sweep(degrees, ms_per_deg, halts, &last_result);      // Stopped if halted
+    if (log_open) {
+        SWEEP_PROFILE profile;
+        log_motion_record(start_ns, degrees < 0 ? "sweep RF" : "sweep FR", halts, &last_result);
+        if (read_sweep_profile(sensor_memory, &profile)) {
+            log_sweep_record(profile.start_ns, &profile);
+        }
+    }
+    Py_END_ALLOW_THREADS
+    return PyLong_FromLong(interrupted_duration);
+}
+
+static PyObject *uv1_read_sweep(PyObject *self, PyObject *args) {
+    (void) self;
+    (void) args;
+    if (!map_sensor_memory()) {
+        return NULL;
+    }
+    SWEEP_PROFILE profile;
+    if (!read_sweep_profile(sensor_memory, &profile)) {
+        Py_RETURN_NONE;
+    }
+    PyObject *ranges = PyTuple_New(SWEEP_BINS);
+    if (ranges == NULL) {
+        return NULL;
+    }
+    int i;
+    for (i = 0; i < SWEEP_BINS; i++) {
+        PyObject *range = profile.range_mm[i] == SWEEP_NO_SAMPLE ? (Py_INCREF(Py_None), Py_None)
+                                                                    : PyLong_FromLong(profile.range_mm[i]);
+        PyTuple_SET_ITEM(ranges, i, range);
+    }
+    return Py_BuildValue("{s:N,s:I,s:i,s:K}",
+                            "ranges_mm", ranges,
+                            "samples", profile.samples,
+                            "direction", profile.direction,
+                            "duration_us", (unsigned long long) ((profile.end_ns - profile.start_ns) / 1000));
+}
+
+static PyObject *uv1_best_heading(PyObject *self, PyObject *args, PyObject *kwargs) {
+    (void) self;
+    static char *keywords[] = { "ranges_mm", "preferred", NULL };
+    static uint16_t range_mm[HEADING_MAX_BINS];
+    PyObject *ranges;
+    int preferred = 0;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|i", keywords, &ranges, &preferred)) {
+        return NULL;
+    }
+    PyObject *sequence = PySequence_Fast(ranges, "ranges_mm must be a sequence");
+    if (sequence == NULL) {
+        return NULL;
+    }
+    Py_ssize_t bins = PySequence_Fast_GET_SIZE(sequence);
+    if (bins < 1 || bins > HEADING_MAX_BINS) {
+        Py_DECREF(sequence);
+        PyErr_Format(PyExc_ValueError, "ranges_mm takes 1-%d ranges", HEADING_MAX_BINS);
+        return NULL;
+    }
+    Py_ssize_t i;
+    for (i = 0; i < bins; i++) {
+        PyObject *range = PySequence_Fast_GET_ITEM(sequence, i);
+        long value = range == Py_None ? SWEEP_NO_SAMPLE : PyLong_AsLong(range);
+        if (value == -1 && PyErr_Occurred()) {
+            Py_DECREF(sequence);
+            return NULL;
+        }
+        range_mm[i] = value <= 0 ? SWEEP_NO_SAMPLE : (value > RANGE_MAX_MM ? RANGE_MAX_MM : value);
+    }
+    Py_DECREF(sequence);
+
+    HEADING best;
+    if (!best_heading(range_mm, (int) bins, preferred, &best)) {
+        Py_RETURN_NONE;
+    }
+    return Py_BuildValue("(ii)", best.degrees, best.distance_mm);
+}
+
+static PyObject *uv1_motion_result(PyObject *self, PyObject *args) {
+    (void) self;
+    (void) args;
+    return Py_BuildValue("{s:l,s:l,s:l,s:l,s:s}",
+                            "executed_us", last_result.executed_us,
+                            "paused_us", last_result.paused_us,
+                            "interrupted_us", last_result.interrupted_us,
+                            "late_us", last_result.late_us,
+                            "halt_cause", halt_cause_name(last_result.halt_cause));
+}
+
+static PyObject *uv1_stop_motors(PyObject *self, PyObject *args) {
+    (void) self;
+    (void) args;
+    if (motors_ready) {
+        Py_BEGIN_ALLOW_THREADS
+        execute_motion(MOTORS_OFF, 0, NULL);
+        stop_pwm();
+        Py_END_ALLOW_THREADS
+        motors_ready = false;
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject *uv1_open_log(PyObject *self, PyObject *args, PyObject *kwargs) {
+    (void) self;
+    static char *keywords[] = { "dir", NULL };
+    const char *dir = TELEMETRY_DIR;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|s", keywords, &dir)) {
+        return NULL;
+    }
+    if (log_open) {
+        PyErr_SetString(PyExc_RuntimeError, "log already open");
+        return NULL;
+    }
+    if (!map_sensor_memory()) {
+        return NULL;
+    }
+    if (open_telemetry(dir) < 0) {
+        PyErr_Format(PyExc_OSError, "Cannot open telemetry log in %s", dir);
+        return NULL;
+    }
+    open_sensor_event_cursor(sensor_memory, &log_cursor);
+    log_open = true;
+    Py_RETURN_NONE;
+}
+
+static PyObject *uv1_log_sensor_events(PyObject *self, PyObject *args) {
+    (void) self;
+    (void) args;
+    if (!log_open) {
+        PyErr_SetString(PyExc_RuntimeError, "open_log first");
+        return NULL;
+    }
+    long logged = 0;
+    SENSOR_EVENT event;
+    while (next_sensor_event(sensor_memory, &log_cursor, &event)) {
+        log_sensor_record(event.timestamp_ns, event.sensor_id, event.value);
+        logged++;
+    }
+    return PyLong_FromLong(logged);
+}
+
+static PyObject *uv1_log_image(PyObject *self, PyObject *args) {
+    (void) self;
+    const char *path;
+    if (!PyArg_ParseTuple(args, "s", &path)) {
+        return NULL;
+    }
+    if (!log_open) {
+        PyErr_SetString(PyExc_RuntimeError, "open_log first");
+        return NULL;
+    }
+    log_image_record(monotonic_ns(), path);
+    Py_RETURN_NONE;
+}
+
+static PyObject *uv1_close_log(PyObject *self, PyObject *args) {
+    (void) self;
+    (void) args;
+    if (log_open) {
+        log_open = false;
+        Py_BEGIN_ALLOW_THREADS
+        close_telemetry();
+        Py_END_ALLOW_THREADS
+    }
+    Py_RETURN_NONE;
+}
+
+static PyMethodDef uv1_methods[] = {
+    { "read_sensors", uv1_read_sensors, METH_NOARGS, "Snapshot of the sensor data as a dict" },
+    { "reset_sensors", uv1_reset_sensors, METH_VARARGS, "Clear readings - any of 'rosi'" },
+    { "wait_sensors", uv1_wait_sensors, METH_VARARGS, "Sleep until a halt relevant change or timeout_ms" },
+    { "setup_motors", (PyCFunction) (void (*)(void)) uv1_setup_motors, METH_VARARGS | METH_KEYWORDS,
+        "Take the motor pins, with trim percent for each motor" },
+    { "run_motion", (PyCFunction) (void (*)(void)) uv1_run_motion, METH_VARARGS | METH_KEYWORDS,
+        "Run a motion - returns the interrupted duration in ms, 0 if completed" },
+    { "sweep", (PyCFunction) (void (*)(void)) uv1_sweep, METH_VARARGS | METH_KEYWORDS,
+        "Turn in place taking a range sweep - returns the interrupted duration in ms" },
+    { "read_sweep", uv1_read_sweep, METH_NOARGS, "Ranges by degree of heading from the last sweep" },
+    { "best_heading", (PyCFunction) (void (*)(void)) uv1_best_heading, METH_VARARGS | METH_KEYWORDS,
+        "Heading and clear distance to go from evenly spaced ranges" },
+    { "motion_result", uv1_motion_result, METH_NOARGS, "Times in usecs and halt cause of the last motion" },
+    { "stop_motors", uv1_stop_motors, METH_NOARGS, "Motors off and the pins released" },
+    { "open_log", (PyCFunction) (void (*)(void)) uv1_open_log, METH_VARARGS | METH_KEYWORDS,
+        "Start a telemetry log - motions and sweeps are logged from then on" },
+    { "log_sensor_events", uv1_log_sensor_events, METH_NOARGS,
+        "Log sensor events since the last call - returns how many" },
+    { "log_image", uv1_log_image, METH_VARARGS, "Log a photo or video taken" },
+    { "close_log", uv1_close_log, METH_NOARGS, "Finish the telemetry log" },
+    { NULL, NULL, 0, NULL }
+};
+
+static struct PyModuleDef uv1_module = {
+    PyModuleDef_HEAD_INIT, "uv1", "UV1 sensors and motors", -1, uv1_methods, NULL, NULL, NULL, NULL
+};
+
+PyMODINIT_FUNC PyInit_uv1(void) {
+    PyObject *module = PyModule_Create(&uv1_module);
+    if (module == NULL) {
+        return NULL;
+    }
+    PyModule_AddIntConstant(module, "HALT_ON_IMPACT", HALT_ON_IMPACT);
+    PyModule_AddIntConstant(module, "HALT_ON_OBSTACLE", HALT_ON_OBSTACLE);
+    PyModule_AddIntConstant(module, "HALT_PAUSE_ON_OBSTACLE", HALT_PAUSE_ON_OBSTACLE);
+    PyModule_AddIntConstant(module, "HALT_ON_TTC", HALT_ON_TTC);
+    PyModule_AddIntConstant(module, "HALT_DEFAULT", HALT_DEFAULT);
+    Py_AtExit(close_telemetry);
+    return module;
+}
@@ -0,0 +1,199 @@
+/**
+* uv1stat.c - Print sensord and motor hot path statistics, like vmstat
+*
+* Usage: uv1stat [-H] [interval_secs [count]]
+*
+* Each line shows rates and latency percentiles over the last interval.
+* -H prints the full latency histograms since sensord started instead.
+* Latencies come from sensor_memory->stats, which is only filled in
+* when sensord and actuatord are built with STATS=1.
+*/
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "sensors.h"
+
+#define HEADER_EVERY    20      // Lines between repeated headers
+
+void print_histograms(SENSOR_STATS *);
+void print_histogram(char *, uint64_t *);
+double percentile_us(uint64_t *, uint64_t *, double);
+uint64_t total_glitches(FILTER_STATS *);
+
+static SENSOR_MEMORY *sensor_memory;
+
+int main(int argc, char **argv) {
+    bool histograms = false;
+    int interval = 1;
+    int count = -1;         // Forever
+    int arg = 1;
+
+    if (arg < argc && strcmp("-H", argv[arg]) == 0) {
+        histograms = true;
+        arg++;
+    }
+    if (arg < argc) {
+        interval = atoi(argv[arg++]);
+    }
+    if (arg < argc) {
+        count = atoi(argv[arg++]);
+    }
+    if (arg < argc || interval <= 0) {
+        fprintf(stderr, "Usage: uv1stat [-H] [interval_secs [count]]\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (access_sensor_memory( &sensor_memory, SENSOR_MEMORY_RDONLY ) < 0)
+    {
+        fprintf(stderr, "Cannot access sensor memory!\n");
+        exit(EXIT_FAILURE);
+    }
+    SENSOR_STATS *stats = &sensor_memory->stats;
+    if (!stats->enabled) {
+        fprintf(stderr, "sensord was built without STATS=1 - latencies will be empty\n");
+    }
+
+    if (histograms) {
+        print_histograms(stats);
+        release_sensor_memory(sensor_memory);
+        exit(EXIT_SUCCESS);
+    }
+
+    // Each line is the difference from the previous copy
+    SENSOR_STATS last;
+    PING_STATS last_ping;
+    PUBLISH_STATS last_publish;
+    uint64_t last_glitches = total_glitches(&sensor_memory->filter_stats);
+    memcpy(&last, stats, sizeof(SENSOR_STATS));
+    memcpy(&last_ping, &sensor_memory->ping_stats, sizeof(PING_STATS));
+    memcpy(&last_publish, &sensor_memory->publish_stats, sizeof(PUBLISH_STATS));
+    int line;
+
+    for (line = 0; count < 0 || line < count; line++) {
+        sleep(interval);
+
+        SENSOR_STATS now;
+        PING_STATS now_ping;
+        PUBLISH_STATS now_publish;
+        memcpy(&now, stats, sizeof(SENSOR_STATS));
+        memcpy(&now_ping, &sensor_memory->ping_stats, sizeof(PING_STATS));
+        memcpy(&now_publish, &sensor_memory->publish_stats, sizeof(PUBLISH_STATS));
+        uint64_t now_glitches = total_glitches(&sensor_memory->filter_stats);
+
+        if (line % HEADER_EVERY == 0) {
+            printf("%8s %7s %7s %8s %6s %6s %6s %9s %9s %9s %9s %9s %9s %8s\n",
+                    "edges/s", "pub/s", "merge/s", "glitch/s", "halt/s", "ping/s", "echo%",
+                    "pub_p50", "pub_p99", "echo_p50", "echo_p99", "halt_p50", "halt_p99", "pwm_jit");
+            printf("%8s %7s %7s %8s %6s %6s %6s %9s %9s %9s %9s %9s %9s %8s\n",
+                    "", "", "", "", "", "", "", "us", "us", "us", "us", "us", "us", "us");
+        }
+
+        uint64_t pings = now_ping.pings - last_ping.pings;
+        uint64_t echoes = now_ping.echoes - last_ping.echoes;
+        printf("%8llu %7llu %7llu %8llu %6llu %6llu %6.1f %9.1f %9.1f %9.1f %9.1f %9.1f %9.1f %8.1f\n",
+                (unsigned long long) (now_publish.edges - last_publish.edges) / interval,
+                (unsigned long long) (now_publish.publishes - last_publish.publishes) / interval,
+                (unsigned long long) (now_publish.merged - last_publish.merged) / interval,
+                (unsigned long long) (now_glitches - last_glitches) / interval,
+                (unsigned long long) (now.halts - last.halts) / interval,
+                (unsigned long long) pings / interval,
+                pings > 0 ? 100.0 * echoes / pings : 0.0,
+                percentile_us(now.publish_ns, last.publish_ns, 0.50),
+                percentile_us(now.publish_ns, last.publish_ns, 0.99),
+                percentile_us(now.echo_ns, last.echo_ns, 0.50),
+                percentile_us(now.echo_ns, last.echo_ns, 0.99),
+                percentile_us(now.halt_ns, last.halt_ns, 0.50),
+                percentile_us(now.halt_ns, last.halt_ns, 0.99),
+                sensor_memory->pwm_stats.mean_jitter_ns / 1000.0);
+        fflush(stdout);
+
+        memcpy(&last, &now, sizeof(SENSOR_STATS));
+        memcpy(&last_ping, &now_ping, sizeof(PING_STATS));
+        memcpy(&last_publish, &now_publish, sizeof(PUBLISH_STATS));
+        last_glitches = now_glitches;
+    }
+
+    release_sensor_memory(sensor_memory);
+    exit(EXIT_SUCCESS);
+}
+
+uint64_t total_glitches(FILTER_STATS *filter_stats) {
+    uint64_t total = 0;
+    int i;
+    for (i = 0; i < SENSOR_ID_COUNT; i++) {
+        total += filter_stats->glitches[i];
+    }
+    return total;
+}
+
+double percentile_us(uint64_t *now, uint64_t *last, double fraction) {
+    // Upper bound of the bucket holding the percentile of the interval's samples, 0 if none
+    uint64_t total = 0;
+    int bucket;
+    for (bucket = 0; bucket < STATS_BUCKETS; bucket++) {
+        total += now[bucket] - last[bucket];
+    }
+    if (total == 0) {
+        return 0.0;
+    }
+    uint64_t seen = 0;
+    for (bucket = 0; bucket < STATS_BUCKETS; bucket++) {
+        seen += now[bucket] - last[bucket];
+        if (seen >= fraction * total) {
+            break;
+        }
+    }
+    return (double) (1ULL << bucket) / 1000.0;
+}
+
+void print_histograms(SENSOR_STATS *stats) {
+    int i;
+
+    printf("handler calls\n");
+    for (i = 0; i < SENSOR_ID_COUNT; i++) {
+        printf("  %-12s %12llu\n", sensor_name(i), (unsigned long long) stats->handler_calls[i]);
+    }
+    FILTER_STATS *filter_stats = &sensor_memory->filter_stats;
+    printf("glitches rejected                 min pulse   debounce     releases       hold    release\n");
+    for (i = SENSOR_ID_OBSTACLE_F; i < SENSOR_ID_COUNT; i++) {
+        printf("  %-12s %12llu %12u us %7u us", sensor_name(i),
+                (unsigned long long) filter_stats->glitches[i],
+                filter_stats->min_pulse_us[i], filter_stats->debounce_us[i]);
+        if (filter_stats->hold_us[i] < 0) {
+            printf(" %12s\n", "latched");
+        } else {
+            printf(" %12llu %7d us %7d us\n", (unsigned long long) filter_stats->releases[i],
+                    filter_stats->hold_us[i], filter_stats->release_us[i]);
+        }
+    }
+    PUBLISH_STATS *publish_stats = &sensor_memory->publish_stats;
+    printf("edges          %12llu\n", (unsigned long long) publish_stats->edges);
+    printf("updates        %12llu\n", (unsigned long long) publish_stats->updates);
+    printf("  merged       %12llu   (%u us window)\n",
+            (unsigned long long) publish_stats->merged, publish_stats->window_us);
+    printf("  immediate    %12llu\n", (unsigned long long) publish_stats->immediate);
+    printf("publishes      %12llu\n", (unsigned long long) stats->publishes);
+    printf("halt signals   %12llu\n", (unsigned long long) stats->halt_signals);
+    printf("halts          %12llu\n", (unsigned long long) stats->halts);
+
+    print_histogram("publish latency (handler entry to published)", stats->publish_ns);
+    print_histogram("ping round trip (trigger to echo complete)", stats->echo_ns);
+    print_histogram("halt reaction (halt signal to motion stopped)", stats->halt_ns);
+}
+
+void print_histogram(char *title, uint64_t *histogram) {
+    int bucket;
+    printf("\n%s\n", title);
+    for (bucket = 0; bucket < STATS_BUCKETS; bucket++) {
+        if (histogram[bucket] == 0) {
+            continue;
+        }
+        uint64_t low = bucket == 0 ? 0 : 1ULL << (bucket - 1);
+        printf("  %12llu - %12llu ns %12llu\n",
+                (unsigned long long) low, (unsigned long long) (1ULL << bucket),
+                (unsigned long long) histogram[bucket]);
+    }
+}